@@ -0,0 +1,225 @@
+#include "anim.h"
+#include "seq.h"
+#include "shp.h"
+#include "util.h"
+
+enum {
+    // World units per sheet pixel.
+    ANIM_PIXEL_SCALE = 1,
+};
+
+static const struct {
+    const char* name;
+    file_entry_e shp;
+    file_entry_e seq;
+} _shapes[ANIM_SHAPE_COUNT] = {
+    [ANIM_SHAPE_TYPE1] = { "TYPE1", F_BATTLE__TYPE1_SHP, F_BATTLE__TYPE1_SEQ },
+    [ANIM_SHAPE_TYPE2] = { "TYPE2", F_BATTLE__TYPE2_SHP, F_BATTLE__TYPE2_SEQ },
+    [ANIM_SHAPE_TYPE3] = { "TYPE3", F_BATTLE__TYPE2_SHP, F_BATTLE__TYPE3_SEQ },
+    [ANIM_SHAPE_TYPE4] = { "TYPE4", F_BATTLE__TYPE2_SHP, F_BATTLE__TYPE4_SEQ },
+    [ANIM_SHAPE_MON] = { "MON", F_BATTLE__MON_SHP, F_BATTLE__MON_SEQ },
+    [ANIM_SHAPE_OTHER] = { "OTHER", F_BATTLE__OTHER_SHP, F_BATTLE__OTHER_SEQ },
+    [ANIM_SHAPE_ARUTE] = { "ARUTE", F_BATTLE__ARUTE_SHP, F_BATTLE__ARUTE_SEQ },
+    [ANIM_SHAPE_CYOKO] = { "CYOKO", F_BATTLE__CYOKO_SHP, F_BATTLE__CYOKO_SEQ },
+    [ANIM_SHAPE_KANZEN] = { "KANZEN", F_BATTLE__KANZEN_SHP, F_BATTLE__KANZEN_SEQ },
+};
+
+// anim_t only holds what the per frame update touches, the step table of its
+// sequence is shared with every animation of the same shape.
+typedef struct {
+    anim_desc_t desc;
+    const seq_step_t* steps;
+    int step_count;
+    const shp_t* shp;
+    int step;
+    int ticks;
+    bool dirty; // The step changed and the sprites need to be rewritten
+    bool active;
+} anim_t;
+
+static struct {
+    anim_t anims[ANIM_MAX];
+
+    // Loaded the first time a shape is used. Shapes that share an SHP file
+    // share the frames.
+    shp_t shps[ANIM_SHAPE_COUNT];
+    seq_t seqs[ANIM_SHAPE_COUNT];
+} _state;
+
+static const shp_t* _get_shp(anim_shape_e);
+static const seq_t* _get_seq(anim_shape_e);
+static void _write_sprites(int);
+
+void anim_reset(void) {
+    for (int i = 0; i < ANIM_MAX; i++) {
+        anim_stop(i);
+    }
+}
+
+void anim_shutdown(void) {
+    anim_reset();
+    for (int i = 0; i < ANIM_SHAPE_COUNT; i++) {
+        if (_state.shps[i].valid) {
+            shp_destroy(_state.shps[i]);
+        }
+        if (_state.seqs[i].valid) {
+            seq_destroy(_state.seqs[i]);
+        }
+        _state.shps[i] = (shp_t) { 0 };
+        _state.seqs[i] = (seq_t) { 0 };
+    }
+}
+
+// anim_update advances every active animation by one tick, then rewrites the
+// sprites of the ones that changed frame.
+void anim_update(void) {
+    for (int i = 0; i < ANIM_MAX; i++) {
+        anim_t* anim = &_state.anims[i];
+        if (!anim->active) {
+            continue;
+        }
+        if (++anim->ticks >= anim->steps[anim->step].duration) {
+            anim->ticks = 0;
+            anim->step = (anim->step + 1) % anim->step_count;
+            anim->dirty = true;
+        }
+    }
+
+    for (int i = 0; i < ANIM_MAX; i++) {
+        if (_state.anims[i].active && _state.anims[i].dirty) {
+            _write_sprites(i);
+            _state.anims[i].dirty = false;
+        }
+    }
+}
+
+// anim_start starts playing a sequence and returns the animation's id, or -1
+// if all animations are in use or the sequence is empty.
+int anim_start(anim_desc_t desc) {
+    ASSERT(spr_is_sheet(desc.spr), "%s is not an SPR file", file_list[desc.spr].name);
+    ASSERT(desc.shape < ANIM_SHAPE_COUNT, "Invalid animation shape %d", desc.shape);
+    ASSERT(desc.palette < SPR_UNIT_PALETTE_COUNT, "Invalid SPR palette %d", desc.palette);
+
+    const seq_t* seq = _get_seq(desc.shape);
+    if (desc.sequence < 0 || desc.sequence >= seq->sequence_count) {
+        return -1;
+    }
+    seq_sequence_t sequence = seq->sequences[desc.sequence];
+    if (sequence.count == 0) {
+        return -1;
+    }
+
+    for (int i = 0; i < ANIM_MAX; i++) {
+        if (_state.anims[i].active) {
+            continue;
+        }
+        _state.anims[i] = (anim_t) {
+            .desc = desc,
+            .steps = &seq->steps[sequence.first],
+            .step_count = sequence.count,
+            .shp = _get_shp(desc.shape),
+            .dirty = true,
+            .active = true,
+        };
+        return i;
+    }
+    return -1;
+}
+
+void anim_stop(int id) {
+    ASSERT(id >= 0 && id < ANIM_MAX, "Invalid animation %d", id);
+    _state.anims[id].active = false;
+
+    sprite_t* sprites = &gfx_sprite_get_internals()[SPRITE_ANIM_FIRST + id * ANIM_PIECE_MAX];
+    for (int i = 0; i < ANIM_PIECE_MAX; i++) {
+        sprites[i] = (sprite_t) { 0 };
+    }
+}
+
+int anim_get_active_count(void) {
+    int count = 0;
+    for (int i = 0; i < ANIM_MAX; i++) {
+        count += _state.anims[i].active;
+    }
+    return count;
+}
+
+const char* anim_shape_str(anim_shape_e shape) {
+    return _shapes[shape].name;
+}
+
+static const shp_t* _get_shp(anim_shape_e shape) {
+    if (_state.shps[shape].valid) {
+        return &_state.shps[shape];
+    }
+    for (int i = 0; i < ANIM_SHAPE_COUNT; i++) {
+        if (_state.shps[i].valid && _shapes[i].shp == _shapes[shape].shp) {
+            return &_state.shps[i];
+        }
+    }
+    _state.shps[shape] = shp_read(_shapes[shape].shp);
+    return &_state.shps[shape];
+}
+
+static const seq_t* _get_seq(anim_shape_e shape) {
+    if (!_state.seqs[shape].valid) {
+        _state.seqs[shape] = seq_read(_shapes[shape].seq);
+    }
+    return &_state.seqs[shape];
+}
+
+// Write one 3D sprite per piece of the animation's current frame. Pieces are
+// placed relative to the unit's feet, y down in the sheet and up in the world.
+static void _write_sprites(int id) {
+    const anim_t* anim = &_state.anims[id];
+    const seq_step_t* step = &anim->steps[anim->step];
+
+    sprite_t* sprites = &gfx_sprite_get_internals()[SPRITE_ANIM_FIRST + id * ANIM_PIECE_MAX];
+    for (int i = 0; i < ANIM_PIECE_MAX; i++) {
+        sprites[i] = (sprite_t) { 0 };
+    }
+
+    if (step->frame >= anim->shp->frame_count) {
+        return;
+    }
+
+    const shp_frame_t* frame = &anim->shp->frames[step->frame];
+    bool step_flip_x = (step->flags & SEQ_STEP_FLIP_X) != 0;
+    bool step_flip_y = (step->flags & SEQ_STEP_FLIP_Y) != 0;
+
+    for (int i = 0; i < MIN(frame->piece_count, ANIM_PIECE_MAX); i++) {
+        const shp_piece_t* piece = &frame->pieces[i];
+        f32 width = piece->region.width;
+        f32 height = piece->region.height;
+
+        sprite_sheet_t sheet = gfx_sprite_get_frame(anim->desc.spr, piece->region);
+        transform_t transform = {
+            .translation = anim->desc.position,
+            .scale = { { width * 0.5f * ANIM_PIXEL_SCALE, height * 0.5f * ANIM_PIXEL_SCALE, 1.0f } },
+        };
+        sprite_t sprite = gfx_sprite_create(SPRITE_3D, sheet, anim->desc.palette, (vec2s) { { 0.0f, 0.0f } }, (vec2s) { { width, height } }, transform);
+
+        f32 x = piece->x + step->offset_x + width * 0.5f;
+        f32 y = -(piece->y + step->offset_y + height * 0.5f);
+        if (step_flip_x) {
+            x = -x;
+        }
+        if (step_flip_y) {
+            y = -y;
+        }
+        sprite.offset = (vec2s) { { x * ANIM_PIXEL_SCALE, y * ANIM_PIXEL_SCALE } };
+
+        if (piece->flip_x != step_flip_x) {
+            f32 u = sprite.uv_min.x;
+            sprite.uv_min.x = sprite.uv_max.x;
+            sprite.uv_max.x = u;
+        }
+        if (piece->flip_y != step_flip_y) {
+            f32 v = sprite.uv_min.y;
+            sprite.uv_min.y = sprite.uv_max.y;
+            sprite.uv_max.y = v;
+        }
+
+        sprites[i] = sprite;
+    }
+}
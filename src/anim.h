@@ -0,0 +1,47 @@
+// anim plays SEQ sequences with SPR sheets. All animations advance together
+// in anim_update(), once per frame, and write the pieces of their current
+// frame to the sprites from SPRITE_ANIM_FIRST.
+#pragma once
+
+#include <stdbool.h>
+
+#include "cglm/types-struct.h"
+
+#include "filesystem.h"
+#include "gfx_sprite.h"
+
+enum {
+    ANIM_MAX = 16,
+    ANIM_PIECE_MAX = (SPRITE_MAX - SPRITE_ANIM_FIRST) / ANIM_MAX,
+};
+
+// The SHP and SEQ files a sheet is animated with.
+typedef enum {
+    ANIM_SHAPE_TYPE1,
+    ANIM_SHAPE_TYPE2,
+    ANIM_SHAPE_TYPE3,
+    ANIM_SHAPE_TYPE4,
+    ANIM_SHAPE_MON,
+    ANIM_SHAPE_OTHER,
+    ANIM_SHAPE_ARUTE,
+    ANIM_SHAPE_CYOKO,
+    ANIM_SHAPE_KANZEN,
+    ANIM_SHAPE_COUNT,
+} anim_shape_e;
+
+typedef struct {
+    file_entry_e spr;
+    anim_shape_e shape;
+    int sequence;
+    int palette;
+    vec3s position; // The unit's feet
+} anim_desc_t;
+
+void anim_reset(void);
+void anim_shutdown(void);
+void anim_update(void);
+
+int anim_start(anim_desc_t);
+void anim_stop(int);
+int anim_get_active_count(void);
+const char* anim_shape_str(anim_shape_e);
@@ -0,0 +1,54 @@
+#include "atlas.h"
+
+atlas_t atlas_create(int width, int height) {
+    return (atlas_t) {
+        .width = width,
+        .height = height,
+    };
+}
+
+// atlas_alloc returns the rectangle for an image of the size, or an invalid
+// rectangle if the atlas is full.
+atlas_rect_t atlas_alloc(atlas_t* atlas, int width, int height) {
+    if (width > atlas->width) {
+        return (atlas_rect_t) { 0 };
+    }
+
+    atlas_shelf_t* best = NULL;
+    for (int i = 0; i < atlas->shelf_count; i++) {
+        atlas_shelf_t* shelf = &atlas->shelves[i];
+        if (shelf->height < height || atlas->width - shelf->used_width < width) {
+            continue;
+        }
+        if (best == NULL || shelf->height < best->height) {
+            best = shelf;
+        }
+    }
+
+    if (best == NULL) {
+        int y = 0;
+        if (atlas->shelf_count > 0) {
+            atlas_shelf_t* last = &atlas->shelves[atlas->shelf_count - 1];
+            y = last->y + last->height;
+        }
+        if (atlas->shelf_count >= ATLAS_SHELF_MAX || y + height > atlas->height) {
+            return (atlas_rect_t) { 0 };
+        }
+
+        best = &atlas->shelves[atlas->shelf_count++];
+        *best = (atlas_shelf_t) {
+            .y = y,
+            .height = height,
+        };
+    }
+
+    atlas_rect_t rect = {
+        .x = best->used_width,
+        .y = best->y,
+        .width = width,
+        .height = height,
+        .valid = true,
+    };
+    best->used_width += width;
+    return rect;
+}
@@ -0,0 +1,38 @@
+// atlas_t is a rectangle allocator for packing images into a texture atlas.
+//
+// Rectangles are placed on shelves, rows of the atlas as tall as the first
+// rectangle placed on them, filled left to right. Each rectangle goes on the
+// shelf that wastes the least height, or a new shelf if none fit.
+#pragma once
+
+#include <stdbool.h>
+
+#include "defines.h"
+
+enum {
+    ATLAS_SHELF_MAX = 64,
+};
+
+typedef struct {
+    int x;
+    int y;
+    int width;
+    int height;
+    bool valid;
+} atlas_rect_t;
+
+typedef struct {
+    int y;
+    int height;
+    int used_width;
+} atlas_shelf_t;
+
+typedef struct {
+    int width;
+    int height;
+    atlas_shelf_t shelves[ATLAS_SHELF_MAX];
+    int shelf_count;
+} atlas_t;
+
+atlas_t atlas_create(int, int);
+atlas_rect_t atlas_alloc(atlas_t*, int, int);
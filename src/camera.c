@@ -1,3 +1,5 @@
+#include <string.h>
+
 #include "cglm/struct/cam.h"
 #include "cglm/struct/vec3.h"
 #include "cglm/types-struct.h"
@@ -14,6 +16,7 @@ static const f32 ZOOM_SENSITIVITY = 0.002f;
 static const vec3s INVERTED_YUP = { { 0.0f, -1.0f, 0.0f } };
 
 static camera_t _state;
+static camera_t _rendered; // The state the last rendered frame used
 
 static vec3s _to_cartesian(spherical_t);
 static spherical_t _to_spherical(vec3s);
@@ -92,6 +95,18 @@ void camera_set_orbit(vec3s center, f32 theta, f32 phi, f32 distance) {
     _state.pitch_rad = asinf(forward.y);
 }
 
+// camera_focus_position returns where the camera has to move to center the
+// target without changing its direction or its distance along the view axis.
+vec3s camera_focus_position(vec3s target) {
+    vec3s forward = { {
+        cosf(_state.pitch_rad) * sinf(_state.yaw_rad),
+        sinf(_state.pitch_rad),
+        cosf(_state.pitch_rad) * cosf(_state.yaw_rad),
+    } };
+    f32 distance = glms_vec3_dot(glms_vec3_sub(target, _state.position), forward);
+    return glms_vec3_sub(target, glms_vec3_scale(forward, distance));
+}
+
 spherical_t camera_get_spherical(void) {
     return _to_spherical(_state.position);
 }
@@ -137,6 +152,13 @@ static spherical_t _to_spherical(vec3s pos) {
     return s;
 }
 
+// camera_changed returns whether the camera moved since the last call.
+bool camera_changed(void) {
+    bool changed = memcmp(&_rendered, &_state, sizeof(camera_t)) != 0;
+    _rendered = _state;
+    return changed;
+}
+
 camera_t* camera_get_internals(void) {
     return &_state;
 }
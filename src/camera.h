@@ -50,6 +50,8 @@ void camera_orbit_motion(orbit_motion_t);
 
 void camera_set_orbit(vec3s, f32, f32, f32);
 void camera_set_freefly(vec3s, f32, f32, f32);
+vec3s camera_focus_position(vec3s);
 
+bool camera_changed(void);
 camera_t* camera_get_internals(void);
 spherical_t camera_get_spherical(void);
@@ -3,6 +3,7 @@
 
 #include "filesystem.h"
 #include "memory.h"
+#include "trace.h"
 #include "util.h"
 
 enum {
@@ -58,6 +59,7 @@ void filesystem_shutdown(void) {
 }
 
 span_t filesystem_read_file(file_entry_e file) {
+    TRACE_BEGIN();
     if (_state.cache.files[file] == NULL) {
         u8* bytes = memory_allocate(file_list[file].size);
         _read_file(file, bytes);
@@ -72,6 +74,7 @@ span_t filesystem_read_file(file_entry_e file) {
         .size = file_list[file].size,
     };
 
+    TRACE_END();
     return span;
 }
 
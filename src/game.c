@@ -1,13 +1,19 @@
 #include "game.h"
+#include "anim.h"
 #include "camera.h"
 #include "filesystem.h"
 #include "font.h"
 #include "gfx.h"
 #include "gui.h"
+#include "image.h"
 #include "memory.h"
+#include "profile.h"
 #include "scene.h"
+#include "sim.h"
 #include "time.h"
+#include "trace.h"
 #include "vm.h"
+#include "vm_transition.h"
 
 #if defined(__EMSCRIPTEN__)
 #    include <emscripten/emscripten.h>
@@ -28,6 +34,7 @@ void data_init(void) {
 void game_init(void) {
     memory_init();
     time_init();
+    sim_init();
     vm_init();
     gfx_init();
     gui_init();
@@ -43,6 +50,9 @@ void game_shutdown(void) {
     font_shutdown();
     gui_shutdown();
     gfx_shutdown();
+    anim_shutdown();
+    image_cache_shutdown();
+    trace_shutdown();
     memory_shutdown();
 }
 
@@ -50,12 +60,33 @@ void game_update(void) {
     if (!data_initialized) {
         return;
     }
+    profile_frame_begin();
     time_update();
-    vm_update();
-    scene_render();
+
+    // The VM and animations run in fixed steps, as many as the time since the
+    // last frame covers. Transitions are then placed between the last step
+    // and the next for rendering.
+    int steps = sim_advance();
+    for (int i = 0; i < steps; i++) {
+        profile_begin(PROFILE_STAGE_VM);
+        vm_update();
+        profile_end(PROFILE_STAGE_VM);
+
+        profile_begin(PROFILE_STAGE_ANIM);
+        anim_update();
+        profile_end(PROFILE_STAGE_ANIM);
+    }
+    vm_transition_interpolate(sim_get_alpha());
+
+    bool rendered = scene_render();
+    profile_frame_end();
+    gfx_auto_scale_update(profile_get_last_frame()->frame_ms);
+
+    gfx_idle_throttle(rendered);
 }
 
 void game_input(const sapp_event* event) {
+    gfx_idle_wake();
     bool handled_by_ui = gui_input(event);
     bool is_mouse_event = event->type == SAPP_EVENTTYPE_MOUSE_MOVE
         || event->type == SAPP_EVENTTYPE_MOUSE_SCROLL
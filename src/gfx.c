@@ -1,51 +1,61 @@
+// nanosleep is POSIX, strict C11 hides it otherwise.
+#define _POSIX_C_SOURCE 200809L
+
+#if defined(_WIN32)
+#    define WIN32_LEAN_AND_MEAN
+#    include <windows.h>
+#elif !defined(__EMSCRIPTEN__)
+#    include <time.h>
+#endif
+
 #include "gfx_model.h"
 #include "sokol_app.h"
 #include "sokol_gfx.h"
 #include "sokol_glue.h"
 #include "sokol_log.h"
+#include "sokol_time.h"
 
 #include "gfx.h"
 #include "gfx_background.h"
 #include "gfx_line.h"
 #include "gfx_sprite.h"
+#include "gfx_tile.h"
 #include "gui.h"
+#include "profile.h"
 #include "shape.h"
+#include "util.h"
+
+// When idle throttling is on and nothing was rendered for a while, frames are
+// spaced out to save power. Input wakes it up again.
+static const f64 IDLE_DELAY_SECONDS = 1.0;
+static const f64 IDLE_FRAME_SECONDS = 1.0 / 10.0;
 
 // Global gfx state
 static gfx_t _state;
 
+static void _display_pass(void);
+static void _sleep(f64);
+static gfx_target_t* _target_get(int);
+
 // There are two passes so we can render the offscreen image to a fullscreen
 // quad. The offscreen is rendered in a lower resolution and then upscaled to
 // the window size to keep the pixelated look.
 void gfx_init(void) {
     _state.dither = true;
+    _state.last_dither = true;
+    _state.on_demand = true;
+    _state.invalidated = true;
+    _state.scale = GFX_SCALE_MIN;
+    _state.scale_budget_ms = 1000.0f / 60.0f;
+    _state.scale_limit = GFX_SCALE_MAX + 1;
 
     sg_setup(&(sg_desc) {
         .environment = sglue_environment(),
         .logger.func = slog_func,
     });
+    sg_enable_frame_stats();
 
-    _state.color_image = sg_make_image(&(sg_image_desc) {
-        .render_target = true,
-        .width = GFX_RENDER_WIDTH,
-        .height = GFX_RENDER_HEIGHT,
-        .pixel_format = SG_PIXELFORMAT_RGBA8,
-        .label = "color-image",
-    });
-
-    _state.depth_image = sg_make_image(&(sg_image_desc) {
-        .render_target = true,
-        .width = GFX_RENDER_WIDTH,
-        .height = GFX_RENDER_HEIGHT,
-        .pixel_format = SG_PIXELFORMAT_DEPTH,
-        .label = "depth-image",
-    });
-
-    _state.attachments = sg_make_attachments(&(sg_attachments_desc) {
-        .colors[0].image = _state.color_image,
-        .depth_stencil.image = _state.depth_image,
-        .label = "offscreen-attachments",
-    });
+    _target_get(_state.scale);
 
     _state.sampler = sg_make_sampler(&(sg_sampler_desc) {
         .min_filter = SG_FILTER_NEAREST,
@@ -63,11 +73,14 @@ void gfx_init(void) {
     gfx_sprite_init();
     gfx_background_init();
     gfx_line_init();
+    gfx_tile_init();
 }
 
 void gfx_render_begin(void) {
+    _state.frame_stats.rendered++;
+    _state.rendered_this_frame = true;
     sg_begin_pass(&(sg_pass) {
-        .attachments = _state.attachments,
+        .attachments = _target_get(_state.scale)->attachments,
         .action = {
             .colors[0] = (sg_color_attachment_action) {
                 .load_action = SG_LOADACTION_CLEAR,
@@ -85,7 +98,156 @@ void gfx_render_begin(void) {
 void gfx_render_end(void) {
     // End pass for user rendering
     sg_end_pass();
+    _display_pass();
+}
+
+// gfx_render_skip keeps the offscreen image from the last rendered frame and
+// only draws the display pass.
+void gfx_render_skip(void) {
+    _state.frame_stats.skipped++;
+    _display_pass();
+}
+
+// gfx_invalidate requests the offscreen pass for the next frame. It is used
+// for changes that are not caught by comparing state, like a new model or
+// background.
+void gfx_invalidate(void) {
+    _state.invalidated = true;
+}
+
+// gfx_take_invalidated returns whether the offscreen image is out of date
+// and clears the request. It is always true when on demand rendering is off.
+bool gfx_take_invalidated(void) {
+    bool invalidated = _state.invalidated || !_state.on_demand || _state.dither != _state.last_dither;
+    _state.invalidated = false;
+    _state.last_dither = _state.dither;
+    return invalidated;
+}
+
+// gfx_idle_throttle is called at the end of every frame with whether the
+// offscreen pass ran. Once idle, it sleeps to keep frames IDLE_FRAME_SECONDS
+// apart.
+void gfx_idle_throttle(bool rendered) {
+    u64 now = stm_now();
+    if (rendered || _state.last_active_time == 0) {
+        _state.last_active_time = now;
+    }
+
+    bool idle = stm_sec(stm_diff(now, _state.last_active_time)) > IDLE_DELAY_SECONDS;
+    if (_state.idle_throttle && idle) {
+        _sleep(IDLE_FRAME_SECONDS - stm_sec(stm_diff(now, _state.last_frame_time)));
+    }
+    _state.last_frame_time = stm_now();
+}
+
+void gfx_idle_wake(void) {
+    _state.last_active_time = stm_now();
+}
+
+// The browser paces wasm builds itself, so they don't sleep.
+static void _sleep(f64 seconds) {
+    if (seconds <= 0.0) {
+        return;
+    }
+#if defined(_WIN32)
+    Sleep((DWORD)(seconds * 1000.0));
+#elif !defined(__EMSCRIPTEN__)
+    struct timespec ts = {
+        .tv_sec = (time_t)seconds,
+        .tv_nsec = (long)((seconds - (time_t)seconds) * 1e9),
+    };
+    nanosleep(&ts, NULL);
+#endif
+}
+
+// Return the render target for the scale, creating it the first time.
+static gfx_target_t* _target_get(int scale) {
+    gfx_target_t* target = &_state.targets[scale - 1];
+    if (target->attachments.id != SG_INVALID_ID) {
+        return target;
+    }
+
+    target->color_image = sg_make_image(&(sg_image_desc) {
+        .render_target = true,
+        .width = GFX_RENDER_WIDTH * scale,
+        .height = GFX_RENDER_HEIGHT * scale,
+        .pixel_format = SG_PIXELFORMAT_RGBA8,
+        .label = "color-image",
+    });
+
+    target->depth_image = sg_make_image(&(sg_image_desc) {
+        .render_target = true,
+        .width = GFX_RENDER_WIDTH * scale,
+        .height = GFX_RENDER_HEIGHT * scale,
+        .pixel_format = SG_PIXELFORMAT_DEPTH,
+        .label = "depth-image",
+    });
+
+    target->attachments = sg_make_attachments(&(sg_attachments_desc) {
+        .colors[0].image = target->color_image,
+        .depth_stencil.image = target->depth_image,
+        .label = "offscreen-attachments",
+    });
+    return target;
+}
+
+int gfx_get_scale(void) {
+    return _state.scale;
+}
+
+void gfx_set_scale(int scale) {
+    ASSERT(scale >= GFX_SCALE_MIN && scale <= GFX_SCALE_MAX, "Invalid render scale %d", scale);
+    if (scale == _state.scale) {
+        return;
+    }
+    _state.scale = scale;
+    _state.scale_window_overruns = 0;
+    _state.scale_window_count = 0;
+    gfx_invalidate();
+}
+
+// gfx_auto_scale_update is called at the end of every frame with the time
+// since the previous frame started, which includes waiting on the GPU and
+// vsync. Only frames that rendered the offscreen pass right after another one
+// are counted, so idle throttling and skipped frames don't look like overruns.
+// A frame overruns when it misses the budget by a quarter, which is what a
+// missed vsync looks like. The scale is only raised after a whole window
+// without overruns, and never back to a scale that overran.
+void gfx_auto_scale_update(f32 frame_ms) {
+    bool rendered = _state.rendered_this_frame;
+    bool consecutive = rendered && _state.rendered_last_frame;
+    _state.rendered_last_frame = rendered;
+    _state.rendered_this_frame = false;
+    if (!_state.auto_scale || !consecutive) {
+        return;
+    }
+
+    if (_state.scale_limit_budget_ms != _state.scale_budget_ms) {
+        _state.scale_limit_budget_ms = _state.scale_budget_ms;
+        _state.scale_limit = GFX_SCALE_MAX + 1;
+    }
+
+    if (frame_ms > _state.scale_budget_ms * 1.25f) {
+        _state.scale_window_overruns++;
+    }
+    if (++_state.scale_window_count < GFX_SCALE_WINDOW) {
+        return;
+    }
+
+    int overruns = _state.scale_window_overruns;
+    _state.scale_window_overruns = 0;
+    _state.scale_window_count = 0;
 
+    int scale = _state.scale;
+    if (overruns >= GFX_SCALE_OVERRUN_MAX && scale > GFX_SCALE_MIN) {
+        _state.scale_limit = scale;
+        gfx_set_scale(scale - 1);
+    } else if (overruns == 0 && scale + 1 < _state.scale_limit && scale < GFX_SCALE_MAX) {
+        gfx_set_scale(scale + 1);
+    }
+}
+
+static void _display_pass(void) {
     // Display the offscreen image to a fullscreen quad and render the UI
     sg_begin_pass(&(sg_pass) {
         .swapchain = sglue_swapchain(),
@@ -98,11 +260,15 @@ void gfx_render_end(void) {
         .label = "display-pass",
     });
     {
+        profile_begin(PROFILE_STAGE_GUI);
         gui_update();
+        profile_end(PROFILE_STAGE_GUI);
     }
     sg_end_pass();
 
+    profile_begin(PROFILE_STAGE_COMMIT);
     sg_commit();
+    profile_end(PROFILE_STAGE_COMMIT);
 }
 
 void gfx_shutdown(void) {
@@ -110,16 +276,22 @@ void gfx_shutdown(void) {
     gfx_sprite_shutdown();
     gfx_background_shutdown();
     gfx_line_shutdown();
+    gfx_tile_shutdown();
 
-    sg_destroy_attachments(_state.attachments);
-    sg_destroy_image(_state.color_image);
-    sg_destroy_image(_state.depth_image);
+    for (int i = 0; i < GFX_SCALE_MAX; i++) {
+        gfx_target_t* target = &_state.targets[i];
+        if (target->attachments.id != SG_INVALID_ID) {
+            sg_destroy_attachments(target->attachments);
+            sg_destroy_image(target->color_image);
+            sg_destroy_image(target->depth_image);
+        }
+    }
     sg_destroy_sampler(_state.sampler);
     sg_destroy_buffer(_state.quad_vbuf);
     sg_shutdown();
 }
 
-sg_image gfx_get_color_image(void) { return _state.color_image; }
+sg_image gfx_get_color_image(void) { return _target_get(_state.scale)->color_image; }
 sg_sampler gfx_get_sampler(void) { return _state.sampler; }
 sg_buffer gfx_get_quad_vbuf(void) { return _state.quad_vbuf; }
 
@@ -143,3 +315,23 @@ sg_face_winding gfx_get_face_winding(void) {
 bool* gfx_get_dither(void) {
     return &_state.dither;
 }
+
+bool* gfx_get_auto_scale(void) {
+    return &_state.auto_scale;
+}
+
+f32* gfx_get_scale_budget(void) {
+    return &_state.scale_budget_ms;
+}
+
+bool* gfx_get_on_demand(void) {
+    return &_state.on_demand;
+}
+
+bool* gfx_get_idle_throttle(void) {
+    return &_state.idle_throttle;
+}
+
+gfx_frame_stats_t gfx_get_frame_stats(void) {
+    return _state.frame_stats;
+}
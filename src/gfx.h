@@ -1,21 +1,51 @@
 #pragma once
 
+#include <stdbool.h>
+
 #include "sokol_gfx.h"
 
+#include "defines.h"
+
 enum {
     GFX_WINDOW_WIDTH = 1920,
     GFX_WINDOW_HEIGHT = 1280,
     
     GFX_RENDER_WIDTH = 256,
     GFX_RENDER_HEIGHT = 240,
-    GFX_RENDER_SCALE = 3
+    GFX_RENDER_SCALE = 3,
+
+    // The offscreen image can be rendered at a multiple of the render size.
+    // GFX_RENDER_WIDTH and GFX_RENDER_HEIGHT stay the logical size everything
+    // is laid out in.
+    GFX_SCALE_MIN = 1,
+    GFX_SCALE_MAX = 4,
+    GFX_SCALE_WINDOW = 30,     // Rendered frames measured before changing scale
+    GFX_SCALE_OVERRUN_MAX = 3, // Frames over the budget in a window that lower the scale
 };
 
+// An offscreen render target. Targets are created the first time their scale
+// is used and kept, so switching back to a scale doesn't create images.
+typedef struct {
+    sg_image color_image;
+    sg_image depth_image;
+    sg_attachments attachments;
+} gfx_target_t;
+
+typedef struct {
+    usize rendered; // Frames that ran the offscreen pass
+    usize skipped;  // Frames that reused the previous offscreen image
+} gfx_frame_stats_t;
+
 void gfx_init(void);
 void gfx_shutdown(void);
 void gfx_render_begin(void);
 void gfx_render_end(void);
-void gfx_scale_change(void);
+void gfx_render_skip(void);
+void gfx_invalidate(void);
+bool gfx_take_invalidated(void);
+void gfx_idle_throttle(bool);
+void gfx_idle_wake(void);
+void gfx_auto_scale_update(f32);
 
 sg_image gfx_get_color_image(void);
 sg_sampler gfx_get_sampler(void);
@@ -23,17 +53,44 @@ sg_buffer gfx_get_quad_vbuf(void);
 
 sg_face_winding gfx_get_face_winding(void);
 
-int gfx_get_scale_divisor(void);
-void gfx_set_scale_divisor(int);
+int gfx_get_scale(void);
+void gfx_set_scale(int);
+bool* gfx_get_auto_scale(void);
+f32* gfx_get_scale_budget(void);
 bool* gfx_get_dither(void);
+bool* gfx_get_on_demand(void);
+bool* gfx_get_idle_throttle(void);
+gfx_frame_stats_t gfx_get_frame_stats(void);
 
 typedef struct {
     bool dither;
 
+    // With on_demand the offscreen pass only runs when something it draws
+    // changed, otherwise the last image is shown again.
+    bool on_demand;
+    bool invalidated;
+    bool last_dither;
+    bool idle_throttle;
+    u64 last_active_time;
+    u64 last_frame_time;
+    gfx_frame_stats_t frame_stats;
+
+    // With auto_scale the scale is lowered when too many of the last
+    // GFX_SCALE_WINDOW rendered frames took longer than the budget from start
+    // to start, and raised after a window without any. A scale that was
+    // lowered from is not tried again until the budget changes.
+    int scale;
+    bool auto_scale;
+    f32 scale_budget_ms;
+    int scale_window_overruns;
+    int scale_window_count;
+    int scale_limit;
+    f32 scale_limit_budget_ms;
+    bool rendered_this_frame;
+    bool rendered_last_frame;
+
     sg_sampler sampler;
     sg_buffer quad_vbuf;
     sg_pipeline pipeline;
-    sg_image color_image;
-    sg_image depth_image;
-    sg_attachments attachments;
+    gfx_target_t targets[GFX_SCALE_MAX];
 } gfx_t;
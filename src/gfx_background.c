@@ -18,6 +18,7 @@ static struct {
 void gfx_background_set(vec4s top, vec4s bottom) {
     _state.top_color = top;
     _state.bottom_color = bottom;
+    gfx_invalidate();
 }
 
 void gfx_background_init(void) {
@@ -51,8 +52,6 @@ void gfx_background_shutdown(void) {
 }
 
 void gfx_background_render(void) {
-    sg_apply_pipeline(_state.pipeline);
-
     fs_background_params_t fs_params;
     fs_params.u_top_color = _state.top_color;
     fs_params.u_bottom_color = _state.bottom_color;
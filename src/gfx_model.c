@@ -1,19 +1,100 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "cglm/struct/mat3.h"
+#include "cglm/struct/mat4.h"
 #include "cglm/struct/vec3.h"
 #include "cglm/struct/vec4.h"
+#include "sokol_time.h"
 
 #include "camera.h"
 #include "gfx.h"
 #include "gfx_model.h"
 #include "lighting.h"
 
+#include "memory.h"
 #include "shader.glsl.h"
+#include "trace.h"
 #include "util.h"
 
+// A built model for a map and map state. Models are kept after switching away
+// from them so switching back does not need to read and upload the map again.
+typedef struct {
+    int map_id;
+    map_state_t map_state;
+    model_t model;
+    u64 last_used;
+    bool valid;
+} model_cache_entry_t;
+
+// A GPU resource shared by all models with identical contents. Either image or
+// buffer is set. The resource is destroyed when the last model releases it.
+// data is a copy of the contents so a hash match can be confirmed byte for
+// byte.
+typedef struct {
+    u64 hash;
+    usize size;
+    void* data;
+    int refs;
+    texture_t texture;
+    image_format_e format;
+    sg_buffer buffer;
+} pool_entry_t;
+
 static struct {
     sg_pipeline pipeline;
+    sg_pipeline baked_pipeline;
     model_t model;
+
+    // What the last rendered frame used, to tell if the model needs drawing
+    // again. The GUI and the VM edit these through pointers.
+    transform_t rendered_transform;
+    lighting_t rendered_lighting;
+    bool rendered_baked;
+
+    struct {
+        bool enabled;
+        bool lights_animating;
+
+        sg_buffer buffer; // The baked color of each vertex
+        int capacity;
+        f32* normals; // World space normals as x, y and z planes
+        f32* intensities[LIGHTING_MAX_LIGHTS];
+        f32* colors;
+
+        // What the current bake was made from.
+        u32 vbuf_id;
+        int vertex_count;
+        mat3s normal_matrix;
+        light_t lights[LIGHTING_MAX_LIGHTS];
+
+        gfx_model_bake_stats_t stats;
+    } bake;
+
+    struct {
+        model_cache_entry_t entries[GFX_MODEL_CACHE_MAX];
+        u64 tick;
+        u32 next_model_id;
+        gfx_model_cache_stats_t stats;
+    } cache;
+
+    pool_entry_t pool[GFX_MODEL_POOL_MAX];
 } _state;
 
+static void _model_destroy(model_t);
+static void _cache_evict(int);
+
+static pool_entry_t* _pool_find(u64, const void*, usize);
+static pool_entry_t* _pool_insert(u64, const void*, usize);
+static sg_buffer _pool_acquire_buffer(const void*, usize);
+static texture_t _pool_acquire_texture(image_t);
+static void _pool_release(pool_entry_t*);
+static bool _bake_usable(void);
+static void _bake_update(mat4s);
+static void _bake_reserve(int);
+static void _bake_free(void);
+static void _render_baked(vs_standard_params_t);
+
 void gfx_model_init(void) {
     _state.pipeline = sg_make_pipeline(&(sg_pipeline_desc) {
         .layout = {
@@ -36,78 +117,287 @@ void gfx_model_init(void) {
         .colors[0].pixel_format = SG_PIXELFORMAT_RGBA8,
         .label = "standard-pipeline",
     });
-}
 
-void gfx_model_shutdown(void) {
-    sg_destroy_pipeline(_state.pipeline);
+    // The baked pipeline reads the mesh vertices without the normals, and the
+    // baked colors from a second buffer.
+    _state.baked_pipeline = sg_make_pipeline(&(sg_pipeline_desc) {
+        .layout = {
+            .buffers[0].stride = sizeof(vertex_t),
+            .attrs = {
+                [ATTR_standard_baked_a_position] = { .format = SG_VERTEXFORMAT_FLOAT3, .offset = offsetof(vertex_t, position) },
+                [ATTR_standard_baked_a_uv] = { .format = SG_VERTEXFORMAT_FLOAT2, .offset = offsetof(vertex_t, uv) },
+                [ATTR_standard_baked_a_palette_index] = { .format = SG_VERTEXFORMAT_FLOAT, .offset = offsetof(vertex_t, palette_index) },
+                [ATTR_standard_baked_a_is_textured] = { .format = SG_VERTEXFORMAT_FLOAT, .offset = offsetof(vertex_t, is_textured) },
+                [ATTR_standard_baked_a_light] = { .format = SG_VERTEXFORMAT_FLOAT4, .buffer_index = 1 },
+            },
+        },
+        .shader = sg_make_shader(standard_baked_shader_desc(sg_query_backend())),
+        .face_winding = gfx_get_face_winding(),
+        .cull_mode = SG_CULLMODE_BACK,
+        .depth = {
+            .pixel_format = SG_PIXELFORMAT_DEPTH,
+            .compare = SG_COMPAREFUNC_GREATER,
+            .write_enabled = true,
+        },
+        .colors[0].pixel_format = SG_PIXELFORMAT_RGBA8,
+        .label = "standard-baked-pipeline",
+    });
+    _state.bake.enabled = true;
 }
 
-model_t gfx_model_create(const map_t* map, map_state_t map_state) {
-    mesh_t final_mesh = {0};
-    map_image_t final_texture = {0};
-    if (map->primary_mesh.valid) {
-        final_mesh = map->primary_mesh;
-    } else {
-        final_mesh = map->override_mesh;
-    }
-
-    for (int i = 0; i < map->alt_mesh_count; i++) {
-        mesh_t alt_mesh = map->alt_meshes[i];
-        if (alt_mesh.valid && map_state_eq(alt_mesh.map_state, map_state)) {
-            merge_meshes(&final_mesh, &alt_mesh);
-            break;
+void gfx_model_shutdown(void) {
+    for (int i = 0; i < GFX_MODEL_CACHE_MAX; i++) {
+        if (_state.cache.entries[i].valid) {
+            _model_destroy(_state.cache.entries[i].model);
         }
     }
+    sg_destroy_pipeline(_state.pipeline);
+    sg_destroy_pipeline(_state.baked_pipeline);
+    _bake_free();
+}
 
-    for (int i = 0; i < map->texture_count; i++) {
-        map_image_t texture = map->textures[i];
-
-        if (texture.image.valid && map_state_eq(texture.state, map_state)) {
-            final_texture = texture;
-            break;
-        }
-        if (texture.image.valid && map_state_default(texture.state)) {
-            if (!final_texture.image.valid) {
-                final_texture = texture;
-            }
-        }
-    }
+model_t gfx_model_create(map_t* map, map_state_t map_state) {
+    TRACE_BEGIN();
+    const mesh_t* final_mesh = map_get_mesh(map, map_state);
+    map_image_t final_texture = map_get_texture(map, map_state);
 
-    ASSERT(final_mesh.valid, "Map mesh is invalid");
+    ASSERT(final_mesh->valid, "Map mesh is invalid");
     ASSERT(final_texture.image.valid, "Map texture is invalid");
 
-    vertices_t vertices = geometry_to_vertices(&final_mesh.geometry);
+    vertices_t vertices = geometry_to_vertices(&final_mesh->geometry);
 
-    sg_buffer vbuf = sg_make_buffer(&(sg_buffer_desc) {
-        .data = SG_RANGE(vertices),
-        .label = "mesh-vertices",
-    });
+    // Only upload the vertices that are used.
+    usize vertices_size = vertices.count * sizeof(vertex_t);
+    sg_buffer vbuf = _pool_acquire_buffer(vertices.vertices, vertices_size);
 
-    texture_t texture = texture_create(final_texture.image);
-    texture_t palette = texture_create(final_mesh.palette);
+    texture_t texture = _pool_acquire_texture(final_texture.image);
+    texture_t palette = _pool_acquire_texture(final_mesh->palette);
 
     vec3s model_center = vertices_center(&vertices);
     vec3s offset_center = glms_vec3_negate(model_center);
 
+    int vertex_count = final_mesh->geometry.vertex_count;
+    f32* normals = memory_allocate(MAX(vertex_count, 1) * 3 * sizeof(f32));
+    for (int i = 0; i < vertex_count; i++) {
+        normals[i] = vertices.vertices[i].normal.x;
+        normals[vertex_count + i] = vertices.vertices[i].normal.y;
+        normals[vertex_count * 2 + i] = vertices.vertices[i].normal.z;
+    }
+
+    vertices_destroy(vertices);
+
     model_t model = {
-        .vertex_count = final_mesh.geometry.vertex_count,
-        .lighting = final_mesh.lighting,
+        .id = ++_state.cache.next_model_id,
+        .vertex_count = vertex_count,
+        .lighting = final_mesh->lighting,
         .model_center = model_center,
         .offset_center = offset_center,
         .transform.scale = { { 1.0f, 1.0f, 1.0f } },
         .vbuf = vbuf,
         .texture = texture,
         .palette = palette,
+        .gpu_size = vertices_size + final_texture.image.size + final_mesh->palette.size,
+        .normals = normals,
     };
+    TRACE_END();
     return model;
 }
 
-void gfx_model_destroy(void) {
-    sg_destroy_buffer(_state.model.vbuf);
-    sg_destroy_buffer(_state.model.ibuf);
+// gfx_model_reset unsets the current model. The GPU resources are owned by the
+// model cache and are released on eviction or shutdown.
+void gfx_model_reset(void) {
+    _state.model = (model_t) { 0 };
+    gfx_invalidate();
+}
+
+// gfx_model_cache_get returns the model for the map and state, creating and
+// caching it if needed. Least recently used models are evicted to keep the
+// cache within GFX_MODEL_CACHE_BUDGET bytes of GPU memory.
+model_t gfx_model_cache_get(map_t* map, int map_id, map_state_t map_state) {
+    _state.cache.tick++;
+
+    for (int i = 0; i < GFX_MODEL_CACHE_MAX; i++) {
+        model_cache_entry_t* entry = &_state.cache.entries[i];
+        if (entry->valid && entry->map_id == map_id && map_state_eq(entry->map_state, map_state)) {
+            entry->last_used = _state.cache.tick;
+            _state.cache.stats.hits++;
+            return entry->model;
+        }
+    }
+
+    _state.cache.stats.misses++;
+
+    // Evict before creating, the new model's resources need pool entries.
+    _cache_evict(1);
+    model_t model = gfx_model_create(map, map_state);
+
+    for (int i = 0; i < GFX_MODEL_CACHE_MAX; i++) {
+        model_cache_entry_t* entry = &_state.cache.entries[i];
+        if (!entry->valid) {
+            *entry = (model_cache_entry_t) {
+                .map_id = map_id,
+                .map_state = map_state,
+                .model = model,
+                .last_used = _state.cache.tick,
+                .valid = true,
+            };
+            _state.cache.stats.count++;
+            _state.cache.stats.size += model.gpu_size;
+
+            // Models that don't share resources with the new one may need to
+            // go to bring the cache back within its budget.
+            _cache_evict(0);
+            return model;
+        }
+    }
+
+    ASSERT(false, "Model cache has no free entry");
+}
+
+bool gfx_model_cache_has(int map_id, map_state_t map_state) {
+    for (int i = 0; i < GFX_MODEL_CACHE_MAX; i++) {
+        model_cache_entry_t* entry = &_state.cache.entries[i];
+        if (entry->valid && entry->map_id == map_id && map_state_eq(entry->map_state, map_state)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+gfx_model_cache_stats_t gfx_model_cache_get_stats(void) {
+    return _state.cache.stats;
+}
+
+// Evict least recently used models until free_entries entries are free and
+// the resident GPU memory fits the budget. The current model and the model
+// returned by this lookup are never evicted.
+static void _cache_evict(int free_entries) {
+    while (true) {
+        bool full = _state.cache.stats.count > GFX_MODEL_CACHE_MAX - free_entries;
+        bool over_budget = _state.cache.stats.resident_size > GFX_MODEL_CACHE_BUDGET;
+        if (!full && !over_budget) {
+            return;
+        }
+
+        model_cache_entry_t* oldest = NULL;
+        for (int i = 0; i < GFX_MODEL_CACHE_MAX; i++) {
+            model_cache_entry_t* entry = &_state.cache.entries[i];
+            bool pinned = entry->model.id == _state.model.id || entry->last_used == _state.cache.tick;
+            if (!entry->valid || pinned) {
+                continue;
+            }
+            if (oldest == NULL || entry->last_used < oldest->last_used) {
+                oldest = entry;
+            }
+        }
+        if (oldest == NULL) {
+            return;
+        }
+
+        _model_destroy(oldest->model);
+        _state.cache.stats.count--;
+        _state.cache.stats.size -= oldest->model.gpu_size;
+        _state.cache.stats.evictions++;
+        *oldest = (model_cache_entry_t) { 0 };
+    }
+}
+
+// Release the model's pooled resources and its normals.
+static void _model_destroy(model_t model) {
+    memory_free(model.normals);
+    for (int i = 0; i < GFX_MODEL_POOL_MAX; i++) {
+        pool_entry_t* entry = &_state.pool[i];
+        if (entry->refs == 0) {
+            continue;
+        }
+        if (entry->buffer.id != SG_INVALID_ID && entry->buffer.id == model.vbuf.id) {
+            _pool_release(entry);
+        }
+        if (texture_valid(entry->texture) && entry->texture.gpu_image.id == model.texture.gpu_image.id) {
+            _pool_release(entry);
+        }
+        if (texture_valid(entry->texture) && entry->texture.gpu_image.id == model.palette.gpu_image.id) {
+            _pool_release(entry);
+        }
+    }
+}
+
+static pool_entry_t* _pool_find(u64 hash, const void* data, usize size) {
+    for (int i = 0; i < GFX_MODEL_POOL_MAX; i++) {
+        pool_entry_t* entry = &_state.pool[i];
+        if (entry->refs > 0 && entry->hash == hash && entry->size == size && memcmp(entry->data, data, size) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static pool_entry_t* _pool_insert(u64 hash, const void* data, usize size) {
+    for (int i = 0; i < GFX_MODEL_POOL_MAX; i++) {
+        pool_entry_t* entry = &_state.pool[i];
+        if (entry->refs == 0) {
+            *entry = (pool_entry_t) {
+                .hash = hash,
+                .size = size,
+                .data = memory_allocate(MAX(size, 1)),
+                .refs = 1,
+            };
+            memcpy(entry->data, data, size);
+            _state.cache.stats.resource_count++;
+            _state.cache.stats.resident_size += size;
+            return entry;
+        }
+    }
+    ASSERT(false, "Model resource pool is full");
+}
 
-    texture_destroy(_state.model.texture);
-    texture_destroy(_state.model.palette);
+static sg_buffer _pool_acquire_buffer(const void* data, usize size) {
+    u64 hash = memory_hash(data, size);
+    pool_entry_t* entry = _pool_find(hash, data, size);
+    if (entry != NULL && entry->buffer.id != SG_INVALID_ID) {
+        entry->refs++;
+        return entry->buffer;
+    }
+
+    entry = _pool_insert(hash, data, size);
+    entry->buffer = sg_make_buffer(&(sg_buffer_desc) {
+        .data = {
+            .ptr = data,
+            .size = size,
+        },
+        .label = "mesh-vertices",
+    });
+    return entry->buffer;
+}
+
+static texture_t _pool_acquire_texture(image_t image) {
+    u64 hash = memory_hash(image.data, image.size);
+    pool_entry_t* entry = _pool_find(hash, image.data, image.size);
+    if (entry != NULL && texture_valid(entry->texture) && entry->texture.width == image.width && entry->format == image.format) {
+        entry->refs++;
+        return entry->texture;
+    }
+
+    entry = _pool_insert(hash, image.data, image.size);
+    entry->texture = texture_create(image);
+    entry->format = image.format;
+    return entry->texture;
+}
+
+static void _pool_release(pool_entry_t* entry) {
+    ASSERT(entry->refs > 0, "Model resource released too many times");
+    entry->refs--;
+    if (entry->refs > 0) {
+        return;
+    }
+
+    sg_destroy_buffer(entry->buffer);
+    texture_destroy(entry->texture);
+    memory_free(entry->data);
+
+    _state.cache.stats.resource_count--;
+    _state.cache.stats.resident_size -= entry->size;
+    *entry = (pool_entry_t) { 0 };
 }
 
 void gfx_model_render(void) {
@@ -119,6 +409,12 @@ void gfx_model_render(void) {
         .u_model = model_mat,
     };
 
+    _state.bake.stats.active = _bake_usable();
+    if (_state.bake.stats.active) {
+        _render_baked(vs_params);
+        return;
+    }
+
     fs_standard_params_t fs_params;
     fs_params.u_ambient_color = _state.model.lighting.ambient_color;
     fs_params.u_ambient_strength = _state.model.lighting.ambient_strength;
@@ -155,10 +451,175 @@ void gfx_model_render(void) {
     sg_draw(0, _state.model.vertex_count, 1);
 }
 
+static void _render_baked(vs_standard_params_t vs_params) {
+    _bake_update(vs_params.u_model);
+
+    lighting_t* lighting = &_state.model.lighting;
+    fs_standard_baked_params_t fs_params = {
+        .u_ambient = glms_vec4_scale(lighting->ambient_color, lighting->ambient_strength),
+        .u_dither = *gfx_get_dither(),
+    };
+
+    sg_bindings bindings = {
+        .vertex_buffers = {
+            [0] = _state.model.vbuf,
+            [1] = _state.bake.buffer,
+        },
+        .samplers[SMP_u_sampler] = gfx_get_sampler(),
+        .images = {
+            [IMG_u_texture] = _state.model.texture.gpu_image,
+            [IMG_u_palette] = _state.model.palette.gpu_image,
+        },
+    };
+
+    sg_apply_pipeline(_state.baked_pipeline);
+    sg_apply_bindings(&bindings);
+    sg_apply_uniforms(0, &SG_RANGE(vs_params));
+    sg_apply_uniforms(1, &SG_RANGE(fs_params));
+    sg_draw(0, _state.model.vertex_count, 1);
+}
+
+// The lights are evaluated per pixel while they animate, baking them every
+// frame would cost more than it saves.
+static bool _bake_usable(void) {
+    return _state.bake.enabled && !_state.bake.lights_animating && _state.model.normals != NULL;
+}
+
+// _bake_update brings the baked colors up to date with the model's lighting.
+// The world space normals only change with the model, its rotation or its
+// scale. Otherwise only the lights whose direction changed are recomputed and
+// a color change just sums the lights again.
+static void _bake_update(mat4s model_mat) {
+    mat3s normal_matrix = glms_mat3_transpose(glms_mat3_inv(glms_mat4_pick3(model_mat)));
+    int count = _state.model.vertex_count;
+
+    bool full = _state.bake.vbuf_id != _state.model.vbuf.id
+        || _state.bake.vertex_count != count
+        || memcmp(&_state.bake.normal_matrix, &normal_matrix, sizeof(mat3s)) != 0;
+
+    bool colors_changed = full;
+    int lights = 0;
+    u64 start = stm_now();
+
+    if (full) {
+        _bake_reserve(count);
+        lighting_bake_normals(_state.model.normals, _state.bake.normals, count, normal_matrix);
+        _state.bake.vbuf_id = _state.model.vbuf.id;
+        _state.bake.vertex_count = count;
+        _state.bake.normal_matrix = normal_matrix;
+    }
+
+    const f32* intensities[LIGHTING_MAX_LIGHTS];
+    vec4s colors[LIGHTING_MAX_LIGHTS];
+    int light_count = 0;
+
+    for (int i = 0; i < LIGHTING_MAX_LIGHTS; i++) {
+        light_t light = _state.model.lighting.lights[i];
+        light_t* baked = &_state.bake.lights[i];
+
+        bool direction_changed = light.valid != baked->valid
+            || memcmp(&light.direction, &baked->direction, sizeof(vec3s)) != 0;
+        bool color_changed = memcmp(&light.color, &baked->color, sizeof(vec4s)) != 0;
+
+        if (light.valid && (full || direction_changed)) {
+            lighting_bake_intensity(_state.bake.normals, _state.bake.intensities[i], count, light.direction);
+            lights++;
+        }
+        colors_changed |= direction_changed || color_changed;
+        *baked = light;
+
+        if (light.valid) {
+            intensities[light_count] = _state.bake.intensities[i];
+            colors[light_count] = light.color;
+            light_count++;
+        }
+    }
+
+    if (!colors_changed) {
+        return;
+    }
+
+    lighting_bake_colors(intensities, colors, light_count, _state.bake.colors, count);
+    sg_update_buffer(_state.bake.buffer, &(sg_range) {
+        .ptr = _state.bake.colors,
+        .size = MAX(count, 1) * 4 * sizeof(f32),
+    });
+
+    if (full) {
+        _state.bake.stats.full++;
+    } else {
+        _state.bake.stats.partial++;
+    }
+    _state.bake.stats.lights = lights;
+    _state.bake.stats.last_ms = (f32)stm_ms(stm_since(start));
+}
+
+// Grow the bake buffers to hold count vertices. They are only replaced when a
+// model with more vertices than any before it is baked.
+static void _bake_reserve(int count) {
+    if (count <= _state.bake.capacity && _state.bake.buffer.id != SG_INVALID_ID) {
+        return;
+    }
+    _bake_free();
+
+    int capacity = MAX(count, 1);
+    _state.bake.capacity = capacity;
+    _state.bake.normals = memory_allocate(capacity * 3 * sizeof(f32));
+    for (int i = 0; i < LIGHTING_MAX_LIGHTS; i++) {
+        _state.bake.intensities[i] = memory_allocate(capacity * sizeof(f32));
+    }
+    _state.bake.colors = memory_allocate(capacity * 4 * sizeof(f32));
+    _state.bake.buffer = sg_make_buffer(&(sg_buffer_desc) {
+        .size = capacity * 4 * sizeof(f32),
+        .usage = SG_USAGE_DYNAMIC,
+        .label = "mesh-baked-light",
+    });
+}
+
+static void _bake_free(void) {
+    if (_state.bake.buffer.id == SG_INVALID_ID) {
+        return;
+    }
+    sg_destroy_buffer(_state.bake.buffer);
+    memory_free(_state.bake.normals);
+    for (int i = 0; i < LIGHTING_MAX_LIGHTS; i++) {
+        memory_free(_state.bake.intensities[i]);
+    }
+    memory_free(_state.bake.colors);
+
+    _state.bake.buffer = (sg_buffer) { 0 };
+    _state.bake.capacity = 0;
+    _state.bake.vbuf_id = SG_INVALID_ID;
+}
+
+// gfx_model_changed returns whether the transform, lighting or the lighting
+// mode changed since the last call.
+bool gfx_model_changed(void) {
+    bool baked = _bake_usable();
+    bool changed = memcmp(&_state.rendered_transform, &_state.model.transform, sizeof(transform_t)) != 0
+        || memcmp(&_state.rendered_lighting, &_state.model.lighting, sizeof(lighting_t)) != 0
+        || _state.rendered_baked != baked;
+    _state.rendered_transform = _state.model.transform;
+    _state.rendered_lighting = _state.model.lighting;
+    _state.rendered_baked = baked;
+    return changed;
+}
+
+// gfx_model_set_lights_animating switches to per pixel lighting while the
+// lights change every frame.
+void gfx_model_set_lights_animating(bool animating) {
+    _state.bake.lights_animating = animating;
+}
+
 // Getters
-void gfx_model_set(model_t model) { _state.model = model; }
+void gfx_model_set(model_t model) {
+    _state.model = model;
+    gfx_invalidate();
+}
 void gfx_model_set_y_rotation(f32 maprot) { _state.model.transform.rotation.y = maprot; }
 transform_t* gfx_model_get_transform(void) { return &_state.model.transform; }
 lighting_t* gfx_model_get_lighting(void) { return &_state.model.lighting; }
 vec3s gfx_model_get_model_center(void) { return _state.model.model_center; }
 vec3s gfx_model_get_offset_center(void) { return _state.model.offset_center; }
+bool* gfx_model_get_bake(void) { return &_state.bake.enabled; }
+gfx_model_bake_stats_t gfx_model_get_bake_stats(void) { return _state.bake.stats; }
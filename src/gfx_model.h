@@ -8,8 +8,18 @@
 #include "texture.h"
 #include "transform.h"
 
+enum {
+    GFX_MODEL_CACHE_MAX = 32,
+    GFX_MODEL_CACHE_BUDGET = 64 * 1024 * 1024,
+
+    // Each model uses a vertex buffer, a texture and a palette.
+    GFX_MODEL_POOL_MAX = GFX_MODEL_CACHE_MAX * 3,
+};
+
 // model_t represents a renderable model
 typedef struct {
+    u32 id; // Unique per created model, 0 when there is no model
+
     sg_buffer vbuf;
     sg_buffer ibuf;
 
@@ -22,17 +32,56 @@ typedef struct {
     int vertex_count;
     vec3s model_center;
     vec3s offset_center;
+
+    usize gpu_size; // Bytes of GPU memory referenced by the buffers and textures
+
+    // Vertex normals as x, y and z planes, kept to bake the lighting.
+    f32* normals;
 } model_t;
 
+// size is the sum of the cached models' gpu_size. Models share identical
+// buffers and textures, so resident_size is the GPU memory actually used.
+typedef struct {
+    int count;
+    usize size;
+    usize hits;
+    usize misses;
+    usize evictions;
+
+    int resource_count;
+    usize resident_size;
+} gfx_model_cache_stats_t;
+
+// The lighting is baked into a color per vertex while the lights are static.
+// A bake only redoes the lights that changed unless the model or its rotation
+// or scale changed too.
+typedef struct {
+    bool active; // The last render used the baked lighting
+    usize full;
+    usize partial;
+    int lights; // Lights recomputed by the last bake
+    f32 last_ms;
+} gfx_model_bake_stats_t;
+
 void gfx_model_init(void);
 void gfx_model_shutdown(void);
 void gfx_model_render(void);
 
-model_t gfx_model_create(const map_t*, map_state_t);
+model_t gfx_model_create(map_t*, map_state_t);
 void gfx_model_set(model_t);
-void gfx_model_destroy(void);
+void gfx_model_reset(void);
+bool gfx_model_changed(void);
+void gfx_model_set_lights_animating(bool);
+
+model_t gfx_model_cache_get(map_t*, int, map_state_t);
+bool gfx_model_cache_has(int, map_state_t);
+gfx_model_cache_stats_t gfx_model_cache_get_stats(void);
+
+bool* gfx_model_get_bake(void);
+gfx_model_bake_stats_t gfx_model_get_bake_stats(void);
 
 transform_t* gfx_model_get_transform(void);
 vec3s gfx_model_get_model_center(void);
+vec3s gfx_model_get_offset_center(void);
 lighting_t* gfx_model_get_lighting(void);
 void gfx_model_set_y_rotation(f32 maprot);
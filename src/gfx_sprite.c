@@ -10,39 +10,115 @@
 
 #include "shader.glsl.h"
 
+#include "atlas.h"
 #include "camera.h"
 #include "defines.h"
 #include "filesystem.h"
 #include "gfx.h"
+#include "gfx_model.h"
 #include "gfx_sprite.h"
 #include "image.h"
 #include "memory.h"
 #include "mesh.h"
 #include "span.h"
+#include "spr.h"
 #include "texture.h"
 #include "util.h"
 
+// Per sprite vertex data for instanced drawing.
+typedef struct {
+    vec3s translation;
+    f32 palette_row;
+    vec2s scale;
+    vec2s offset;
+    vec4s uv_rect; // min uv in xy, max uv in zw
+} sprite_instance_t;
+
+// A decoded SPR frame in one of the frame slots of the atlas.
+typedef struct {
+    file_entry_e entry;
+    spr_region_t region;
+    u64 last_used;
+    bool valid;
+} sprite_frame_slot_t;
+
 static struct {
     // There is some wasted space because space on the palette_idx and cache
     // because only certain files have sprites, but this is easier to manage and
     // reason about. they are only u8 and i32 respectively.
 
-    // current_palette_idx is the current palette index for each file.
-    u8 current_palette_idx[F_FILE_COUNT];
+    // The sprite sheet for each file, loaded the first time it is requested.
+    sprite_sheet_t sheets[F_FILE_COUNT];
 
-    // cache the gpu texture for each file, they will be requested per frame.
+    // ImGui can only show RGBA textures, so the GUI gets a decoded copy of the
+    // sheet with the palette it is viewing. Sprites don't use these.
+    // current_palette_idx is the palette of the cached texture for each file.
+    u8 current_palette_idx[F_FILE_COUNT];
     texture_t cache[F_FILE_COUNT];
 
-    sprite_t sprites[100];
+    // CPU copies of the atlases. The textures are created once and updated
+    // from them before rendering when a sheet or frame was added.
+    struct {
+        atlas_t allocator;
+        u8* indices;
+        u8* palettes;
+        int palette_rows;
+        texture_t index_texture;
+        texture_t palette_texture;
+        bool dirty;
+    } atlas;
+
+    // SPR sheets are decoded a frame at a time, as frames are requested. The
+    // least recently used frame that no sprite shows is evicted when all slots
+    // are taken. Each SPR file's unit palettes are added to the palette atlas
+    // once.
+    struct {
+        sprite_frame_slot_t slots[SPRITE_FRAME_CACHE_MAX];
+        int palette_rows[F_FILE_COUNT];
+        bool palette_loaded[F_FILE_COUNT];
+        u64 tick;
+        sprite_frame_cache_stats_t stats;
+    } frames;
+
+    sprite_t sprites[SPRITE_MAX];
+    sprite_t rendered[SPRITE_MAX]; // The sprites the last rendered frame used
+
+    // Rebuilt every frame, 3D sprites first and then 2D sprites so each type
+    // is drawn with one instanced draw call.
+    sprite_instance_t instances[SPRITE_MAX];
+    sg_buffer instance_buffer;
+    int draw_count;
 
     sg_pipeline pipeline_3d;
     sg_pipeline pipeline_2d;
     sg_bindings bindings;
 } _state;
 
+static void _sheet_read(file_entry_e);
+static sprite_sheet_t _sheet_pack(image_t, image_t);
+static void _atlas_init(void);
+static int _frame_palette_row(file_entry_e);
+static void _atlas_upload(void);
+static void _frames_pinned(bool*);
+static int _fill_instances(sprite_type_e, int, mat4s);
+static void _draw_batch(sg_pipeline, mat4s, mat4s, vec3s, vec3s, int, int);
+
 // Getters
 sprite_t* gfx_sprite_get_internals(void) { return _state.sprites; }
 
+// gfx_sprite_changed returns whether a sprite or the atlas changed since the
+// last call. Sprites are edited through gfx_sprite_get_internals(), so they
+// are compared with a copy.
+bool gfx_sprite_changed(void) {
+    bool changed = _state.atlas.dirty || memcmp(_state.rendered, _state.sprites, sizeof(_state.sprites)) != 0;
+    if (changed) {
+        memcpy(_state.rendered, _state.sprites, sizeof(_state.sprites));
+    }
+    return changed;
+}
+sprite_frame_cache_stats_t gfx_sprite_get_frame_stats(void) { return _state.frames.stats; }
+int gfx_sprite_get_draw_count(void) { return _state.draw_count; }
+
 void gfx_sprite_init(void) {
     // Initialize the palette index to -1 to make them currently invalid
     for (usize i = 0; i < F_FILE_COUNT; i++) {
@@ -54,16 +130,57 @@ void gfx_sprite_init(void) {
         .samplers[SMP_u_sampler] = gfx_get_sampler(),
     };
 
-    _state.pipeline_3d = sg_make_pipeline(&(sg_pipeline_desc) {
-        .layout = {
-            .buffers[0].stride = sizeof(vertex_t),
-            .attrs = {
-                [ATTR_sprite_a_position].format = SG_VERTEXFORMAT_FLOAT3,
-                [ATTR_sprite_a_uv].offset = offsetof(vertex_t, uv),
-                [ATTR_sprite_a_uv].format = SG_VERTEXFORMAT_FLOAT2,
+    _state.instance_buffer = sg_make_buffer(&(sg_buffer_desc) {
+        .size = SPRITE_MAX * sizeof(sprite_instance_t),
+        .usage = SG_USAGE_STREAM,
+        .label = "sprite-instances",
+    });
+    _state.bindings.vertex_buffers[1] = _state.instance_buffer;
+
+    // The quad comes from buffer 0 and everything per sprite from buffer 1.
+    sg_vertex_layout_state layout = {
+        .buffers[0].stride = sizeof(vertex_t),
+        .buffers[1] = {
+            .stride = sizeof(sprite_instance_t),
+            .step_func = SG_VERTEXSTEP_PER_INSTANCE,
+        },
+        .attrs = {
+            [ATTR_sprite_a_position].format = SG_VERTEXFORMAT_FLOAT3,
+            [ATTR_sprite_a_uv].offset = offsetof(vertex_t, uv),
+            [ATTR_sprite_a_uv].format = SG_VERTEXFORMAT_FLOAT2,
+            [ATTR_sprite_a_translation] = {
+                .buffer_index = 1,
+                .offset = offsetof(sprite_instance_t, translation),
+                .format = SG_VERTEXFORMAT_FLOAT3,
+            },
+            [ATTR_sprite_a_palette_row] = {
+                .buffer_index = 1,
+                .offset = offsetof(sprite_instance_t, palette_row),
+                .format = SG_VERTEXFORMAT_FLOAT,
+            },
+            [ATTR_sprite_a_scale] = {
+                .buffer_index = 1,
+                .offset = offsetof(sprite_instance_t, scale),
+                .format = SG_VERTEXFORMAT_FLOAT2,
+            },
+            [ATTR_sprite_a_offset] = {
+                .buffer_index = 1,
+                .offset = offsetof(sprite_instance_t, offset),
+                .format = SG_VERTEXFORMAT_FLOAT2,
+            },
+            [ATTR_sprite_a_uv_rect] = {
+                .buffer_index = 1,
+                .offset = offsetof(sprite_instance_t, uv_rect),
+                .format = SG_VERTEXFORMAT_FLOAT4,
             },
         },
-        .shader = sg_make_shader(sprite_shader_desc(sg_query_backend())),
+    };
+
+    sg_shader shader = sg_make_shader(sprite_shader_desc(sg_query_backend()));
+
+    _state.pipeline_3d = sg_make_pipeline(&(sg_pipeline_desc) {
+        .layout = layout,
+        .shader = shader,
         .face_winding = gfx_get_face_winding(),
         .cull_mode = SG_CULLMODE_NONE,
         .depth = {
@@ -84,15 +201,8 @@ void gfx_sprite_init(void) {
     // The only difference is the depth comparisons. These 2d sprites should
     // always be on top.
     _state.pipeline_2d = sg_make_pipeline(&(sg_pipeline_desc) {
-        .layout = {
-            .buffers[0].stride = sizeof(vertex_t),
-            .attrs = {
-                [ATTR_sprite_a_position].format = SG_VERTEXFORMAT_FLOAT3,
-                [ATTR_sprite_a_uv].offset = offsetof(vertex_t, uv),
-                [ATTR_sprite_a_uv].format = SG_VERTEXFORMAT_FLOAT2,
-            },
-        },
-        .shader = sg_make_shader(sprite_shader_desc(sg_query_backend())),
+        .layout = layout,
+        .shader = shader,
         .face_winding = gfx_get_face_winding(),
         .cull_mode = SG_CULLMODE_NONE,
         .depth = {
@@ -118,42 +228,59 @@ void gfx_sprite_shutdown(void) {
             texture_destroy(_state.cache[i]);
         }
     }
+
+    if (texture_valid(_state.atlas.index_texture)) {
+        texture_destroy(_state.atlas.index_texture);
+        texture_destroy(_state.atlas.palette_texture);
+    }
+    memory_free(_state.atlas.indices);
+    memory_free(_state.atlas.palettes);
+
+    sg_destroy_buffer(_state.instance_buffer);
 }
 
 void gfx_sprite_reset(void) {
-    for (usize i = 0; i < 100; i++) {
+    for (usize i = 0; i < SPRITE_MAX; i++) {
         _state.sprites[i] = (sprite_t) {0};
     }
 }
 
-sprite_t gfx_sprite_create(sprite_type_e type, texture_t texture, vec2s min, vec2s size, transform_t transform) {
+sprite_t gfx_sprite_create(sprite_type_e type, sprite_sheet_t sheet, int palette_idx, vec2s min, vec2s size, transform_t transform) {
+    ASSERT(palette_idx < sheet.palette_count, "Invalid sprite palette %d", palette_idx);
+
+    // min is relative to the sheet, the UVs are in the atlas.
+    min.x += sheet.rect.x;
+    min.y += sheet.rect.y;
+    const f32 width = SPRITE_ATLAS_WIDTH;
+    const f32 height = SPRITE_ATLAS_HEIGHT;
     vec2s uv_min, uv_max;
 
     if (type == SPRITE_2D) {
         // 2D sprites use flipped Y coordinates
         uv_min = (vec2s) {
-            .x = min.x / texture.width,
-            .y = (min.y + size.y) / texture.height,
+            .x = min.x / width,
+            .y = (min.y + size.y) / height,
         };
         uv_max = (vec2s) {
-            .x = (min.x + size.x) / texture.width,
-            .y = (min.y) / texture.height,
+            .x = (min.x + size.x) / width,
+            .y = (min.y) / height,
         };
     } else {
         // 3D sprites use normal Y coordinates
         uv_min = (vec2s) {
-            .x = min.x / texture.width,
-            .y = min.y / texture.height,
+            .x = min.x / width,
+            .y = min.y / height,
         };
         uv_max = (vec2s) {
-            .x = (min.x + size.x) / texture.width,
-            .y = (min.y + size.y) / texture.height,
+            .x = (min.x + size.x) / width,
+            .y = (min.y + size.y) / height,
         };
     }
 
     sprite_t sprite = {
         .type = type,
-        .texture = texture,
+        .sheet = sheet,
+        .palette_idx = palette_idx,
         .uv_min = uv_min,
         .uv_max = uv_max,
         .transform = transform,
@@ -161,79 +288,245 @@ sprite_t gfx_sprite_create(sprite_type_e type, texture_t texture, vec2s min, vec
     return sprite;
 }
 
-void _sprite2d_render(const sprite_t* sprite) {
-    mat4s ortho_proj = glms_ortho(0.0f, GFX_RENDER_WIDTH, 0.0f, GFX_RENDER_HEIGHT, -1.0f, 1.0f);
+// gfx_sprite_get_sheet returns the sprite sheet for the file. The first call
+// packs all the sheets in image_desc_list so the atlas is only uploaded once.
+sprite_sheet_t gfx_sprite_get_sheet(file_entry_e entry) {
+    if (_state.sheets[entry].valid) {
+        return _state.sheets[entry];
+    }
 
-    // Model matrix for screen position
-    mat4s model_mat = glms_mat4_identity();
-    model_mat = glms_translate(model_mat, (vec3s) { { sprite->transform.translation.x, sprite->transform.translation.y, 0.0f } });
-    model_mat = glms_scale(model_mat, sprite->transform.scale);
+    if (_state.atlas.indices == NULL) {
+        for (usize i = 0; i < sizeof(image_desc_list) / sizeof(image_desc_t); i++) {
+            _sheet_read(image_desc_list[i].entry);
+        }
+    }
+    if (!_state.sheets[entry].valid) {
+        _sheet_read(entry);
+    }
 
-    // Set up uniforms
-    vs_sprite_params_t vs_params = {
-        .u_proj = ortho_proj,
-        .u_view = glms_mat4_identity(), // No view transformation for UI
-        .u_model = model_mat,
-        .u_uv_min = sprite->uv_min,
-        .u_uv_max = sprite->uv_max,
+    return _state.sheets[entry];
+}
+
+// gfx_sprite_add_sheet packs an R8 index image and its palettes, 16 colors per
+// row, into the sprite atlases. The atlas textures are rebuilt before the next
+// render, which is fine as sheets are only added when first used.
+sprite_sheet_t gfx_sprite_add_sheet(image_t index, image_t palette) {
+    return _sheet_pack(index, palette);
+}
+
+// gfx_sprite_get_frame returns a region of an SPR sheet as a sprite sheet of
+// its own, for use with gfx_sprite_create(). Only the region is decoded, the
+// first time it is requested, into a frame slot of the atlas. The frame stays
+// valid until it is evicted by SPRITE_FRAME_CACHE_MAX newer frames.
+sprite_sheet_t gfx_sprite_get_frame(file_entry_e entry, spr_region_t region) {
+    ASSERT(region.width <= SPRITE_FRAME_SIZE && region.height <= SPRITE_FRAME_SIZE, "SPR frame %dx%d is larger than a frame slot", region.width, region.height);
+
+    _state.frames.tick++;
+
+    int slot_idx = -1;
+    for (int i = 0; i < SPRITE_FRAME_CACHE_MAX; i++) {
+        sprite_frame_slot_t* slot = &_state.frames.slots[i];
+        if (slot->valid && slot->entry == entry && memcmp(&slot->region, &region, sizeof(spr_region_t)) == 0) {
+            slot->last_used = _state.frames.tick;
+            _state.frames.stats.hits++;
+            slot_idx = i;
+            break;
+        }
+    }
+
+    bool miss = slot_idx < 0;
+    if (miss) {
+        // Take a free slot, or the least recently used one that isn't shown.
+        bool pinned[SPRITE_FRAME_CACHE_MAX];
+        _frames_pinned(pinned);
+
+        for (int i = 0; i < SPRITE_FRAME_CACHE_MAX; i++) {
+            const sprite_frame_slot_t* slot = &_state.frames.slots[i];
+            if (!slot->valid) {
+                slot_idx = i;
+                break;
+            }
+            if (!pinned[i] && (slot_idx < 0 || slot->last_used < _state.frames.slots[slot_idx].last_used)) {
+                slot_idx = i;
+            }
+        }
+        ASSERT(slot_idx >= 0, "All sprite frame slots are in use");
+    }
+
+    atlas_rect_t rect = {
+        .x = (slot_idx % SPRITE_FRAME_COLUMNS) * SPRITE_FRAME_SIZE,
+        .y = SPRITE_SHEET_AREA_HEIGHT + (slot_idx / SPRITE_FRAME_COLUMNS) * SPRITE_FRAME_SIZE,
+        .width = region.width,
+        .height = region.height,
+        .valid = true,
     };
 
-    // Bindings for this sprite
-    sg_bindings bindings = _state.bindings;
-    bindings.images[IMG_u_texture] = sprite->texture.gpu_image;
+    if (miss) {
+        sprite_frame_slot_t* slot = &_state.frames.slots[slot_idx];
+        _state.frames.stats.misses++;
+        if (slot->valid) {
+            _state.frames.stats.evictions++;
+        } else {
+            _state.frames.stats.count++;
+        }
 
-    // Render the sprite
-    sg_apply_pipeline(_state.pipeline_2d);
-    sg_apply_bindings(&bindings);
-    sg_apply_uniforms(0, &SG_RANGE(vs_params));
-    sg_draw(0, 6, 1);
+        _atlas_init();
+
+        span_t span = filesystem_read_file(entry);
+        image_t index = spr_read_region(&span, region);
+        for (int y = 0; y < index.height; y++) {
+            u8* dst = &_state.atlas.indices[(rect.y + y) * SPRITE_ATLAS_WIDTH + rect.x];
+            memcpy(dst, &index.data[y * index.width], index.width);
+        }
+        image_destroy(index);
+        _state.atlas.dirty = true;
+
+        *slot = (sprite_frame_slot_t) {
+            .entry = entry,
+            .region = region,
+            .last_used = _state.frames.tick,
+            .valid = true,
+        };
+    }
+
+    return (sprite_sheet_t) {
+        .rect = rect,
+        .palette_row = _frame_palette_row(entry),
+        .palette_count = SPR_UNIT_PALETTE_COUNT,
+        .valid = true,
+    };
+}
+
+// Mark the frame slots that a sprite is showing. Their pixels can't be
+// replaced while the sprite's UVs point at them.
+static void _frames_pinned(bool* pinned) {
+    memset(pinned, 0, SPRITE_FRAME_CACHE_MAX * sizeof(bool));
+    for (int i = 0; i < SPRITE_MAX; i++) {
+        atlas_rect_t rect = _state.sprites[i].sheet.rect;
+        if (!_state.sprites[i].sheet.valid || rect.y < SPRITE_SHEET_AREA_HEIGHT) {
+            continue;
+        }
+        int column = rect.x / SPRITE_FRAME_SIZE;
+        int row = (rect.y - SPRITE_SHEET_AREA_HEIGHT) / SPRITE_FRAME_SIZE;
+        pinned[row * SPRITE_FRAME_COLUMNS + column] = true;
+    }
+}
+
+// gfx_sprite_get_atlas returns the index atlas. Changes are uploaded by the
+// next gfx_sprite_render(), textures can only be updated once per frame.
+texture_t gfx_sprite_get_atlas(void) {
+    _atlas_init();
+    return _state.atlas.index_texture;
 }
 
-void _sprite3d_render(const sprite_t* sprite) {
-    // Get the sprite's model matrix (translation and scale)
-    mat4s model_mat = transform_to_matrix(sprite->transform);
+static void _sheet_read(file_entry_e entry) {
+    image_desc_t desc = image_get_desc(entry);
+    ASSERT(desc.type == IMG_4BPP_PAL, "Sprite sheet %s is not paletted", desc.name);
+
+    image_t index = image_get(entry, 0, IMAGE_FORMAT_R8);
+
+    span_t span = filesystem_read_file(entry);
+    span.offset = desc.pal_offset;
+    image_t palette = image_read_palette(&span, desc.pal_count);
 
-    // Retrieve the camera's view matrix
-    mat4s view_mat = camera_get_view();
+    _state.sheets[entry] = _sheet_pack(index, palette);
 
-    // Extract and transpose the rotational part of the view matrix
-    mat4s rotation_only = glms_mat4_identity();
-    rotation_only.col[0] = (vec4s) { { view_mat.col[0].x, view_mat.col[0].y, view_mat.col[0].z, 0.0f } };
-    rotation_only.col[1] = (vec4s) { { view_mat.col[1].x, view_mat.col[1].y, view_mat.col[1].z, 0.0f } };
-    rotation_only.col[2] = (vec4s) { { view_mat.col[2].x, view_mat.col[2].y, view_mat.col[2].z, 0.0f } };
+    image_destroy(index);
+    image_destroy(palette);
+}
 
-    mat4s inv_view_rot = glms_mat4_transpose(rotation_only);
+// Copy the sheet into the CPU atlases without uploading them.
+static sprite_sheet_t _sheet_pack(image_t index, image_t palette) {
+    ASSERT(index.format == IMAGE_FORMAT_R8, "Sprite sheet must be palette indices");
 
-    // Build the billboard matrix: rotation + translation + scale
-    mat4s billboard_mat = inv_view_rot;
+    _atlas_init();
 
-    // Apply scale
-    vec3s scale = sprite->transform.scale;
-    billboard_mat.col[0] = glms_vec4_scale(billboard_mat.col[0], scale.x);
-    billboard_mat.col[1] = glms_vec4_scale(billboard_mat.col[1], scale.y);
-    billboard_mat.col[2] = glms_vec4_scale(billboard_mat.col[2], scale.z);
+    atlas_rect_t rect = atlas_alloc(&_state.atlas.allocator, index.width, index.height);
+    ASSERT(rect.valid, "Sprite atlas is full");
+    ASSERT(_state.atlas.palette_rows + palette.height <= SPRITE_PALETTE_ROWS, "Sprite palette atlas is full");
 
-    // Preserve translation from the model matrix
-    billboard_mat.col[3] = model_mat.col[3];
+    for (int y = 0; y < index.height; y++) {
+        u8* dst = &_state.atlas.indices[(rect.y + y) * SPRITE_ATLAS_WIDTH + rect.x];
+        memcpy(dst, &index.data[y * index.width], index.width);
+    }
 
-    vs_sprite_params_t vs_params = {
-        .u_proj = camera_get_proj(),
-        .u_view = view_mat,
-        .u_model = billboard_mat,
-        .u_uv_min = sprite->uv_min,
-        .u_uv_max = sprite->uv_max,
+    sprite_sheet_t sheet = {
+        .rect = rect,
+        .palette_row = _state.atlas.palette_rows,
+        .palette_count = palette.height,
+        .valid = true,
     };
 
-    ASSERT(texture_valid(sprite->texture), "Invalid sprite texture");
+    memcpy(&_state.atlas.palettes[_state.atlas.palette_rows * 16 * 4], palette.data, palette.size);
+    _state.atlas.palette_rows += palette.height;
+    _state.atlas.dirty = true;
 
-    _state.bindings.images[IMG_u_texture] = sprite->texture.gpu_image;
+    return sheet;
+}
 
-    sg_apply_pipeline(_state.pipeline_3d);
-    sg_apply_bindings(&_state.bindings);
-    sg_apply_uniforms(0, &SG_RANGE(vs_params));
-    sg_draw(0, 6, 1);
+static void _atlas_init(void) {
+    if (_state.atlas.indices != NULL) {
+        return;
+    }
+    // Sheets only go in the sheet area, the rest is frame slots.
+    _state.atlas.allocator = atlas_create(SPRITE_ATLAS_WIDTH, SPRITE_SHEET_AREA_HEIGHT);
+    _state.atlas.indices = memory_allocate(SPRITE_ATLAS_WIDTH * SPRITE_ATLAS_HEIGHT);
+    _state.atlas.palettes = memory_allocate(SPRITE_PALETTE_ROWS * 16 * 4);
+    _state.atlas.index_texture = texture_create_dynamic(SPRITE_ATLAS_WIDTH, SPRITE_ATLAS_HEIGHT, IMAGE_FORMAT_R8);
+    _state.atlas.palette_texture = texture_create_dynamic(16, SPRITE_PALETTE_ROWS, IMAGE_FORMAT_RGBA8);
+    _state.atlas.dirty = true;
 }
 
+// Return the first palette atlas row of the SPR file's unit palettes, adding
+// them the first time.
+static int _frame_palette_row(file_entry_e entry) {
+    if (_state.frames.palette_loaded[entry]) {
+        return _state.frames.palette_rows[entry];
+    }
+
+    ASSERT(_state.atlas.palette_rows + SPR_UNIT_PALETTE_COUNT <= SPRITE_PALETTE_ROWS, "Sprite palette atlas is full");
+
+    span_t span = filesystem_read_file(entry);
+    image_t palette = spr_read_palette(&span, SPR_UNIT_PALETTE_COUNT);
+    memcpy(&_state.atlas.palettes[_state.atlas.palette_rows * 16 * 4], palette.data, palette.size);
+    image_destroy(palette);
+
+    _state.frames.palette_rows[entry] = _state.atlas.palette_rows;
+    _state.frames.palette_loaded[entry] = true;
+    _state.atlas.palette_rows += SPR_UNIT_PALETTE_COUNT;
+    _state.atlas.dirty = true;
+
+    return _state.frames.palette_rows[entry];
+}
+
+// Update the atlas textures if a sheet or frame was added since the last
+// upload. Only gfx_sprite_render() calls this so it happens once per frame.
+static void _atlas_upload(void) {
+    if (!_state.atlas.dirty) {
+        return;
+    }
+    _state.atlas.dirty = false;
+
+    texture_update(_state.atlas.index_texture, (image_t) {
+        .width = SPRITE_ATLAS_WIDTH,
+        .height = SPRITE_ATLAS_HEIGHT,
+        .size = SPRITE_ATLAS_WIDTH * SPRITE_ATLAS_HEIGHT,
+        .data = _state.atlas.indices,
+        .format = IMAGE_FORMAT_R8,
+        .valid = true,
+    });
+    texture_update(_state.atlas.palette_texture, (image_t) {
+        .width = 16,
+        .height = SPRITE_PALETTE_ROWS,
+        .size = SPRITE_PALETTE_ROWS * 16 * 4,
+        .data = _state.atlas.palettes,
+        .valid = true,
+    });
+}
+
+// sprite_get_paletted_texture returns an RGBA copy of the sheet decoded with
+// the palette, for showing in the GUI. It is uploaded again when the palette
+// changes. Sprites use gfx_sprite_get_sheet() instead.
 texture_t sprite_get_paletted_texture(file_entry_e entry, int palette_idx) {
     if (_state.current_palette_idx[entry] == palette_idx) {
         return _state.cache[entry];
@@ -245,26 +538,105 @@ texture_t sprite_get_paletted_texture(file_entry_e entry, int palette_idx) {
         texture_destroy(_state.cache[entry]);
     }
 
-    span_t span = filesystem_read_file(entry);
-    image_desc_t desc = image_get_desc(entry);
-    image_t image = image_read_using_palette(&span, desc, palette_idx);
-
-    texture_t texture = texture_create(image);
-    _state.cache[entry] = texture;
-
+    // Palettes viewed before come from the decoded-image cache.
+    image_t image = image_get(entry, palette_idx, IMAGE_FORMAT_RGBA8);
+    _state.cache[entry] = texture_create(image);
     image_destroy(image);
 
     return _state.cache[entry];
 }
 
+// gfx_sprite_render draws all sprites with at most two instanced draw calls,
+// one per pipeline. All sprites share the atlas textures.
 void gfx_sprite_render(void) {
-    for (int i = 0; i < 100; i++) {
-        if (texture_valid(_state.sprites[i].texture)) {
-            if (_state.sprites[i].type == SPRITE_2D) {
-                _sprite2d_render(&_state.sprites[i]);
-            } else if (_state.sprites[i].type == SPRITE_3D) {
-                _sprite3d_render(&_state.sprites[i]);
-            }
+    _state.draw_count = 0;
+    _atlas_upload();
+
+    mat4s model = transform_to_matrix_around_center(*gfx_model_get_transform(), gfx_model_get_offset_center());
+    int count_3d = _fill_instances(SPRITE_3D, 0, model);
+    int count_2d = _fill_instances(SPRITE_2D, count_3d, model);
+    int count = count_3d + count_2d;
+    if (count == 0) {
+        return;
+    }
+
+    sg_update_buffer(_state.instance_buffer, &(sg_range) {
+        .ptr = _state.instances,
+        .size = count * sizeof(sprite_instance_t),
+    });
+
+    // 3D sprites face the camera, their quads are built from the camera's
+    // right and up vectors in the vertex shader.
+    mat4s view = camera_get_view();
+    vec3s right = { { view.col[0].x, view.col[1].x, view.col[2].x } };
+    vec3s up = { { view.col[0].y, view.col[1].y, view.col[2].y } };
+    _draw_batch(_state.pipeline_3d, camera_get_proj(), view, right, up, 0, count_3d);
+
+    // 2D sprites are in screen pixels.
+    mat4s ortho_proj = glms_ortho(0.0f, GFX_RENDER_WIDTH, 0.0f, GFX_RENDER_HEIGHT, -1.0f, 1.0f);
+    vec3s screen_right = { { 1.0f, 0.0f, 0.0f } };
+    vec3s screen_up = { { 0.0f, 1.0f, 0.0f } };
+    _draw_batch(_state.pipeline_2d, ortho_proj, glms_mat4_identity(), screen_right, screen_up, count_3d, count_2d);
+}
+
+// Write the instances of the sprites of the type starting at first and return
+// how many were written. Sprites on the map are moved into world space with the
+// model matrix so they follow the map when it is rotated.
+static int _fill_instances(sprite_type_e type, int first, mat4s model) {
+    int count = 0;
+    for (int i = 0; i < SPRITE_MAX; i++) {
+        const sprite_t* sprite = &_state.sprites[i];
+        if (!sprite->sheet.valid || sprite->type != type) {
+            continue;
+        }
+
+        vec3s translation = sprite->transform.translation;
+        if (sprite->on_map) {
+            translation = glms_vec3(glms_mat4_mulv(model, glms_vec4(translation, 1.0f)));
+        }
+        if (type == SPRITE_2D) {
+            translation.z = 0.0f;
         }
+
+        _state.instances[first + count++] = (sprite_instance_t) {
+            .translation = translation,
+            .palette_row = sprite->sheet.palette_row + sprite->palette_idx,
+            .scale = { { sprite->transform.scale.x, sprite->transform.scale.y } },
+            .offset = sprite->offset,
+            .uv_rect = { { sprite->uv_min.x, sprite->uv_min.y, sprite->uv_max.x, sprite->uv_max.y } },
+        };
+    }
+    return count;
+}
+
+static void _draw_batch(sg_pipeline pipeline, mat4s proj, mat4s view, vec3s right, vec3s up, int first, int count) {
+    if (count == 0) {
+        return;
     }
+
+    vs_sprite_params_t vs_params = {
+        .u_proj = proj,
+        .u_view = view,
+        .u_right = glms_vec4(right, 0.0f),
+        .u_up = glms_vec4(up, 0.0f),
+    };
+
+    fs_sprite_params_t fs_params = {
+        .u_palette_count = SPRITE_PALETTE_ROWS,
+    };
+
+    ASSERT(texture_valid(_state.atlas.index_texture), "Invalid sprite atlas");
+
+    sg_bindings bindings = _state.bindings;
+    bindings.vertex_buffer_offsets[1] = first * sizeof(sprite_instance_t);
+    bindings.images[IMG_u_texture] = _state.atlas.index_texture.gpu_image;
+    bindings.images[IMG_u_palette] = _state.atlas.palette_texture.gpu_image;
+
+    sg_apply_pipeline(pipeline);
+    sg_apply_bindings(&bindings);
+    sg_apply_uniforms(0, &SG_RANGE(vs_params));
+    sg_apply_uniforms(1, &SG_RANGE(fs_params));
+    sg_draw(0, 6, count);
+
+    _state.draw_count++;
 }
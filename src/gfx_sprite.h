@@ -4,21 +4,63 @@
 
 #include "cglm/types-struct.h"
 
+#include "atlas.h"
 #include "filesystem.h"
+#include "image.h"
 #include "sokol_gfx.h"
+#include "spr.h"
 #include "texture.h"
 #include "transform.h"
 
+enum {
+    // All sprite sheets are packed into one index atlas and one palette atlas.
+    // Whole sheets go in the top half of the index atlas and SPR frames in
+    // fixed size slots in the bottom half.
+    SPRITE_ATLAS_WIDTH = 1024,
+    SPRITE_ATLAS_HEIGHT = 2048,
+    SPRITE_SHEET_AREA_HEIGHT = 1024,
+    SPRITE_PALETTE_ROWS = 2048,
+
+    SPRITE_FRAME_SIZE = 64,
+    SPRITE_FRAME_COLUMNS = SPRITE_ATLAS_WIDTH / SPRITE_FRAME_SIZE,
+    SPRITE_FRAME_CACHE_MAX = SPRITE_FRAME_COLUMNS * ((SPRITE_ATLAS_HEIGHT - SPRITE_SHEET_AREA_HEIGHT) / SPRITE_FRAME_SIZE),
+
+    // Sprites from SPRITE_ANIM_FIRST are written by the animation player.
+    SPRITE_MAX = 384,
+    SPRITE_ANIM_FIRST = 128,
+};
+
 typedef enum {
     SPRITE_2D,
     SPRITE_3D
 } sprite_type_e;
 
+// sprite_sheet_t is a sprite sheet packed into the sprite atlas as palette
+// indices, with all of its palettes in the palette atlas, one row per palette.
+// The sprite shader looks up the color, so changing the palette of a sprite is
+// free and all sprites share the same two textures.
+typedef struct {
+    atlas_rect_t rect;
+    int palette_row; // First row of the sheet's palettes in the palette atlas
+    int palette_count;
+    bool valid;
+} sprite_sheet_t;
+
+typedef struct {
+    int count;
+    usize hits;
+    usize misses;
+    usize evictions;
+} sprite_frame_cache_stats_t;
+
 typedef struct {
     sprite_type_e type;
-    texture_t texture;
+    sprite_sheet_t sheet;
+    int palette_idx;
     vec2s uv_min;
     vec2s uv_max;
+    vec2s offset; // Moves the quad along the right and up axes, in world units
+    bool on_map;  // The translation is in map mesh space and follows the model transform
     transform_t transform;
 } sprite_t;
 
@@ -26,7 +68,14 @@ void gfx_sprite_init(void);
 void gfx_sprite_shutdown(void);
 void gfx_sprite_reset(void);
 void gfx_sprite_render(void);
-sprite_t gfx_sprite_create(sprite_type_e, texture_t, vec2s, vec2s, transform_t);
+sprite_t gfx_sprite_create(sprite_type_e, sprite_sheet_t, int, vec2s, vec2s, transform_t);
 
 sprite_t* gfx_sprite_get_internals(void);
+bool gfx_sprite_changed(void);
+sprite_sheet_t gfx_sprite_get_sheet(file_entry_e);
+sprite_sheet_t gfx_sprite_add_sheet(image_t, image_t);
+sprite_sheet_t gfx_sprite_get_frame(file_entry_e, spr_region_t);
+sprite_frame_cache_stats_t gfx_sprite_get_frame_stats(void);
+texture_t gfx_sprite_get_atlas(void);
+int gfx_sprite_get_draw_count(void);
 texture_t sprite_get_paletted_texture(file_entry_e, int);
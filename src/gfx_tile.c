@@ -0,0 +1,282 @@
+#include <string.h>
+
+#include "sokol_gfx.h"
+
+#include "camera.h"
+#include "color.h"
+#include "gfx.h"
+#include "gfx_model.h"
+#include "gfx_tile.h"
+#include "transform.h"
+#include "util.h"
+
+#include "shader.glsl.h"
+
+enum {
+    TILE_INSTANCE_MAX = TERRAIN_LEVEL_COUNT * TERRAIN_TILE_MAX,
+};
+
+// Lift the overlay off the surface so it doesn't z-fight with the map.
+static const f32 TILE_LIFT = 0.5f;
+
+// Per tile vertex data for instanced drawing, in mesh space.
+typedef struct {
+    vec2s origin; // x and z of the tile's first corner
+    vec4s heights; // y of the corners (x0 z0, x1 z0, x0 z1, x1 z1)
+    vec4s color;
+} tile_instance_t;
+
+// Corners of the tile for the fill triangles and the outline lines.
+static const vec2s fill_corners[] = {
+    { { 0, 0 } }, { { 1, 0 } }, { { 0, 1 } },
+    { { 0, 1 } }, { { 1, 0 } }, { { 1, 1 } },
+};
+static const vec2s outline_corners[] = {
+    { { 0, 0 } }, { { 1, 0 } },
+    { { 1, 0 } }, { { 1, 1 } },
+    { { 1, 1 } }, { { 0, 1 } },
+    { { 0, 1 } }, { { 0, 0 } },
+};
+
+static struct {
+    tile_instance_t instances[TILE_INSTANCE_MAX];
+    int instance_count;
+    bool dirty; // The instances changed since the last upload
+    tile_style_e style;
+
+    sg_buffer instance_buffer;
+    sg_buffer fill_vbuf;
+    sg_buffer outline_vbuf;
+    sg_pipeline fill_pipeline;
+    sg_pipeline outline_pipeline;
+} _state;
+
+void gfx_tile_init(void) {
+    _state.instance_buffer = sg_make_buffer(&(sg_buffer_desc) {
+        .size = TILE_INSTANCE_MAX * sizeof(tile_instance_t),
+        .usage = SG_USAGE_STREAM,
+        .label = "tile-instances",
+    });
+    _state.fill_vbuf = sg_make_buffer(&(sg_buffer_desc) {
+        .data = SG_RANGE(fill_corners),
+        .label = "tile-fill-vertices",
+    });
+    _state.outline_vbuf = sg_make_buffer(&(sg_buffer_desc) {
+        .data = SG_RANGE(outline_corners),
+        .label = "tile-outline-vertices",
+    });
+
+    // The corner comes from buffer 0 and everything per tile from buffer 1.
+    sg_vertex_layout_state layout = {
+        .buffers[1] = {
+            .stride = sizeof(tile_instance_t),
+            .step_func = SG_VERTEXSTEP_PER_INSTANCE,
+        },
+        .attrs = {
+            [ATTR_tile_a_corner].format = SG_VERTEXFORMAT_FLOAT2,
+            [ATTR_tile_a_origin] = {
+                .buffer_index = 1,
+                .offset = offsetof(tile_instance_t, origin),
+                .format = SG_VERTEXFORMAT_FLOAT2,
+            },
+            [ATTR_tile_a_heights] = {
+                .buffer_index = 1,
+                .offset = offsetof(tile_instance_t, heights),
+                .format = SG_VERTEXFORMAT_FLOAT4,
+            },
+            [ATTR_tile_a_color] = {
+                .buffer_index = 1,
+                .offset = offsetof(tile_instance_t, color),
+                .format = SG_VERTEXFORMAT_FLOAT4,
+            },
+        },
+    };
+
+    sg_shader shader = sg_make_shader(tile_shader_desc(sg_query_backend()));
+
+    sg_pipeline_desc desc = {
+        .layout = layout,
+        .shader = shader,
+        .cull_mode = SG_CULLMODE_NONE,
+        .depth = {
+            .pixel_format = SG_PIXELFORMAT_DEPTH,
+            .compare = SG_COMPAREFUNC_GREATER_EQUAL,
+            .write_enabled = false,
+        },
+        .colors[0].pixel_format = SG_PIXELFORMAT_RGBA8,
+        .colors[0].blend = {
+            .enabled = true,
+            .src_factor_rgb = SG_BLENDFACTOR_SRC_ALPHA,
+            .dst_factor_rgb = SG_BLENDFACTOR_ONE_MINUS_SRC_ALPHA,
+            .op_rgb = SG_BLENDOP_ADD,
+        },
+        .label = "tile-fill-pipeline",
+    };
+    _state.fill_pipeline = sg_make_pipeline(&desc);
+
+    desc.primitive_type = SG_PRIMITIVETYPE_LINES;
+    desc.label = "tile-outline-pipeline";
+    _state.outline_pipeline = sg_make_pipeline(&desc);
+}
+
+void gfx_tile_shutdown(void) {
+    sg_destroy_pipeline(_state.fill_pipeline);
+    sg_destroy_pipeline(_state.outline_pipeline);
+    sg_destroy_buffer(_state.fill_vbuf);
+    sg_destroy_buffer(_state.outline_vbuf);
+    sg_destroy_buffer(_state.instance_buffer);
+}
+
+// gfx_tile_set builds an instance for every cell of the grid with a visible
+// color. colors has one color per cell, indexed like the grid's cells. The
+// instances are uploaded before the next render if they changed.
+void gfx_tile_set(const terrain_grid_t* grid, const vec4s* colors) {
+    int previous_count = _state.instance_count;
+    bool changed = false;
+    _state.instance_count = 0;
+
+    for (int level = 0; level < TERRAIN_LEVEL_COUNT; level++) {
+        for (int z = 0; z < grid->z_count; z++) {
+            for (int x = 0; x < grid->x_count; x++) {
+                int idx = level * TERRAIN_TILE_MAX + z * grid->x_count + x;
+                u32 cell = grid->cells[idx];
+                if (!(cell & TERRAIN_CELL_VALID) || colors[idx].w <= 0.0f) {
+                    continue;
+                }
+
+                // Heights are in half h and the map's y axis points down.
+                const f32 scale = -TILE_HEIGHT * 0.5f;
+                tile_instance_t instance = {
+                    .origin = { { x * TILE_WIDTH, z * TILE_DEPTH } },
+                    .heights = { {
+                        terrain_surface_height(cell, 0.0f, 0.0f) * scale - TILE_LIFT,
+                        terrain_surface_height(cell, 1.0f, 0.0f) * scale - TILE_LIFT,
+                        terrain_surface_height(cell, 0.0f, 1.0f) * scale - TILE_LIFT,
+                        terrain_surface_height(cell, 1.0f, 1.0f) * scale - TILE_LIFT,
+                    } },
+                    .color = colors[idx],
+                };
+
+                tile_instance_t* dst = &_state.instances[_state.instance_count++];
+                if (memcmp(dst, &instance, sizeof(tile_instance_t)) != 0) {
+                    *dst = instance;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    if (changed || _state.instance_count != previous_count) {
+        _state.dirty = true;
+        gfx_invalidate();
+    }
+}
+
+void gfx_tile_clear(void) {
+    if (_state.instance_count > 0) {
+        gfx_invalidate();
+    }
+    _state.instance_count = 0;
+    _state.dirty = false;
+}
+
+void gfx_tile_set_style(tile_style_e style) {
+    if (_state.style != style) {
+        gfx_invalidate();
+    }
+    _state.style = style;
+}
+
+void gfx_tile_render(void) {
+    if (_state.instance_count == 0) {
+        return;
+    }
+
+    if (_state.dirty) {
+        sg_update_buffer(_state.instance_buffer, &(sg_range) {
+            .ptr = _state.instances,
+            .size = _state.instance_count * sizeof(tile_instance_t),
+        });
+        _state.dirty = false;
+    }
+
+    // Use the model's transform so the overlay stays on the map.
+    vs_tile_params_t vs_params = {
+        .u_proj = camera_get_proj(),
+        .u_view = camera_get_view(),
+        .u_model = transform_to_matrix_around_center(*gfx_model_get_transform(), gfx_model_get_offset_center()),
+        .u_tile_size = { { TILE_WIDTH, TILE_DEPTH } },
+    };
+
+    bool fill = _state.style == TILE_STYLE_FILL;
+    sg_bindings bindings = {
+        .vertex_buffers[0] = fill ? _state.fill_vbuf : _state.outline_vbuf,
+        .vertex_buffers[1] = _state.instance_buffer,
+    };
+
+    sg_apply_pipeline(fill ? _state.fill_pipeline : _state.outline_pipeline);
+    sg_apply_bindings(&bindings);
+    sg_apply_uniforms(0, &SG_RANGE(vs_params));
+    sg_draw(0, fill ? 6 : 8, _state.instance_count);
+}
+
+// gfx_tile_colors_from_terrain writes a color for every cell of the terrain.
+// Surfaces and slopes get a color each, walkability is green or red.
+void gfx_tile_colors_from_terrain(const terrain_t* terrain, tile_overlay_e overlay, vec4s* colors) {
+    const vec4s hidden = { 0 };
+    for (int level = 0; level < TERRAIN_LEVEL_COUNT; level++) {
+        for (int i = 0; i < TERRAIN_TILE_MAX; i++) {
+            const tile_t* tile = &terrain->tiles[level][i];
+            vec4s color = hidden;
+
+            switch (overlay) {
+            case TILE_OVERLAY_SURFACE:
+            case TILE_OVERLAY_SLOPE: {
+                u32 v = overlay == TILE_OVERLAY_SURFACE ? tile->surface : tile->slope;
+                v ^= v >> 13;
+                v *= 0x85ebca6b;
+                v ^= v >> 16;
+                color = (vec4s) { { (v & 0xFF) / 255.0f, ((v >> 8) & 0xFF) / 255.0f, ((v >> 16) & 0xFF) / 255.0f, 0.5f } };
+                break;
+            }
+            case TILE_OVERLAY_WALKABLE:
+                color = tile->cant_walk ? COLOR_RED : COLOR_GREEN;
+                color.w = 0.5f;
+                break;
+            default:
+                break;
+            }
+            colors[level * TERRAIN_TILE_MAX + i] = color;
+        }
+    }
+}
+
+// gfx_tile_colors_from_range colors the tiles of a move range from blue at
+// the start to cyan at the full Move.
+void gfx_tile_colors_from_range(const path_range_t* range, int move, vec4s* colors) {
+    for (int i = 0; i < PATH_NODE_MAX; i++) {
+        if (range->cost[i] == PATH_COST_UNREACHABLE) {
+            colors[i] = (vec4s) { 0 };
+            continue;
+        }
+        f32 t = move > 0 ? (f32)range->cost[i] / move : 0.0f;
+        colors[i] = (vec4s) { { 0.0f, t, 1.0f, 0.5f } };
+    }
+}
+
+const char* gfx_tile_overlay_str(tile_overlay_e overlay) {
+    switch (overlay) {
+    case TILE_OVERLAY_NONE:
+        return "None";
+    case TILE_OVERLAY_SURFACE:
+        return "Surface";
+    case TILE_OVERLAY_SLOPE:
+        return "Slope";
+    case TILE_OVERLAY_WALKABLE:
+        return "Walkable";
+    case TILE_OVERLAY_MOVE_RANGE:
+        return "Move Range";
+    default:
+        return "Unknown";
+    }
+}
@@ -0,0 +1,35 @@
+// gfx_tile draws an overlay on the terrain tiles of the current map, filled or
+// as outlines, with one color per tile. All tiles are drawn with one instanced
+// draw call. Changing the colors only rewrites the instance buffer.
+#pragma once
+
+#include "cglm/types-struct.h"
+
+#include "path.h"
+#include "terrain.h"
+
+typedef enum {
+    TILE_OVERLAY_NONE,
+    TILE_OVERLAY_SURFACE,
+    TILE_OVERLAY_SLOPE,
+    TILE_OVERLAY_WALKABLE,
+    TILE_OVERLAY_MOVE_RANGE,
+    TILE_OVERLAY_COUNT,
+} tile_overlay_e;
+
+typedef enum {
+    TILE_STYLE_FILL,
+    TILE_STYLE_OUTLINE,
+} tile_style_e;
+
+void gfx_tile_init(void);
+void gfx_tile_shutdown(void);
+void gfx_tile_render(void);
+
+void gfx_tile_set(const terrain_grid_t*, const vec4s*);
+void gfx_tile_clear(void);
+void gfx_tile_set_style(tile_style_e);
+
+void gfx_tile_colors_from_terrain(const terrain_t*, tile_overlay_e, vec4s*);
+void gfx_tile_colors_from_range(const path_range_t*, int, vec4s*);
+const char* gfx_tile_overlay_str(tile_overlay_e);
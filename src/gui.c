@@ -14,13 +14,22 @@
 #include "font.h"
 #include "gfx.h"
 #include "gfx_model.h"
+#include "gfx_tile.h"
 #include "gfx_sprite.h"
 #include "gui.h"
 #include "map.h"
+#include "anim.h"
 #include "map_record.h"
 #include "memory.h"
 #include "parse.h"
+#include "path.h"
+#include "pixel.h"
+#include "profile.h"
 #include "scene.h"
+#include "seq.h"
+#include "sight.h"
+#include "sim.h"
+#include "trace.h"
 #include "unit.h"
 #include "util.h"
 #include "vm.h"
@@ -28,10 +37,26 @@
 #include "vm_message.h"
 #include "vm_opcode.h"
 
+// What the tile overlay was last built from. Zeroed before it is filled so it
+// can be compared with memcmp.
+typedef struct {
+    const terrain_t* terrain;
+    map_state_t map_state;
+    int map_num;
+    tile_overlay_e overlay;
+    int style;
+    path_limits_t limits;
+    bool has_start;
+    path_tile_t start;
+} tile_overlay_key_t;
+
 static void _draw(void);
 static uint32_t hash_int_rand_color(u32 v);
 static uint32_t hash_map_state_rand_color(map_state_t state);
 
+// Where trace captures are written when they are stopped.
+static const char* TRACE_PATH = "heretic_trace.json";
+
 static struct {
     bool show_sprite_window[F_FILE_COUNT];
     u8 current_palette_idx[F_FILE_COUNT];
@@ -51,6 +76,34 @@ static struct {
     bool show_window_mesh;
 
     bool show_window_demo;
+    bool show_window_benchmarks;
+    bool show_window_animations;
+
+    // Result of writing the last trace capture to TRACE_PATH.
+    bool trace_written;
+    bool trace_failed;
+
+    // Terrain overlay drawn in the viewport. Move ranges start at the picked
+    // tile.
+    tile_overlay_e tile_overlay;
+    int tile_style;
+    path_limits_t tile_limits;
+    tile_overlay_key_t tile_built;
+    bool tile_built_valid;
+
+    anim_desc_t anim_desc;
+    pixel_bench_t pixel_bench;
+    image_tim_bench_t tim_bench;
+    path_bench_t path_bench;
+    sight_bench_t sight_bench;
+
+    // The last polygon picked in the viewport. The scroll flags let the Mesh
+    // and Terrain windows jump to it once. The pick is cleared when the scene
+    // changes map.
+    mesh_hit_t pick;
+    u32 pick_generation;
+    bool pick_scroll_mesh;
+    bool pick_scroll_terrain;
 } _state;
 
 static bool is_hovered = false;
@@ -75,6 +128,7 @@ void gui_init(void) {
     _state.show_window_demo = false;
     _state.show_window_terrain = true;
     _state.show_window_mesh = true;
+    _state.tile_limits = (path_limits_t) { .move = 4, .jump = 3 };
 }
 
 void gui_shutdown(void) {
@@ -192,6 +246,19 @@ static void _draw_window_raw_records(void) {
     igEnd();
 }
 
+// Highlights the current table row if it is the picked polygon and scrolls to
+// it the first time it is drawn.
+static void _mesh_row_pick(mesh_poly_e type, int index) {
+    if (!_state.pick.valid || _state.pick.poly_type != type || _state.pick.poly_index != index) {
+        return;
+    }
+    igTableSetBgColor(ImGuiTableBgTarget_RowBg0, IM_COL32(70, 130, 180, 255), -1);
+    if (_state.pick_scroll_mesh) {
+        igSetScrollHereY(0.5f);
+        _state.pick_scroll_mesh = false;
+    }
+}
+
 static void _draw_window_mesh(void) {
     scene_t* scene = scene_get_internals();
     igBegin("Mesh", &_state.show_window_mesh, 0);
@@ -209,6 +276,7 @@ static void _draw_window_mesh(void) {
                 igTableNextRow();
                 u32 bg_color = hash_int_rand_color(i);
                 igTableSetBgColor(ImGuiTableBgTarget_RowBg0, bg_color, -1);
+                _mesh_row_pick(MESH_POLY_TEX_QUAD, i);
                 igTableSetColumnIndex(0);
                 igText("Tex Quad %d", i);
                 igTableSetColumnIndex(1);
@@ -226,6 +294,7 @@ static void _draw_window_mesh(void) {
                 igTableNextRow();
                 u32 bg_color = hash_int_rand_color(i);
                 igTableSetBgColor(ImGuiTableBgTarget_RowBg0, bg_color, -1);
+                _mesh_row_pick(MESH_POLY_UNTEX_QUAD, i);
                 igTableSetColumnIndex(0);
                 igText("Untex Quad %d", i);
                 igTableSetColumnIndex(1);
@@ -243,6 +312,7 @@ static void _draw_window_mesh(void) {
                 igTableNextRow();
                 u32 bg_color = hash_int_rand_color(i);
                 igTableSetBgColor(ImGuiTableBgTarget_RowBg0, bg_color, -1);
+                _mesh_row_pick(MESH_POLY_TEX_TRI, i);
                 igTableSetColumnIndex(0);
                 igText("Tex Tri %d", i);
                 igTableSetColumnIndex(1);
@@ -260,6 +330,7 @@ static void _draw_window_mesh(void) {
                 igTableNextRow();
                 u32 bg_color = hash_int_rand_color(i);
                 igTableSetBgColor(ImGuiTableBgTarget_RowBg0, bg_color, -1);
+                _mesh_row_pick(MESH_POLY_UNTEX_TRI, i);
                 igTableSetColumnIndex(0);
                 igText("Untex Tri %d", i);
                 igTableSetColumnIndex(1);
@@ -309,6 +380,9 @@ static void _draw_window_sprite_paletted(file_entry_e entry, int width, int heig
 
     igSeparator();
 
+    image_cache_stats_t stats = image_cache_get_stats();
+    igText("Image Cache: %d images, %0.2fMB, Hits: %zu Misses: %zu Evictions: %zu", stats.count, BYTES_TO_MB(stats.size), stats.hits, stats.misses, stats.evictions);
+
     texture_t texture = sprite_get_paletted_texture(entry, *selected);
     igImage(texture_imgui_id(texture), dims);
     igEnd();
@@ -336,6 +410,113 @@ static void _draw_window_event_text(void) {
     igEnd();
 }
 
+// Lists each unique map state of the current map. States with a cached model
+// are marked with a * and switch without reloading.
+static void _draw_map_state_switcher(void) {
+    scene_t* scene = scene_get_internals();
+    if (scene->map == NULL) {
+        return;
+    }
+
+    map_record_t unique_records[MAP_RECORD_MAX_NUM];
+    int unique_count = 0;
+    for (int i = 0; i < scene->map->record_count; i++) {
+        map_record_t record = scene->map->records[i];
+        if (map_record_state_unique(unique_records, unique_count, record)) {
+            unique_records[unique_count++] = record;
+        }
+    }
+
+    for (int i = 0; i < unique_count; i++) {
+        map_state_t state = unique_records[i].state;
+        bool cached = gfx_model_cache_has(scene->current_map, state);
+
+        char label[64];
+        snprintf(label, sizeof(label), "%s %s %d%s", time_str(state.time), weather_str(state.weather), state.layout, cached ? " *" : "");
+
+        igPushIDInt(i);
+        if (igRadioButton(label, map_state_eq(scene->map_state, state))) {
+            scene_set_map_state(state);
+        }
+        igPopID();
+    }
+
+    gfx_model_cache_stats_t stats = gfx_model_cache_get_stats();
+    igText("Model Cache: %d models, %0.2fMB / %0.2fMB", stats.count, BYTES_TO_MB(stats.resident_size), BYTES_TO_MB(GFX_MODEL_CACHE_BUDGET));
+    igText("Hits: %zu Misses: %zu Evictions: %zu", stats.hits, stats.misses, stats.evictions);
+    igText("GPU Sharing: %d resources, %0.2fMB saved", stats.resource_count, BYTES_TO_MB(stats.size - stats.resident_size));
+    map_pool_stats_t map_stats = map_get_pool_stats();
+    igText("Map Sharing: %d resources, %0.2fMB, %0.2fMB saved", map_stats.resource_count, BYTES_TO_MB(map_stats.resident_size), BYTES_TO_MB(map_stats.shared_size));
+}
+
+static void _draw_profiler_row(const char* name, profile_percentiles_t p) {
+    igTableNextRow();
+    igTableNextColumn();
+    igText("%s", name);
+    igTableNextColumn();
+    igText("%.2f", p.p50);
+    igTableNextColumn();
+    igText("%.2f", p.p95);
+    igTableNextColumn();
+    igText("%.2f", p.p99);
+    igTableNextColumn();
+    igText("%.2f", p.max);
+}
+
+// Frame times of the last PROFILE_FRAME_COUNT frames with their percentiles
+// and the per-stage CPU times. Draw counts are sokol_gfx's stats of the last
+// frame.
+static void _draw_profiler(void) {
+    f32 frame_times[PROFILE_FRAME_COUNT];
+    int count = profile_get_frame_times(frame_times);
+    profile_summary_t summary = profile_get_summary();
+    const profile_frame_t* last = profile_get_last_frame();
+
+    char overlay[64];
+    snprintf(overlay, sizeof(overlay), "p50 %.2f ms  p99 %.2f ms", summary.frame_ms.p50, summary.frame_ms.p99);
+    f32 scale_max = summary.frame_ms.max > 0.0f ? summary.frame_ms.max : 1.0f;
+    igPlotLinesEx("##frame_times", frame_times, count, 0, overlay, 0.0f, scale_max, (ImVec2) { 0.0f, 80.0f }, sizeof(f32));
+
+    igText("Draws: %u, Pipelines: %u, Bindings: %u, Uniforms: %u, Uploaded: %u KB", last->draws, last->pipelines, last->bindings, last->uniforms, last->upload_bytes / 1024);
+    igTextDisabled("GPU time is not measured, the frame time includes waiting on it.");
+
+    if (igBeginTable("Profiler", 5, ImGuiTableFlags_BordersInnerV | ImGuiTableFlags_RowBg)) {
+        igTableSetupColumnEx("Stage (ms)", ImGuiTableColumnFlags_WidthStretch, 0.0f, 0);
+        igTableSetupColumnEx("p50", ImGuiTableColumnFlags_WidthFixed, 50.0f, 0);
+        igTableSetupColumnEx("p95", ImGuiTableColumnFlags_WidthFixed, 50.0f, 0);
+        igTableSetupColumnEx("p99", ImGuiTableColumnFlags_WidthFixed, 50.0f, 0);
+        igTableSetupColumnEx("Max", ImGuiTableColumnFlags_WidthFixed, 50.0f, 0);
+        igTableHeadersRow();
+
+        _draw_profiler_row("Frame", summary.frame_ms);
+        _draw_profiler_row("CPU", summary.cpu_ms);
+        for (int i = 0; i < PROFILE_STAGE_COUNT; i++) {
+            _draw_profiler_row(profile_stage_str(i), summary.stage_ms[i]);
+        }
+        igEndTable();
+    }
+
+    // Loading is traced as nested spans while a capture runs. Stopping writes
+    // them to TRACE_PATH for chrome://tracing or Perfetto.
+    trace_stats_t trace = trace_get_stats();
+    if (!trace.capturing && igButton("Start Trace")) {
+        trace_start();
+        _state.trace_written = false;
+        _state.trace_failed = false;
+    } else if (trace.capturing && igButton("Stop Trace")) {
+        trace_stop();
+        _state.trace_written = trace_export(TRACE_PATH);
+        _state.trace_failed = !_state.trace_written;
+    }
+    igSameLine();
+    igText("Spans: %d, Dropped: %d", trace.count, trace.dropped);
+    if (_state.trace_written) {
+        igText("Wrote %s", TRACE_PATH);
+    } else if (_state.trace_failed) {
+        igText("Failed to write %s", TRACE_PATH);
+    }
+}
+
 static void _draw_window_scene(void) {
     camera_t* cam = camera_get_internals();
     scene_t* scene = scene_get_internals();
@@ -392,7 +573,55 @@ static void _draw_window_scene(void) {
     igText("Map: %d - %s", scene->current_map, map_list[scene->current_map].name);
     igNewLine();
 
+    if (igCollapsingHeader("Map State", ImGuiTreeNodeFlags_DefaultOpen)) {
+        _draw_map_state_switcher();
+    }
+
     igCheckbox("Enable Dithering", gfx_get_dither());
+    igCheckbox("Render On Demand", gfx_get_on_demand());
+    igSameLine();
+    igCheckbox("Throttle When Idle", gfx_get_idle_throttle());
+    gfx_frame_stats_t gfx_stats = gfx_get_frame_stats();
+    igText("Offscreen Frames: %zu rendered, %zu skipped", gfx_stats.rendered, gfx_stats.skipped);
+    igText("Sprite Draw Calls: %d", gfx_sprite_get_draw_count());
+    sprite_frame_cache_stats_t frame_stats = gfx_sprite_get_frame_stats();
+    igText("SPR Frames: %d/%d, Hits: %zu Misses: %zu Evictions: %zu", frame_stats.count, SPRITE_FRAME_CACHE_MAX, frame_stats.hits, frame_stats.misses, frame_stats.evictions);
+
+    if (igCollapsingHeader("Resolution", 0)) {
+        for (int scale = GFX_SCALE_MIN; scale <= GFX_SCALE_MAX; scale++) {
+            char label[8];
+            snprintf(label, sizeof(label), "%dx", scale);
+            if (scale > GFX_SCALE_MIN) {
+                igSameLine();
+            }
+            if (igRadioButton(label, gfx_get_scale() == scale)) {
+                gfx_set_scale(scale);
+                *gfx_get_auto_scale() = false;
+            }
+        }
+        igSameLine();
+        igCheckbox("Auto", gfx_get_auto_scale());
+        igSliderFloat("Budget (ms)", gfx_get_scale_budget(), 1.0f, 50.0f);
+        igText("Render Size: %dx%d", GFX_RENDER_WIDTH * gfx_get_scale(), GFX_RENDER_HEIGHT * gfx_get_scale());
+    }
+
+    if (igCollapsingHeader("Simulation", 0)) {
+        sim_t* sim = sim_get_internals();
+        if (igRadioButton("30 Hz", sim->hz == 30)) {
+            sim->hz = 30;
+        }
+        igSameLine();
+        if (igRadioButton("60 Hz", sim->hz == 60)) {
+            sim->hz = 60;
+        }
+        igSameLine();
+        igCheckbox("Interpolate", &sim->interpolate);
+        igText("Steps: %zu, Dropped: %zu, Alpha: %.2f", sim->steps, sim->dropped, sim->alpha);
+    }
+
+    if (igCollapsingHeader("Profiler", 0)) {
+        _draw_profiler();
+    }
 
     if (igCollapsingHeader("Model", ImGuiTreeNodeFlags_DefaultOpen)) {
         transform_t* transform = gfx_model_get_transform();
@@ -440,6 +669,13 @@ static void _draw_window_scene(void) {
 static void _draw_window_map_lights(void) {
     igBegin("Lights", &_state.show_window_map_lights, 0);
 
+    igCheckbox("Bake Static Lights", gfx_model_get_bake());
+    gfx_model_bake_stats_t bake = gfx_model_get_bake_stats();
+    igText("Lighting: %s", bake.active ? "Baked" : "Per Pixel");
+    igText("Bakes: %zu full, %zu partial", bake.full, bake.partial);
+    igText("Last Bake: %0.3fms, %d lights", bake.last_ms, bake.lights);
+    igSeparator();
+
     lighting_t* lighting = gfx_model_get_lighting();
     vec4s* ambient = &lighting->ambient_color;
     igText("Ambient");
@@ -669,15 +905,145 @@ static void _draw_window_event_entd(void) {
     igEnd();
 }
 
+// Plays a sequence of an SPR sheet at the center of the map.
+static void _draw_window_animations(void) {
+    igBegin("Animations", &_state.show_window_animations, 0);
+
+    anim_desc_t* desc = &_state.anim_desc;
+    if (!spr_is_sheet(desc->spr)) {
+        desc->spr = F_BATTLE__RAMUZA_SPR;
+    }
+
+    if (igBeginCombo("SPR", file_list[desc->spr].name, 0)) {
+        for (int i = 0; i < F_FILE_COUNT; i++) {
+            if (spr_is_sheet(i) && igSelectable(file_list[i].name)) {
+                desc->spr = i;
+            }
+        }
+        igEndCombo();
+    }
+
+    if (igBeginCombo("Shape", anim_shape_str(desc->shape), 0)) {
+        for (int i = 0; i < ANIM_SHAPE_COUNT; i++) {
+            if (igSelectable(anim_shape_str(i))) {
+                desc->shape = i;
+            }
+        }
+        igEndCombo();
+    }
+
+    igSliderInt("Sequence", &desc->sequence, 0, SEQ_SEQUENCE_MAX - 1);
+    igSliderInt("Palette", &desc->palette, 0, SPR_UNIT_PALETTE_COUNT - 1);
+
+    if (igButton("Play")) {
+        desc->position = gfx_model_get_offset_center();
+        anim_start(*desc);
+    }
+    igSameLine();
+    if (igButton("Stop All")) {
+        anim_reset();
+    }
+
+    igText("Active: %d/%d", anim_get_active_count(), ANIM_MAX);
+    igEnd();
+}
+
+static void _draw_window_benchmarks(void) {
+    igBegin("Benchmarks", &_state.show_window_benchmarks, 0);
+
+    igText("Pixel kernels: %s", pixel_simd_str());
+    if (igButton("Run Pixel Kernels")) {
+        _state.pixel_bench = pixel_benchmark(20);
+    }
+
+    if (igButton("Run TIM Decode")) {
+        _state.tim_bench = image_tim_benchmark();
+    }
+    if (_state.tim_bench.count > 0) {
+        image_tim_bench_t b = _state.tim_bench;
+        igText("TIM: %d files, %0.2fMB decoded in %0.3fms", b.count, BYTES_TO_MB(b.size), b.ms);
+    }
+
+    if (igButton("Run Pathfinding")) {
+        _state.path_bench = path_benchmark();
+    }
+    if (_state.path_bench.maps > 0) {
+        path_bench_t b = _state.path_bench;
+        igText("Maps: %d", b.maps);
+        igText("Move ranges: %d in %0.3fms (%0.2fus each, %d tiles)", b.range_queries, b.range_ms, b.range_ms * 1000.0 / MAX(b.range_queries, 1), b.range_tiles);
+        igText("Paths: %d in %0.3fms (%0.2fus each, %d tiles)", b.path_queries, b.path_ms, b.path_ms * 1000.0 / MAX(b.path_queries, 1), b.path_tiles);
+    }
+
+    if (igButton("Run Line of Sight")) {
+        _state.sight_bench = sight_benchmark();
+    }
+    if (_state.sight_bench.maps > 0) {
+        sight_bench_t b = _state.sight_bench;
+        igText("Visibility tables: %d maps in %0.3fms (%0.3fms each)", b.maps, b.ms, b.ms / b.maps);
+        igText("Visible: %d of %d tile pairs", b.visible, b.pairs);
+    }
+
+    if (_state.pixel_bench.iterations > 0) {
+        if (igBeginTable("Pixel Kernels", 5, ImGuiTableFlags_BordersInnerV | ImGuiTableFlags_BordersOuterV | ImGuiTableFlags_RowBg)) {
+            igTableSetupColumnEx("Kernel", ImGuiTableColumnFlags_WidthStretch, 0.0f, 0);
+            igTableSetupColumnEx("Baseline ms", ImGuiTableColumnFlags_WidthFixed, 80.0f, 0);
+            igTableSetupColumnEx("Kernel ms", ImGuiTableColumnFlags_WidthFixed, 80.0f, 0);
+            igTableSetupColumnEx("Speedup", ImGuiTableColumnFlags_WidthFixed, 60.0f, 0);
+            igTableSetupColumnEx("Matches", ImGuiTableColumnFlags_WidthFixed, 60.0f, 0);
+            igTableHeadersRow();
+
+            for (int i = 0; i < PIXEL_BENCH_KERNEL_COUNT; i++) {
+                pixel_bench_result_t r = _state.pixel_bench.results[i];
+                igTableNextRow();
+                igTableSetColumnIndex(0);
+                igText("%s", r.name);
+                igTableSetColumnIndex(1);
+                igText("%0.3f", r.baseline_ms);
+                igTableSetColumnIndex(2);
+                igText("%0.3f", r.kernel_ms);
+                igTableSetColumnIndex(3);
+                igText("%0.1fx", r.baseline_ms / r.kernel_ms);
+                igTableSetColumnIndex(4);
+                igText("%s", r.matches ? "true" : "false");
+            }
+            igEndTable();
+        }
+    }
+
+    igEnd();
+}
+
 static void _draw_window_terrain(void) {
     scene_t* scene = scene_get_internals();
-    int x_count = scene->map->primary_mesh.terrain.x_count;
-    int z_count = scene->map->primary_mesh.terrain.z_count;
+    const terrain_t* terrain = &map_get_mesh(scene->map, scene->map_state)->terrain;
+    int x_count = terrain->x_count;
+    int z_count = terrain->z_count;
 
     igBegin("Terrain", &_state.show_window_terrain, 0);
 
     igText("Terrain: %d x %d = %d", x_count, z_count, x_count * z_count);
 
+    if (igBeginCombo("Overlay", gfx_tile_overlay_str(_state.tile_overlay), 0)) {
+        for (int i = 0; i < TILE_OVERLAY_COUNT; i++) {
+            if (igSelectable(gfx_tile_overlay_str(i))) {
+                _state.tile_overlay = i;
+            }
+        }
+        igEndCombo();
+    }
+    if (igRadioButton("Fill", _state.tile_style == TILE_STYLE_FILL)) {
+        _state.tile_style = TILE_STYLE_FILL;
+    }
+    igSameLine();
+    if (igRadioButton("Outline", _state.tile_style == TILE_STYLE_OUTLINE)) {
+        _state.tile_style = TILE_STYLE_OUTLINE;
+    }
+    if (_state.tile_overlay == TILE_OVERLAY_MOVE_RANGE) {
+        igSliderInt("Move", &_state.tile_limits.move, 1, 10);
+        igSliderInt("Jump", &_state.tile_limits.jump, 1, 10);
+        igText("Right click a tile in the viewport to start from it.");
+    }
+
     if (igBeginTable("", 13, ImGuiTableFlags_BordersInnerV | ImGuiTableFlags_BordersOuterV | ImGuiTableFlags_RowBg)) {
         igTableSetupColumnEx("#", ImGuiTableColumnFlags_WidthFixed, 20, 0);
         igTableSetupColumnEx("lvl", ImGuiTableColumnFlags_WidthFixed, 30, 0);
@@ -698,10 +1064,19 @@ static void _draw_window_terrain(void) {
         for (u8 level = 0; level < 2; level++) {
             for (int z = 0; z < z_count; z++) {
                 for (int x = 0; x < x_count; x++) {
-                    tile_t* tile = &scene->map->primary_mesh.terrain.tiles[level][z * x_count + x];
+                    const tile_t* tile = &terrain->tiles[level][z * x_count + x];
                     igTableNextRow();
                     int tile_number = level * (z_count * x_count) + (z * x_count + x);
 
+                    mesh_hit_t* pick = &_state.pick;
+                    if (pick->valid && pick->has_tile && pick->elevation == level && pick->terrain_z == z && pick->terrain_x == x) {
+                        igTableSetBgColor(ImGuiTableBgTarget_RowBg0, IM_COL32(70, 130, 180, 255), -1);
+                        if (_state.pick_scroll_terrain) {
+                            igSetScrollHereY(0.5f);
+                            _state.pick_scroll_terrain = false;
+                        }
+                    }
+
                     igTableSetColumnIndex(0);
                     igText("%d", tile_number);
                     igTableSetColumnIndex(1);
@@ -744,8 +1119,69 @@ static void _draw_window_terrain(void) {
     igEnd();
 }
 
+// Rebuild the tile overlay instances from the terrain of the current map
+// state when the overlay settings, the picked tile or the map changed.
+static void _update_tile_overlay(void) {
+    scene_t* scene = scene_get_internals();
+    const terrain_t* terrain = NULL;
+    if (scene->map != NULL) {
+        terrain = &map_get_mesh(scene->map, scene->map_state)->terrain;
+    }
+
+    tile_overlay_key_t key;
+    memset(&key, 0, sizeof(key));
+    key.terrain = terrain;
+    key.map_state = scene->map_state;
+    key.map_num = scene->current_map;
+    key.overlay = _state.tile_overlay;
+    key.style = _state.tile_style;
+    key.limits = _state.tile_limits;
+    key.has_start = _state.pick.valid && _state.pick.has_tile;
+    if (key.has_start) {
+        key.start = (path_tile_t) { _state.pick.terrain_x, _state.pick.terrain_z, _state.pick.elevation };
+    }
+
+    if (_state.tile_built_valid && memcmp(&key, &_state.tile_built, sizeof(key)) == 0) {
+        return;
+    }
+    _state.tile_built = key;
+    _state.tile_built_valid = true;
+
+    if (_state.tile_overlay == TILE_OVERLAY_NONE || terrain == NULL || !terrain->valid) {
+        gfx_tile_clear();
+        return;
+    }
+
+    vec4s colors[PATH_NODE_MAX];
+    gfx_tile_set_style(_state.tile_style);
+
+    if (_state.tile_overlay != TILE_OVERLAY_MOVE_RANGE) {
+        gfx_tile_colors_from_terrain(terrain, _state.tile_overlay, colors);
+        gfx_tile_set(&terrain->grid, colors);
+        return;
+    }
+
+    if (!key.has_start) {
+        gfx_tile_clear();
+        return;
+    }
+    path_range_t range = path_move_range(&terrain->grid, key.start, _state.tile_limits);
+    gfx_tile_colors_from_range(&range, _state.tile_limits.move, colors);
+    gfx_tile_set(&terrain->grid, colors);
+}
+
 static void _draw(void) {
     is_hovered = false;
+
+    u32 generation = scene_get_internals()->map_generation;
+    if (_state.pick_generation != generation) {
+        _state.pick_generation = generation;
+        _state.pick = (mesh_hit_t) { 0 };
+        _state.pick_scroll_mesh = false;
+        _state.pick_scroll_terrain = false;
+    }
+
+    _update_tile_overlay();
     ImVec2 dims = {
         .x = GFX_RENDER_WIDTH * GFX_RENDER_SCALE,
         .y = GFX_RENDER_HEIGHT * GFX_RENDER_SCALE,
@@ -800,17 +1236,38 @@ static void _draw(void) {
         }
         igEndMenu();
     }
+    if (igBeginMenu("Tools")) {
+        if (igMenuItem("Benchmarks")) {
+            _state.show_window_benchmarks = !_state.show_window_benchmarks;
+        }
+        igEndMenu();
+    }
     if (igBeginMenu("Sprites")) {
         if (igMenuItem("FONT.BIN")) {
             _state.show_sprite_window[F_EVENT__FONT_BIN] = !_state.show_sprite_window[F_EVENT__FONT_BIN];
         }
 
+        if (igMenuItem("Animations")) {
+            _state.show_window_animations = !_state.show_window_animations;
+        }
+
         for (usize i = 0; i < sizeof(image_desc_list) / sizeof(image_desc_t); i++) {
             image_desc_t desc = image_desc_list[i];
             if (igMenuItem(desc.name)) {
                 _state.show_sprite_window[desc.entry] = !_state.show_sprite_window[desc.entry];
             }
         }
+
+        if (igBeginMenu("TIM")) {
+            const file_entry_e* tims;
+            int tim_count = image_tim_list(&tims);
+            for (int i = 0; i < tim_count; i++) {
+                if (igMenuItem(file_list[tims[i]].name)) {
+                    _state.show_sprite_window[tims[i]] = !_state.show_sprite_window[tims[i]];
+                }
+            }
+            igEndMenu();
+        }
         igEndMenu();
     }
     igEndMainMenuBar();
@@ -818,6 +1275,29 @@ static void _draw(void) {
     igBegin("Viewport", NULL, ImGuiWindowFlags_NoResize);
     if (gfx_get_color_image().id != SG_INVALID_ID) {
         igImage(simgui_imtextureid(gfx_get_color_image()), dims);
+
+        // Right click picks the polygon and tile under the cursor. Left click
+        // is already used for orbiting the camera.
+        if (igIsItemHovered(ImGuiHoveredFlags_None) && igIsMouseClicked(ImGuiMouseButton_Right)) {
+            ImVec2 min = igGetItemRectMin();
+            ImVec2 max = igGetItemRectMax();
+            ImVec2 mouse = igGetMousePos();
+            f32 u = (mouse.x - min.x) / (max.x - min.x);
+            f32 v = (mouse.y - min.y) / (max.y - min.y);
+
+            // The offscreen projection flips Y, so the top of the image is -1.
+            _state.pick = scene_pick(u * 2.0f - 1.0f, v * 2.0f - 1.0f);
+            _state.pick_scroll_mesh = _state.pick.valid;
+            _state.pick_scroll_terrain = _state.pick.valid && _state.pick.has_tile;
+        }
+    }
+    if (_state.pick.valid) {
+        mesh_hit_t* pick = &_state.pick;
+        igText("Picked %s %d", mesh_poly_str(pick->poly_type), pick->poly_index);
+        if (pick->has_tile) {
+            igSameLine();
+            igText("- Tile X: %d Z: %d Lvl: %d", pick->terrain_x, pick->terrain_z, pick->elevation);
+        }
     }
     if (igIsWindowHovered(ImGuiHoveredFlags_None)) {
         is_hovered = true;
@@ -870,6 +1350,23 @@ static void _draw(void) {
         }
     }
 
+    const file_entry_e* tims;
+    int tim_count = image_tim_list(&tims);
+    for (int i = 0; i < tim_count; i++) {
+        if (_state.show_sprite_window[tims[i]]) {
+            image_desc_t desc = image_get_desc(tims[i]);
+            _draw_window_sprite_paletted(tims[i], desc.width, desc.height);
+        }
+    }
+
+    if (_state.show_window_benchmarks) {
+        _draw_window_benchmarks();
+    }
+
+    if (_state.show_window_animations) {
+        _draw_window_animations();
+    }
+
     if (_state.show_window_demo) {
         igShowDemoWindow(&_state.show_window_demo);
     }
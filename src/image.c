@@ -1,16 +1,56 @@
 #include <string.h>
 
+#include "sokol_time.h"
+
 #include "defines.h"
 #include "image.h"
 #include "memory.h"
+#include "pixel.h"
 #include "span.h"
+#include "trace.h"
 #include "util.h"
 
 enum {
     PAL_COL_COUNT = 16,
     PAL_ROW_SIZE = PAL_COL_COUNT * 4, // 4 bytes per color
+
+    PAL_8BPP_COL_COUNT = 256,
+    PAL_8BPP_ROW_SIZE = PAL_8BPP_COL_COUNT * 4,
+
+    TIM_MAGIC = 0x10,
+    TIM_FLAG_CLUT = 0x08,
+    TIM_FILE_MAX = 32,
 };
 
+// A decoded image of a file. palette_idx is only used for paletted RGBA8
+// images, R8 images are the palette indices.
+typedef struct {
+    image_desc_t desc;
+    int palette_idx;
+    image_format_e format;
+    image_t image;
+    u64 last_used;
+    bool valid;
+} image_cache_entry_t;
+
+static struct {
+    image_cache_entry_t entries[IMAGE_CACHE_MAX];
+    u64 tick;
+    image_cache_stats_t stats;
+
+    // TIM headers are parsed once, indexed like image_tim_list().
+    image_desc_t tim_descs[TIM_FILE_MAX];
+    bool tim_parsed[TIM_FILE_MAX];
+} _state;
+
+static image_t _read_using_palette(span_t*, image_desc_t, int);
+static image_t _cache_get(span_t*, image_desc_t, int, image_format_e);
+static bool _desc_equal(const image_desc_t*, const image_desc_t*);
+static image_t _copy(image_t);
+static image_t _decode(span_t*, image_desc_t, int, image_format_e);
+static void _cache_evict(usize);
+static image_t _read_clut(span_t*, image_desc_t, int);
+
 image_t image_read_palette(span_t* span, int rows) {
     // Each color is 16 colors * 2 bytes per color = 32 bytes per row
     // FIXME: There are exception to this with 512 byte palettes.
@@ -18,51 +58,101 @@ image_t image_read_palette(span_t* span, int rows) {
 }
 
 image_t image_read_4bpp(span_t* span, int width, int height) {
+    TRACE_BEGIN();
     const int dims = width * height;
     const int size = dims * 4;
     const int size_on_disk = dims / 2; // two pixels per byte
 
     u8* data = memory_allocate(size);
 
-    usize write_idx = 0;
-    for (int i = 0; i < size_on_disk; i++) {
-        u8 raw_pixel = span_read_u8(span);
+    pixel_4bpp_to_rgba(span_read_ptr(span, size_on_disk), data, size_on_disk);
+    TRACE_END();
 
-        u8 right = (raw_pixel & 0x0F);
-        u8 left = (raw_pixel & 0xF0) >> 4;
+    return (image_t) {
+        .width = width,
+        .height = height,
+        .data = data,
+        .size = size,
+        .valid = true
+    };
+}
 
-        for (int j = 0; j < 4; j++) {
-            data[write_idx++] = right;
-        }
+// Read a 4bpp image keeping one palette index per byte (R8). This is a quarter
+// of the size of image_read_4bpp() for images only sampled for their index.
+image_t image_read_4bpp_indexed(span_t* span, int width, int height) {
+    TRACE_BEGIN();
+    const int dims = width * height;
+    const int size_on_disk = dims / 2; // two pixels per byte
 
-        for (int j = 0; j < 4; j++) {
-            data[write_idx++] = left;
-        }
-    }
+    u8* data = memory_allocate(dims);
+
+    pixel_4bpp_to_r8(span_read_ptr(span, size_on_disk), data, size_on_disk);
+    TRACE_END();
 
     return (image_t) {
         .width = width,
         .height = height,
         .data = data,
-        .size = size,
-        .valid = true
+        .size = dims,
+        .format = IMAGE_FORMAT_R8,
+        .valid = true,
     };
 }
 
 image_t image_read_16bpp(span_t* span, int width, int height) {
+    TRACE_BEGIN();
+    const int dims = width * height;
+    const int size = dims * 4;
+
+    u8* data = memory_allocate(size);
+
+    pixel_bgr555_to_rgba(span_read_ptr(span, dims * 2), data, dims);
+    TRACE_END();
+
+    return (image_t) {
+        .width = width,
+        .height = height,
+        .data = data,
+        .size = size,
+        .valid = true,
+    };
+}
+
+// Read an 8bpp image using a palette of 256 colors per row.
+image_t image_read_8bpp_pal(span_t* span, int width, int height, image_t palette, usize pal_idx) {
+    TRACE_BEGIN();
     const int dims = width * height;
     const int size = dims * 4;
 
     u8* data = memory_allocate(size);
 
-    usize write_idx = 0;
-    for (int i = 0; i < dims; i++) {
-        u16 val = span_read_u16(span);
-        data[write_idx++] = (val & 0x001F) << 3; // 0b0000000000011111
-        data[write_idx++] = (val & 0x03E0) >> 2; // 0b0000001111100000
-        data[write_idx++] = (val & 0x7C00) >> 7; // 0b0111110000000000
-        data[write_idx++] = (val == 0) ? 0x00 : 0xFF;
+    ASSERT(PAL_8BPP_ROW_SIZE * (pal_idx + 1) <= palette.size, "Palette row %zu out of bounds", pal_idx);
+    pixel_8bpp_pal_to_rgba(span_read_ptr(span, dims), data, dims, &palette.data[PAL_8BPP_ROW_SIZE * pal_idx]);
+    TRACE_END();
+
+    return (image_t) {
+        .width = width,
+        .height = height,
+        .data = data,
+        .size = size,
+        .valid = true,
+    };
+}
+
+// Rows are stride bytes apart on disk, which can be more than width * 3.
+image_t image_read_24bpp(span_t* span, int width, int height, int stride) {
+    TRACE_BEGIN();
+    const int dims = width * height;
+    const int size = dims * 4;
+
+    ASSERT(stride >= width * 3, "24bpp stride %d is shorter than a row of %d pixels", stride, width);
+    const u8* src = span_read_ptr(span, (usize)stride * height);
+    u8* data = memory_allocate(size);
+
+    for (int y = 0; y < height; y++) {
+        pixel_rgb24_to_rgba(src + y * stride, data + y * width * 4, width);
     }
+    TRACE_END();
 
     return (image_t) {
         .width = width,
@@ -74,19 +164,27 @@ image_t image_read_16bpp(span_t* span, int width, int height) {
 }
 
 // Read and return an image using the palette provided.
-// The image's rgba values are the index of the palette.
+// The pixels are decoded straight to the colors of the palette row.
 image_t image_read_4bpp_pal(span_t* span, int width, int height, image_t palette, usize pal_idx) {
+    TRACE_BEGIN();
     const int dims = width * height;
+    const int size = dims * 4;
+    const int size_on_disk = dims / 2; // two pixels per byte
     const int pal_offset = (PAL_ROW_SIZE * pal_idx);
 
-    image_t image = image_read_4bpp(span, width, height);
+    u8* data = memory_allocate(size);
 
-    for (int i = 0; i < dims * 4; i = i + 4) {
-        u8 pixel = image.data[i];
-        memcpy(&image.data[i], &palette.data[pal_offset + (pixel * 4)], 4);
-    }
+    ASSERT((usize)pal_offset + PAL_ROW_SIZE <= palette.size, "Palette row %zu out of bounds", pal_idx);
+    pixel_4bpp_pal_to_rgba(span_read_ptr(span, size_on_disk), data, size_on_disk, &palette.data[pal_offset]);
+    TRACE_END();
 
-    return image;
+    return (image_t) {
+        .width = width,
+        .height = height,
+        .data = data,
+        .size = size,
+        .valid = true,
+    };
 }
 
 void image_destroy(image_t image) {
@@ -99,36 +197,339 @@ image_t image_read(span_t* span, image_desc_t desc) {
     return image_read_using_palette(span, desc, 0); // default to palette index 0
 }
 
+// image_read_using_palette returns the image decoded with the palette. Images
+// decoded before come from the decoded-image cache. The caller owns the
+// result and destroys it with image_destroy().
 image_t image_read_using_palette(span_t* span, image_desc_t desc, int pal_index) {
+    return _cache_get(span, desc, pal_index, IMAGE_FORMAT_RGBA8);
+}
+
+// Decode without the cache.
+static image_t _read_using_palette(span_t* span, image_desc_t desc, int pal_index) {
     switch (desc.type) {
     case IMG_4BPP:
         span->offset = desc.data_offset;
         return image_read_4bpp(span, desc.width, desc.height);
     case IMG_4BPP_PAL:
         span->offset = desc.pal_offset;
-        image_t palette = image_read_palette(span, desc.pal_count);
+        image_t palette = _read_clut(span, desc, PAL_COL_COUNT);
         span->offset = desc.data_offset;
         image_t image = image_read_4bpp_pal(span, desc.width, desc.height, palette, pal_index);
         image_destroy(palette);
         return image;
+    case IMG_8BPP_PAL:
+        span->offset = desc.pal_offset;
+        image_t palette_8bpp = _read_clut(span, desc, PAL_8BPP_COL_COUNT);
+        span->offset = desc.data_offset;
+        image_t image_8bpp = image_read_8bpp_pal(span, desc.width, desc.height, palette_8bpp, pal_index);
+        image_destroy(palette_8bpp);
+        return image_8bpp;
     case IMG_16BPP:
         span->offset = desc.data_offset;
         return image_read_16bpp(span, desc.width, desc.height);
+    case IMG_24BPP:
+        span->offset = desc.data_offset;
+        return image_read_24bpp(span, desc.width, desc.height, desc.stride);
     default:
         return (image_t) { 0 }; // Return an empty image if type is unknown
         ASSERT(false, "Unknown image type: %d", desc.type);
     }
 }
 
+// _read_clut reads pal_count palettes of row_colors colors. A CLUT that
+// doesn't fill its last palette is padded with transparent black rather than
+// reading past it.
+static image_t _read_clut(span_t* span, image_desc_t desc, int row_colors) {
+    int color_count = desc.pal_color_count > 0 ? desc.pal_color_count : desc.pal_count * row_colors;
+    ASSERT(color_count <= desc.pal_count * row_colors, "CLUT of %s has more colors than its palettes", desc.name);
+
+    image_t colors = image_read_16bpp(span, color_count, 1);
+    if (color_count == desc.pal_count * row_colors) {
+        colors.width = row_colors;
+        colors.height = desc.pal_count;
+        return colors;
+    }
+
+    usize size = desc.pal_count * row_colors * 4;
+    u8* data = memory_allocate(size);
+    memcpy(data, colors.data, colors.size);
+    image_destroy(colors);
+
+    return (image_t) {
+        .width = row_colors,
+        .height = desc.pal_count,
+        .data = data,
+        .size = size,
+        .valid = true,
+    };
+}
+
+// image_get returns the image of the file decoded with the palette, as RGBA8
+// or as R8 palette indices. The caller owns the result and destroys it with
+// image_destroy().
+image_t image_get(file_entry_e entry, int palette_idx, image_format_e format) {
+    image_desc_t desc = image_get_desc(entry);
+    ASSERT(desc.entry == entry, "No image description for file %d", entry);
+
+    span_t span = filesystem_read_file(entry);
+    return _cache_get(&span, desc, palette_idx, format);
+}
+
+// _cache_get returns a copy of the image from the decoded-image cache, decoding
+// it from span on a miss. The cache keeps its own copy so evicting it never
+// frees an image a caller holds. The least recently used images are evicted to
+// keep the cache within IMAGE_CACHE_BUDGET bytes.
+static image_t _cache_get(span_t* span, image_desc_t desc, int palette_idx, image_format_e format) {
+    if (format == IMAGE_FORMAT_R8 || (desc.type != IMG_4BPP_PAL && desc.type != IMG_8BPP_PAL)) {
+        palette_idx = 0;
+    }
+
+    _state.tick++;
+
+    for (int i = 0; i < IMAGE_CACHE_MAX; i++) {
+        image_cache_entry_t* cached = &_state.entries[i];
+        if (cached->valid && _desc_equal(&cached->desc, &desc)
+            && cached->palette_idx == palette_idx && cached->format == format) {
+            cached->last_used = _state.tick;
+            _state.stats.hits++;
+            return _copy(cached->image);
+        }
+    }
+
+    _state.stats.misses++;
+
+    image_t image = _decode(span, desc, palette_idx, format);
+    if (image.size > IMAGE_CACHE_BUDGET) {
+        return image;
+    }
+    _cache_evict(image.size);
+
+    for (int i = 0; i < IMAGE_CACHE_MAX; i++) {
+        image_cache_entry_t* cached = &_state.entries[i];
+        if (!cached->valid) {
+            *cached = (image_cache_entry_t) {
+                .desc = desc,
+                .palette_idx = palette_idx,
+                .format = format,
+                .image = image,
+                .last_used = _state.tick,
+                .valid = true,
+            };
+            _state.stats.count++;
+            _state.stats.size += image.size;
+            return _copy(image);
+        }
+    }
+
+    ASSERT(false, "Image cache has no free entry");
+}
+
+// Two descriptions decode to the same pixels when they read the same bytes of
+// the same file the same way.
+static bool _desc_equal(const image_desc_t* a, const image_desc_t* b) {
+    return a->entry == b->entry && a->type == b->type
+        && a->width == b->width && a->height == b->height && a->stride == b->stride
+        && a->data_offset == b->data_offset && a->pal_offset == b->pal_offset
+        && a->pal_count == b->pal_count && a->pal_color_count == b->pal_color_count;
+}
+
+static image_t _copy(image_t image) {
+    u8* data = memory_allocate(image.size);
+    memcpy(data, image.data, image.size);
+    image.data = data;
+    return image;
+}
+
+void image_cache_shutdown(void) {
+    for (int i = 0; i < IMAGE_CACHE_MAX; i++) {
+        if (_state.entries[i].valid) {
+            image_destroy(_state.entries[i].image);
+        }
+        _state.entries[i] = (image_cache_entry_t) { 0 };
+    }
+    _state.stats = (image_cache_stats_t) { 0 };
+}
+
+image_cache_stats_t image_cache_get_stats(void) {
+    return _state.stats;
+}
+
+static image_t _decode(span_t* span, image_desc_t desc, int palette_idx, image_format_e format) {
+    if (format == IMAGE_FORMAT_R8) {
+        ASSERT(desc.type == IMG_4BPP || desc.type == IMG_4BPP_PAL, "Only 4bpp images can be read as palette indices");
+        span->offset = desc.data_offset;
+        return image_read_4bpp_indexed(span, desc.width, desc.height);
+    }
+
+    return _read_using_palette(span, desc, palette_idx);
+}
+
+// Evict least recently used images until there is a free entry and the
+// incoming size fits the budget.
+static void _cache_evict(usize incoming_size) {
+    while (_state.stats.count >= IMAGE_CACHE_MAX || _state.stats.size + incoming_size > IMAGE_CACHE_BUDGET) {
+        image_cache_entry_t* oldest = NULL;
+        for (int i = 0; i < IMAGE_CACHE_MAX; i++) {
+            image_cache_entry_t* cached = &_state.entries[i];
+            if (cached->valid && (oldest == NULL || cached->last_used < oldest->last_used)) {
+                oldest = cached;
+            }
+        }
+        if (oldest == NULL) {
+            return;
+        }
+
+        image_destroy(oldest->image);
+        _state.stats.count--;
+        _state.stats.size -= oldest->image.size;
+        _state.stats.evictions++;
+        *oldest = (image_cache_entry_t) { 0 };
+    }
+}
+
+// image_get_desc returns the description of the image in the file. TIM files
+// describe themselves, their description is read from the header.
 image_desc_t image_get_desc(file_entry_e entry) {
     for (usize i = 0; i < sizeof(image_desc_list) / sizeof(image_desc_t); i++) {
         if (image_desc_list[i].entry == entry) {
             return image_desc_list[i];
         }
     }
+
+    const file_entry_e* tims;
+    int tim_count = image_tim_list(&tims);
+    for (int i = 0; i < tim_count; i++) {
+        if (tims[i] == entry) {
+            if (!_state.tim_parsed[i]) {
+                span_t span = filesystem_read_file(entry);
+                _state.tim_descs[i] = image_read_tim_desc(&span, entry);
+                _state.tim_parsed[i] = true;
+            }
+            return _state.tim_descs[i];
+        }
+    }
+
     return (image_desc_t) { 0 }; // Return an empty descriptor if not found
 }
 
+// image_read_tim_desc reads the header of a PSX TIM file.
+//
+// Header:
+//   u32 magic (0x10)
+//   u32 flags, bits 0-2 are the pixel mode (0: 4bpp, 1: 8bpp, 2: 16bpp,
+//       3: 24bpp) and bit 3 is set if there is a CLUT block.
+// CLUT and image blocks:
+//   u32 length of the block including this 12 byte header
+//   u16 x, u16 y (framebuffer position, unused)
+//   u16 width in 16-bit units, u16 height
+//   data
+image_desc_t image_read_tim_desc(span_t* span, file_entry_e entry) {
+    span->offset = 0;
+    u32 magic = span_read_u32(span);
+    ASSERT(magic == TIM_MAGIC, "%s is not a TIM file", file_list[entry].name);
+
+    u32 flags = span_read_u32(span);
+    u32 mode = flags & 0x07;
+    bool has_clut = (flags & TIM_FLAG_CLUT) != 0;
+
+    image_desc_t desc = {
+        .name = file_list[entry].name,
+        .entry = entry,
+    };
+
+    int color_count = 0;
+    if (has_clut) {
+        usize clut_start = span->offset;
+        u32 clut_length = span_read_u32(span);
+        span->offset += 4; // x, y
+        u16 clut_width = span_read_u16(span);
+        u16 clut_height = span_read_u16(span);
+
+        desc.pal_offset = span->offset;
+        desc.pal_length = clut_length - 12;
+        color_count = clut_width * clut_height;
+        desc.pal_color_count = color_count;
+        span->offset = clut_start + clut_length;
+    }
+
+    u32 image_length = span_read_u32(span);
+    span->offset += 4; // x, y
+    u16 width = span_read_u16(span);
+    u16 height = span_read_u16(span);
+
+    desc.data_offset = span->offset;
+    desc.data_length = image_length - 12;
+    desc.height = height;
+
+    switch (mode) {
+    case 0:
+        desc.type = has_clut ? IMG_4BPP_PAL : IMG_4BPP;
+        desc.width = width * 4;
+        desc.pal_count = (color_count + PAL_COL_COUNT - 1) / PAL_COL_COUNT;
+        break;
+    case 1:
+        ASSERT(has_clut, "8bpp TIM %s has no CLUT", desc.name);
+        desc.type = IMG_8BPP_PAL;
+        desc.width = width * 2;
+        desc.pal_count = (color_count + PAL_8BPP_COL_COUNT - 1) / PAL_8BPP_COL_COUNT;
+        break;
+    case 2:
+        desc.type = IMG_16BPP;
+        desc.width = width;
+        break;
+    case 3:
+        desc.type = IMG_24BPP;
+        desc.width = width * 2 / 3;
+        desc.stride = width * 2;
+        break;
+    default:
+        ASSERT(false, "Unknown TIM pixel mode %d in %s", mode, desc.name);
+    }
+
+    return desc;
+}
+
+// image_tim_list returns the TIM files on the disc.
+int image_tim_list(const file_entry_e** out) {
+    static file_entry_e tims[TIM_FILE_MAX];
+    static int tim_count = -1;
+
+    if (tim_count < 0) {
+        tim_count = 0;
+        for (int i = 0; i < F_FILE_COUNT; i++) {
+            const char* name = file_list[i].name;
+            usize len = strlen(name);
+            if (len > 4 && strcmp(&name[len - 4], ".TIM") == 0) {
+                ASSERT(tim_count < TIM_FILE_MAX, "Too many TIM files");
+                tims[tim_count++] = i;
+            }
+        }
+    }
+
+    *out = tims;
+    return tim_count;
+}
+
+// image_tim_benchmark parses and decodes every TIM file on the disc.
+image_tim_bench_t image_tim_benchmark(void) {
+    const file_entry_e* tims;
+    int tim_count = image_tim_list(&tims);
+
+    image_tim_bench_t bench = { .count = tim_count };
+
+    u64 start = stm_now();
+    for (int i = 0; i < tim_count; i++) {
+        span_t span = filesystem_read_file(tims[i]);
+        image_desc_t desc = image_read_tim_desc(&span, tims[i]);
+        image_t image = _read_using_palette(&span, desc, 0);
+        bench.size += image.size;
+        image_destroy(image);
+    }
+    bench.ms = stm_ms(stm_since(start));
+
+    return bench;
+}
+
 // clang-format off
 const image_desc_t image_desc_list[4] = {
     { .name = "FRAME.BIN", .entry = F_EVENT__FRAME_BIN, .type = IMG_4BPP_PAL, .width = 256, .height = 288, .pal_offset = 36864, .pal_count = 22, .pal_default = 5 },
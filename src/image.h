@@ -12,18 +12,31 @@
 #include "map_record.h"
 #include "span.h"
 
+enum {
+    IMAGE_CACHE_MAX = 64,
+    IMAGE_CACHE_BUDGET = 16 * 1024 * 1024,
+};
+
+typedef enum {
+    IMAGE_FORMAT_RGBA8, // 4 bytes per pixel
+    IMAGE_FORMAT_R8,    // 1 byte per pixel, used for palette indices
+} image_format_e;
+
 typedef struct {
     int width;
     int height;
     usize size;
     u8* data;
+    image_format_e format;
     bool valid;
 } image_t;
 
 typedef enum {
     IMG_4BPP,
     IMG_4BPP_PAL,
+    IMG_8BPP_PAL,
     IMG_16BPP,
+    IMG_24BPP,
 } image_type_e;
 
 typedef struct {
@@ -33,16 +46,32 @@ typedef struct {
 
     int width;
     int height;
+    int stride; // Bytes per row of 24bpp TIMs, rows are padded to halfwords
 
     int data_offset;
     int data_length;
 
     int pal_offset;
     int pal_length;
-    int pal_count;
+    int pal_count; // Number of palettes, 16 colors each for 4bpp and 256 for 8bpp
+    int pal_color_count; // Colors in a TIM CLUT, 0 when there are pal_count full palettes
     int pal_default;
 } image_desc_t;
 
+typedef struct {
+    int count;
+    usize size; // Decoded bytes
+    f64 ms;
+} image_tim_bench_t;
+
+typedef struct {
+    int count;
+    usize size;
+    usize hits;
+    usize misses;
+    usize evictions;
+} image_cache_stats_t;
+
 extern const image_desc_t image_desc_list[4];
 image_desc_t image_get_desc(file_entry_e);
 
@@ -53,5 +82,16 @@ image_t image_read_using_palette(span_t* span, image_desc_t desc, int pal_index)
 
 image_t image_read_palette(span_t*, int);
 image_t image_read_4bpp(span_t*, int, int);
+image_t image_read_4bpp_indexed(span_t*, int, int);
 image_t image_read_4bpp_pal(span_t*, int, int, image_t, usize);
+image_t image_read_8bpp_pal(span_t*, int, int, image_t, usize);
 image_t image_read_16bpp(span_t*, int, int);
+image_t image_read_24bpp(span_t*, int, int, int);
+
+image_desc_t image_read_tim_desc(span_t*, file_entry_e);
+int image_tim_list(const file_entry_e**);
+image_tim_bench_t image_tim_benchmark(void);
+
+image_t image_get(file_entry_e, int, image_format_e);
+void image_cache_shutdown(void);
+image_cache_stats_t image_cache_get_stats(void);
@@ -1,11 +1,30 @@
+#include <math.h>
+#include <string.h>
+
 #include "cglm/util.h"
 
 #include "lighting.h"
 #include "mesh.h"
 
+// AVX2 builds use the SSE2 path, the bake is bound by memory bandwidth.
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define LIGHTING_SIMD_SSE2
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define LIGHTING_SIMD_NEON
+#elif defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#define LIGHTING_SIMD_WASM
+#endif
+
 static f32 read_light_color(span_t*);
 static vec4s read_rgb8(span_t*);
 
+static void _bake_normals_scalar(const f32*, f32*, usize, usize, mat3s);
+static void _bake_intensity_scalar(const f32*, f32*, usize, usize, vec3s);
+static void _bake_colors_scalar(const f32* const*, const vec4s*, int, f32*, usize, usize);
+
 // read_light_color clamps the value between 0.0 and 1.0. These unclamped values
 // are used to affect the lighting model but it isn't understood yet.
 // https://ffhacktics.com/wiki/Maps/Mesh#Light_colors_and_positions.2C_background_gradient_colors
@@ -69,3 +88,245 @@ static f32 read_light_color(span_t* span) {
     f32 val = span_read_f16(span);
     return glm_min(glm_max(0.0f, val), 1.0f);
 }
+
+//
+// Bake kernels
+//
+
+void lighting_bake_normals(const f32* src, f32* dst, usize count, mat3s m) {
+    usize i = 0;
+
+#if defined(LIGHTING_SIMD_SSE2)
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    __m128 c[3][3];
+    for (int col = 0; col < 3; col++) {
+        for (int row = 0; row < 3; row++) {
+            c[col][row] = _mm_set1_ps(m.col[col].raw[row]);
+        }
+    }
+    for (; i + 4 <= count; i += 4) {
+        __m128 nx = _mm_loadu_ps(src + i);
+        __m128 ny = _mm_loadu_ps(src + count + i);
+        __m128 nz = _mm_loadu_ps(src + count * 2 + i);
+        __m128 x = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c[0][0], nx), _mm_mul_ps(c[1][0], ny)), _mm_mul_ps(c[2][0], nz));
+        __m128 y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c[0][1], nx), _mm_mul_ps(c[1][1], ny)), _mm_mul_ps(c[2][1], nz));
+        __m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c[0][2], nx), _mm_mul_ps(c[1][2], ny)), _mm_mul_ps(c[2][2], nz));
+
+        // Zero length normals stay zero instead of becoming NaN.
+        __m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+        __m128 inv = _mm_and_ps(_mm_div_ps(one, _mm_sqrt_ps(len2)), _mm_cmpgt_ps(len2, zero));
+        _mm_storeu_ps(dst + i, _mm_mul_ps(x, inv));
+        _mm_storeu_ps(dst + count + i, _mm_mul_ps(y, inv));
+        _mm_storeu_ps(dst + count * 2 + i, _mm_mul_ps(z, inv));
+    }
+#elif defined(LIGHTING_SIMD_NEON)
+    const float32x4_t zero = vdupq_n_f32(0.0f);
+    float32x4_t c[3][3];
+    for (int col = 0; col < 3; col++) {
+        for (int row = 0; row < 3; row++) {
+            c[col][row] = vdupq_n_f32(m.col[col].raw[row]);
+        }
+    }
+    for (; i + 4 <= count; i += 4) {
+        float32x4_t nx = vld1q_f32(src + i);
+        float32x4_t ny = vld1q_f32(src + count + i);
+        float32x4_t nz = vld1q_f32(src + count * 2 + i);
+        float32x4_t x = vmlaq_f32(vmlaq_f32(vmulq_f32(c[0][0], nx), c[1][0], ny), c[2][0], nz);
+        float32x4_t y = vmlaq_f32(vmlaq_f32(vmulq_f32(c[0][1], nx), c[1][1], ny), c[2][1], nz);
+        float32x4_t z = vmlaq_f32(vmlaq_f32(vmulq_f32(c[0][2], nx), c[1][2], ny), c[2][2], nz);
+
+        // 32-bit ARM has no vector square root, two Newton steps refine the
+        // estimate to float precision.
+        float32x4_t len2 = vmlaq_f32(vmlaq_f32(vmulq_f32(x, x), y, y), z, z);
+        float32x4_t inv = vrsqrteq_f32(len2);
+        inv = vmulq_f32(inv, vrsqrtsq_f32(vmulq_f32(len2, inv), inv));
+        inv = vmulq_f32(inv, vrsqrtsq_f32(vmulq_f32(len2, inv), inv));
+        inv = vbslq_f32(vcgtq_f32(len2, zero), inv, zero);
+        vst1q_f32(dst + i, vmulq_f32(x, inv));
+        vst1q_f32(dst + count + i, vmulq_f32(y, inv));
+        vst1q_f32(dst + count * 2 + i, vmulq_f32(z, inv));
+    }
+#elif defined(LIGHTING_SIMD_WASM)
+    const v128_t zero = wasm_f32x4_splat(0.0f);
+    const v128_t one = wasm_f32x4_splat(1.0f);
+    v128_t c[3][3];
+    for (int col = 0; col < 3; col++) {
+        for (int row = 0; row < 3; row++) {
+            c[col][row] = wasm_f32x4_splat(m.col[col].raw[row]);
+        }
+    }
+    for (; i + 4 <= count; i += 4) {
+        v128_t nx = wasm_v128_load(src + i);
+        v128_t ny = wasm_v128_load(src + count + i);
+        v128_t nz = wasm_v128_load(src + count * 2 + i);
+        v128_t x = wasm_f32x4_add(wasm_f32x4_add(wasm_f32x4_mul(c[0][0], nx), wasm_f32x4_mul(c[1][0], ny)), wasm_f32x4_mul(c[2][0], nz));
+        v128_t y = wasm_f32x4_add(wasm_f32x4_add(wasm_f32x4_mul(c[0][1], nx), wasm_f32x4_mul(c[1][1], ny)), wasm_f32x4_mul(c[2][1], nz));
+        v128_t z = wasm_f32x4_add(wasm_f32x4_add(wasm_f32x4_mul(c[0][2], nx), wasm_f32x4_mul(c[1][2], ny)), wasm_f32x4_mul(c[2][2], nz));
+
+        v128_t len2 = wasm_f32x4_add(wasm_f32x4_add(wasm_f32x4_mul(x, x), wasm_f32x4_mul(y, y)), wasm_f32x4_mul(z, z));
+        v128_t inv = wasm_v128_and(wasm_f32x4_div(one, wasm_f32x4_sqrt(len2)), wasm_f32x4_gt(len2, zero));
+        wasm_v128_store(dst + i, wasm_f32x4_mul(x, inv));
+        wasm_v128_store(dst + count + i, wasm_f32x4_mul(y, inv));
+        wasm_v128_store(dst + count * 2 + i, wasm_f32x4_mul(z, inv));
+    }
+#endif
+
+    _bake_normals_scalar(src, dst, i, count, m);
+}
+
+void lighting_bake_intensity(const f32* normals, f32* dst, usize count, vec3s direction) {
+    // The shader normalizes the direction, a zero direction lights nothing.
+    f32 len = sqrtf(direction.x * direction.x + direction.y * direction.y + direction.z * direction.z);
+    f32 inv = len > 0.0f ? 1.0f / len : 0.0f;
+    vec3s dir = { { direction.x * inv, direction.y * inv, direction.z * inv } };
+    usize i = 0;
+
+#if defined(LIGHTING_SIMD_SSE2)
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 dx = _mm_set1_ps(dir.x);
+    const __m128 dy = _mm_set1_ps(dir.y);
+    const __m128 dz = _mm_set1_ps(dir.z);
+    for (; i + 4 <= count; i += 4) {
+        __m128 nx = _mm_loadu_ps(normals + i);
+        __m128 ny = _mm_loadu_ps(normals + count + i);
+        __m128 nz = _mm_loadu_ps(normals + count * 2 + i);
+        __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, dx), _mm_mul_ps(ny, dy)), _mm_mul_ps(nz, dz));
+        _mm_storeu_ps(dst + i, _mm_min_ps(_mm_max_ps(d, zero), one));
+    }
+#elif defined(LIGHTING_SIMD_NEON)
+    const float32x4_t zero = vdupq_n_f32(0.0f);
+    const float32x4_t one = vdupq_n_f32(1.0f);
+    const float32x4_t dx = vdupq_n_f32(dir.x);
+    const float32x4_t dy = vdupq_n_f32(dir.y);
+    const float32x4_t dz = vdupq_n_f32(dir.z);
+    for (; i + 4 <= count; i += 4) {
+        float32x4_t nx = vld1q_f32(normals + i);
+        float32x4_t ny = vld1q_f32(normals + count + i);
+        float32x4_t nz = vld1q_f32(normals + count * 2 + i);
+        float32x4_t d = vmlaq_f32(vmlaq_f32(vmulq_f32(nx, dx), ny, dy), nz, dz);
+        vst1q_f32(dst + i, vminq_f32(vmaxq_f32(d, zero), one));
+    }
+#elif defined(LIGHTING_SIMD_WASM)
+    const v128_t zero = wasm_f32x4_splat(0.0f);
+    const v128_t one = wasm_f32x4_splat(1.0f);
+    const v128_t dx = wasm_f32x4_splat(dir.x);
+    const v128_t dy = wasm_f32x4_splat(dir.y);
+    const v128_t dz = wasm_f32x4_splat(dir.z);
+    for (; i + 4 <= count; i += 4) {
+        v128_t nx = wasm_v128_load(normals + i);
+        v128_t ny = wasm_v128_load(normals + count + i);
+        v128_t nz = wasm_v128_load(normals + count * 2 + i);
+        v128_t d = wasm_f32x4_add(wasm_f32x4_add(wasm_f32x4_mul(nx, dx), wasm_f32x4_mul(ny, dy)), wasm_f32x4_mul(nz, dz));
+        wasm_v128_store(dst + i, wasm_f32x4_min(wasm_f32x4_max(d, zero), one));
+    }
+#endif
+
+    _bake_intensity_scalar(normals, dst, i, count, dir);
+}
+
+void lighting_bake_colors(const f32* const* intensities, const vec4s* colors, int light_count, f32* dst, usize count) {
+    usize i = 0;
+
+#if defined(LIGHTING_SIMD_SSE2)
+    for (; i + 4 <= count; i += 4) {
+        __m128 r = _mm_setzero_ps();
+        __m128 g = _mm_setzero_ps();
+        __m128 b = _mm_setzero_ps();
+        __m128 a = _mm_set1_ps(1.0f);
+        for (int l = 0; l < light_count; l++) {
+            __m128 intensity = _mm_loadu_ps(intensities[l] + i);
+            r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(colors[l].r), intensity));
+            g = _mm_add_ps(g, _mm_mul_ps(_mm_set1_ps(colors[l].g), intensity));
+            b = _mm_add_ps(b, _mm_mul_ps(_mm_set1_ps(colors[l].b), intensity));
+        }
+
+        // The planes become one RGBA color per vertex.
+        _MM_TRANSPOSE4_PS(r, g, b, a);
+        _mm_storeu_ps(dst + i * 4, r);
+        _mm_storeu_ps(dst + i * 4 + 4, g);
+        _mm_storeu_ps(dst + i * 4 + 8, b);
+        _mm_storeu_ps(dst + i * 4 + 12, a);
+    }
+#elif defined(LIGHTING_SIMD_NEON)
+    for (; i + 4 <= count; i += 4) {
+        float32x4x4_t rgba = { {
+            vdupq_n_f32(0.0f),
+            vdupq_n_f32(0.0f),
+            vdupq_n_f32(0.0f),
+            vdupq_n_f32(1.0f),
+        } };
+        for (int l = 0; l < light_count; l++) {
+            float32x4_t intensity = vld1q_f32(intensities[l] + i);
+            rgba.val[0] = vmlaq_n_f32(rgba.val[0], intensity, colors[l].r);
+            rgba.val[1] = vmlaq_n_f32(rgba.val[1], intensity, colors[l].g);
+            rgba.val[2] = vmlaq_n_f32(rgba.val[2], intensity, colors[l].b);
+        }
+        vst4q_f32(dst + i * 4, rgba);
+    }
+#elif defined(LIGHTING_SIMD_WASM)
+    for (; i + 4 <= count; i += 4) {
+        v128_t r = wasm_f32x4_splat(0.0f);
+        v128_t g = wasm_f32x4_splat(0.0f);
+        v128_t b = wasm_f32x4_splat(0.0f);
+        v128_t a = wasm_f32x4_splat(1.0f);
+        for (int l = 0; l < light_count; l++) {
+            v128_t intensity = wasm_v128_load(intensities[l] + i);
+            r = wasm_f32x4_add(r, wasm_f32x4_mul(wasm_f32x4_splat(colors[l].r), intensity));
+            g = wasm_f32x4_add(g, wasm_f32x4_mul(wasm_f32x4_splat(colors[l].g), intensity));
+            b = wasm_f32x4_add(b, wasm_f32x4_mul(wasm_f32x4_splat(colors[l].b), intensity));
+        }
+
+        v128_t rg_lo = wasm_i32x4_shuffle(r, g, 0, 4, 1, 5);
+        v128_t ba_lo = wasm_i32x4_shuffle(b, a, 0, 4, 1, 5);
+        v128_t rg_hi = wasm_i32x4_shuffle(r, g, 2, 6, 3, 7);
+        v128_t ba_hi = wasm_i32x4_shuffle(b, a, 2, 6, 3, 7);
+        wasm_v128_store(dst + i * 4, wasm_i32x4_shuffle(rg_lo, ba_lo, 0, 1, 4, 5));
+        wasm_v128_store(dst + i * 4 + 4, wasm_i32x4_shuffle(rg_lo, ba_lo, 2, 3, 6, 7));
+        wasm_v128_store(dst + i * 4 + 8, wasm_i32x4_shuffle(rg_hi, ba_hi, 0, 1, 4, 5));
+        wasm_v128_store(dst + i * 4 + 12, wasm_i32x4_shuffle(rg_hi, ba_hi, 2, 3, 6, 7));
+    }
+#endif
+
+    _bake_colors_scalar(intensities, colors, light_count, dst, i, count);
+}
+
+// The scalar versions handle the vertices from begin to count, which is all of
+// them without SIMD and the tail otherwise.
+static void _bake_normals_scalar(const f32* src, f32* dst, usize begin, usize count, mat3s m) {
+    for (usize i = begin; i < count; i++) {
+        f32 nx = src[i];
+        f32 ny = src[count + i];
+        f32 nz = src[count * 2 + i];
+        f32 x = m.col[0].raw[0] * nx + m.col[1].raw[0] * ny + m.col[2].raw[0] * nz;
+        f32 y = m.col[0].raw[1] * nx + m.col[1].raw[1] * ny + m.col[2].raw[1] * nz;
+        f32 z = m.col[0].raw[2] * nx + m.col[1].raw[2] * ny + m.col[2].raw[2] * nz;
+
+        f32 len2 = x * x + y * y + z * z;
+        f32 inv = len2 > 0.0f ? 1.0f / sqrtf(len2) : 0.0f;
+        dst[i] = x * inv;
+        dst[count + i] = y * inv;
+        dst[count * 2 + i] = z * inv;
+    }
+}
+
+static void _bake_intensity_scalar(const f32* normals, f32* dst, usize begin, usize count, vec3s dir) {
+    for (usize i = begin; i < count; i++) {
+        f32 d = normals[i] * dir.x + normals[count + i] * dir.y + normals[count * 2 + i] * dir.z;
+        dst[i] = glm_min(glm_max(d, 0.0f), 1.0f);
+    }
+}
+
+static void _bake_colors_scalar(const f32* const* intensities, const vec4s* colors, int light_count, f32* dst, usize begin, usize count) {
+    for (usize i = begin; i < count; i++) {
+        f32 rgba[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+        for (int l = 0; l < light_count; l++) {
+            f32 intensity = intensities[l][i];
+            rgba[0] += colors[l].r * intensity;
+            rgba[1] += colors[l].g * intensity;
+            rgba[2] += colors[l].b * intensity;
+        }
+        memcpy(dst + i * 4, rgba, sizeof(rgba));
+    }
+}
@@ -34,3 +34,18 @@ typedef struct {
 } lighting_t;
 
 lighting_t read_lighting(span_t*);
+
+// The bake kernels compute the standard shader's diffuse lighting per vertex
+// on the CPU. Normals are stored as planes, count x values followed by count
+// y values and count z values. They use SSE2, NEON or WASM SIMD128 when the
+// compiler targets them and fall back to scalar code otherwise.
+
+// Transforms the normals by the normal matrix and normalizes them.
+void lighting_bake_normals(const f32* src, f32* dst, usize count, mat3s normal_matrix);
+
+// Clamped dot product of each normal with the normalized light direction.
+void lighting_bake_intensity(const f32* normals, f32* dst, usize count, vec3s direction);
+
+// Sum of the light colors scaled by their intensities, as RGBA with alpha 1.
+// dst holds count * 4 values.
+void lighting_bake_colors(const f32* const* intensities, const vec4s* colors, int light_count, f32* dst, usize count);
@@ -1,9 +1,12 @@
+#include <string.h>
+
 #include "sokol_gfx.h"
 
 #include "filesystem.h"
 #include "image.h"
 #include "map.h"
 #include "memory.h"
+#include "trace.h"
 #include "util.h"
 
 enum {
@@ -11,13 +14,27 @@ enum {
     MAP_IMAGE_HEIGHT = 1024,
 };
 
-static map_image_t _read_map_texture(span_t* span, map_state_t state) {
-    image_t image = image_read_4bpp(span, MAP_IMAGE_WIDTH, MAP_IMAGE_HEIGHT);
-    return (map_image_t) {
-        .state = state,
-        .image = image,
-    };
-}
+// A decoded resource shared by every map with identical contents. data is
+// heap allocated and freed when the last map releases it.
+typedef struct {
+    u64 hash;
+    usize size;
+    void* data;
+    int refs;
+} pool_entry_t;
+
+static struct {
+    pool_entry_t pool[MAP_POOL_MAX];
+} _state;
+
+static void _decode_texture(map_t*, map_image_t*);
+static void _decode_alt_mesh(map_t*, map_alt_mesh_t*);
+static void _acquire_palette(mesh_t*);
+static bool _state_wanted(map_state_t, map_state_t);
+static void* _pool_acquire(void*, usize);
+static pool_entry_t* _pool_find(const void*);
+static void _pool_retain(const void*);
+static void _pool_release(const void*);
 
 void map_destroy(map_t* map) {
     if (map == NULL) {
@@ -26,20 +43,29 @@ void map_destroy(map_t* map) {
 
     // Textures
     for (int i = 0; i < map->texture_count; i++) {
-        image_destroy(map->textures[i].image);
+        _pool_release(map->textures[i].image.data);
     }
 
-    // Palettes
-    image_destroy(map->primary_mesh.palette);
-    image_destroy(map->override_mesh.palette);
+    // Palettes and alt meshes
+    _pool_release(map->primary_mesh.palette.data);
+    _pool_release(map->override_mesh.palette.data);
     for (int i = 0; i < map->alt_mesh_count; i++) {
-        image_destroy(map->alt_meshes[i].palette);
+        mesh_t* alt_mesh = map->alt_meshes[i].mesh;
+        if (alt_mesh != NULL) {
+            _pool_release(alt_mesh->palette.data);
+            _pool_release(alt_mesh);
+        }
     }
 
+    memory_free(map->merged_mesh);
     memory_free(map);
 }
 
-map_t* read_map(int num) {
+// read_map parses all the GNS records of a map but only decodes the primary and
+// override meshes and the textures and alt meshes for the default state and
+// the requested state. Everything else is decoded on demand.
+map_t* read_map(int num, map_state_t map_state) {
+    TRACE_BEGIN();
 
     // Fetch the GNS file which contains pointers to the map's resources.
     const file_entry_e map_file = map_list[num].file;
@@ -52,14 +78,13 @@ map_t* read_map(int num) {
     for (int i = 0; i < map->record_count; i++) {
         map_record_t* record = &map->records[i];
 
-        // Fetch the resource file
-
         switch (record->type) {
         case FILETYPE_TEXTURE: {
-            const file_entry_e entry = filesystem_entry_by_sector(record->sector);
-            span_t file = filesystem_read_file(entry);
-            map_image_t texture = _read_map_texture(&file, record->state);
-            map->textures[map->texture_count++] = texture;
+            ASSERT(map->texture_count < MAP_TEXTURE_MAX, "Too many map textures");
+            map->textures[map->texture_count++] = (map_image_t) {
+                .state = record->state,
+                .record = i,
+            };
             break;
         }
         case FILETYPE_MESH_PRIMARY: {
@@ -69,6 +94,7 @@ map_t* read_map(int num) {
             ASSERT(map_state_default(record->state), "Primary mesh file has non-default state");
 
             map->primary_mesh = read_mesh(&file);
+            _acquire_palette(&map->primary_mesh);
             record->vertex_count = map->primary_mesh.geometry.vertex_count;
             record->light_count = map->primary_mesh.lighting.light_count;
             record->valid_palette = map->primary_mesh.palette.valid;
@@ -79,15 +105,11 @@ map_t* read_map(int num) {
         }
 
         case FILETYPE_MESH_ALT: {
-            const file_entry_e entry = filesystem_entry_by_sector(record->sector);
-            span_t file = filesystem_read_file(entry);
-            mesh_t alt_mesh = read_mesh(&file);
-            alt_mesh.map_state = record->state;
-            map->alt_meshes[map->alt_mesh_count++] = alt_mesh;
-            record->vertex_count = alt_mesh.geometry.vertex_count;
-            record->light_count = alt_mesh.lighting.light_count;
-            record->valid_palette = alt_mesh.palette.valid;
-            record->valid_terrain = alt_mesh.terrain.valid;
+            ASSERT(map->alt_mesh_count < MAP_ALT_MESH_MAX, "Too many alt meshes");
+            map->alt_meshes[map->alt_mesh_count++] = (map_alt_mesh_t) {
+                .state = record->state,
+                .record = i,
+            };
             break;
         }
 
@@ -98,6 +120,7 @@ map_t* read_map(int num) {
             ASSERT(map_state_default(record->state), "Oerride must be default map state");
 
             map->override_mesh = read_mesh(&file);
+            _acquire_palette(&map->override_mesh);
             record->vertex_count = map->override_mesh.geometry.vertex_count;
             record->light_count = map->override_mesh.lighting.light_count;
             record->valid_palette = map->override_mesh.palette.valid;
@@ -109,9 +132,256 @@ map_t* read_map(int num) {
         }
     }
 
+    map_load_state(map, map_state);
+
+    TRACE_END();
     return map;
 }
 
+// read_map_terrain reads only the terrain of the map's primary mesh, for
+// queries over every map that don't need the meshes or textures.
+terrain_t read_map_terrain(int num) {
+    span_t gns = filesystem_read_file(map_list[num].file);
+    map_record_t records[MAP_RECORD_MAX_NUM];
+    int record_count = read_map_records(&gns, records);
+
+    for (int i = 0; i < record_count; i++) {
+        if (records[i].type == FILETYPE_MESH_PRIMARY) {
+            span_t file = filesystem_read_file(filesystem_entry_by_sector(records[i].sector));
+            return read_terrain(&file);
+        }
+    }
+    return (terrain_t) { 0 };
+}
+
+// read_map_terrain_grids reads the terrain grid of every valid map into grids,
+// which holds MAP_COUNT grids, and returns how many were read.
+int read_map_terrain_grids(terrain_grid_t* grids) {
+    int count = 0;
+    for (int i = 0; i < MAP_COUNT; i++) {
+        if (!map_list[i].valid) {
+            continue;
+        }
+        terrain_t terrain = read_map_terrain(i);
+        if (terrain.valid) {
+            grids[count++] = terrain.grid;
+        }
+    }
+    return count;
+}
+
+// map_load_state decodes the textures and alt meshes used by the state (and the
+// default state it falls back to) that have not been decoded yet.
+void map_load_state(map_t* map, map_state_t map_state) {
+    for (int i = 0; i < map->texture_count; i++) {
+        map_image_t* texture = &map->textures[i];
+        if (!texture->image.valid && _state_wanted(texture->state, map_state)) {
+            _decode_texture(map, texture);
+        }
+    }
+
+    for (int i = 0; i < map->alt_mesh_count; i++) {
+        map_alt_mesh_t* alt_mesh = &map->alt_meshes[i];
+        if (alt_mesh->mesh == NULL && map_state_eq(alt_mesh->state, map_state)) {
+            _decode_alt_mesh(map, alt_mesh);
+        }
+    }
+}
+
+// map_get_mesh returns the primary (or override) mesh merged with the alt mesh
+// for the requested state, if there is one. The merged mesh is kept in the map
+// and stays valid until a different state is requested or the map is destroyed.
+const mesh_t* map_get_mesh(map_t* map, map_state_t map_state) {
+    if (map->merged_mesh != NULL && map_state_eq(map->merged_state, map_state)) {
+        return map->merged_mesh;
+    }
+
+    map_load_state(map, map_state);
+
+    if (map->merged_mesh == NULL) {
+        map->merged_mesh = memory_allocate(sizeof(mesh_t));
+    }
+    mesh_t* final_mesh = map->merged_mesh;
+    if (map->primary_mesh.valid) {
+        *final_mesh = map->primary_mesh;
+    } else {
+        *final_mesh = map->override_mesh;
+    }
+
+    for (int i = 0; i < map->alt_mesh_count; i++) {
+        const mesh_t* alt_mesh = map->alt_meshes[i].mesh;
+        if (alt_mesh != NULL && alt_mesh->valid && map_state_eq(map->alt_meshes[i].state, map_state)) {
+            merge_meshes(final_mesh, alt_mesh);
+            break;
+        }
+    }
+
+    map->merged_state = map_state;
+    return final_mesh;
+}
+
+// map_get_texture returns the texture for the requested state, falling back to
+// the default state texture.
+map_image_t map_get_texture(map_t* map, map_state_t map_state) {
+    map_load_state(map, map_state);
+
+    map_image_t final_texture = { 0 };
+
+    for (int i = 0; i < map->texture_count; i++) {
+        map_image_t texture = map->textures[i];
+
+        if (texture.image.valid && map_state_eq(texture.state, map_state)) {
+            final_texture = texture;
+            break;
+        }
+        if (texture.image.valid && map_state_default(texture.state)) {
+            if (!final_texture.image.valid) {
+                final_texture = texture;
+            }
+        }
+    }
+
+    return final_texture;
+}
+
+// Textures that point at the same sector as a decoded texture of the map use
+// its image without decoding again. Other textures are decoded and shared
+// through the pool with any texture of any map that decodes to the same bytes.
+static void _decode_texture(map_t* map, map_image_t* texture) {
+    const map_record_t* record = &map->records[texture->record];
+
+    for (int i = 0; i < map->texture_count; i++) {
+        const map_image_t* other = &map->textures[i];
+        if (other->image.valid && map->records[other->record].sector == record->sector) {
+            _pool_retain(other->image.data);
+            texture->image = other->image;
+            return;
+        }
+    }
+
+    const file_entry_e entry = filesystem_entry_by_sector(record->sector);
+    span_t file = filesystem_read_file(entry);
+    image_t image = image_read_4bpp_indexed(&file, MAP_IMAGE_WIDTH, MAP_IMAGE_HEIGHT);
+    image.data = _pool_acquire(image.data, image.size);
+    texture->image = image;
+}
+
+// Alt meshes are shared like textures. The palette is pooled first so meshes
+// with the same palette have the same bytes.
+static void _decode_alt_mesh(map_t* map, map_alt_mesh_t* alt_mesh) {
+    map_record_t* record = &map->records[alt_mesh->record];
+
+    mesh_t* mesh = NULL;
+    for (int i = 0; i < map->alt_mesh_count; i++) {
+        const map_alt_mesh_t* other = &map->alt_meshes[i];
+        if (other->mesh != NULL && map->records[other->record].sector == record->sector) {
+            mesh = other->mesh;
+            _pool_retain(mesh->palette.data);
+            _pool_retain(mesh);
+            break;
+        }
+    }
+
+    if (mesh == NULL) {
+        const file_entry_e entry = filesystem_entry_by_sector(record->sector);
+        span_t file = filesystem_read_file(entry);
+
+        mesh = memory_allocate(sizeof(mesh_t));
+        *mesh = read_mesh(&file);
+        _acquire_palette(mesh);
+        mesh = _pool_acquire(mesh, sizeof(mesh_t));
+    }
+    alt_mesh->mesh = mesh;
+
+    record->vertex_count = mesh->geometry.vertex_count;
+    record->light_count = mesh->lighting.light_count;
+    record->valid_palette = mesh->palette.valid;
+    record->valid_terrain = mesh->terrain.valid;
+}
+
+static void _acquire_palette(mesh_t* mesh) {
+    if (mesh->palette.data != NULL) {
+        mesh->palette.data = _pool_acquire(mesh->palette.data, mesh->palette.size);
+    }
+}
+
+// Textures fall back to the default state so both are wanted.
+static bool _state_wanted(map_state_t state, map_state_t requested) {
+    return map_state_eq(state, requested) || map_state_default(state);
+}
+
+map_pool_stats_t map_get_pool_stats(void) {
+    map_pool_stats_t stats = { 0 };
+    for (int i = 0; i < MAP_POOL_MAX; i++) {
+        const pool_entry_t* entry = &_state.pool[i];
+        if (entry->refs > 0) {
+            stats.resource_count++;
+            stats.resident_size += entry->size;
+            stats.shared_size += entry->size * (entry->refs - 1);
+        }
+    }
+    return stats;
+}
+
+// _pool_acquire takes ownership of the heap allocated data and returns the
+// pooled data with the same bytes, freeing data if it was already pooled.
+static void* _pool_acquire(void* data, usize size) {
+    u64 hash = memory_hash(data, size);
+    for (int i = 0; i < MAP_POOL_MAX; i++) {
+        pool_entry_t* entry = &_state.pool[i];
+        if (entry->refs > 0 && entry->hash == hash && entry->size == size && memcmp(entry->data, data, size) == 0) {
+            memory_free(data);
+            entry->refs++;
+            return entry->data;
+        }
+    }
+
+    for (int i = 0; i < MAP_POOL_MAX; i++) {
+        pool_entry_t* entry = &_state.pool[i];
+        if (entry->refs == 0) {
+            *entry = (pool_entry_t) {
+                .hash = hash,
+                .size = size,
+                .data = data,
+                .refs = 1,
+            };
+            return data;
+        }
+    }
+    ASSERT(false, "Map resource pool is full");
+}
+
+static pool_entry_t* _pool_find(const void* data) {
+    for (int i = 0; i < MAP_POOL_MAX; i++) {
+        pool_entry_t* entry = &_state.pool[i];
+        if (entry->refs > 0 && entry->data == data) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static void _pool_retain(const void* data) {
+    if (data == NULL) {
+        return;
+    }
+    pool_entry_t* entry = _pool_find(data);
+    ASSERT(entry != NULL, "Map resource is not pooled");
+    entry->refs++;
+}
+
+static void _pool_release(const void* data) {
+    if (data == NULL) {
+        return;
+    }
+    pool_entry_t* entry = _pool_find(data);
+    ASSERT(entry != NULL, "Map resource is not pooled");
+    if (--entry->refs == 0) {
+        memory_free(entry->data);
+        *entry = (pool_entry_t) { 0 };
+    }
+}
+
 map_desc_t map_list[MAP_COUNT] = {
     { 0, F_MAP__MAP000_GNS, false, "Unknown" }, // No texture
     { 1, F_MAP__MAP001_GNS, true, "At Main Gate of Igros Castle" },
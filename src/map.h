@@ -8,28 +8,73 @@
 
 #define MAP_COUNT 128
 
+enum {
+    MAP_TEXTURE_MAX = 20,
+    MAP_ALT_MESH_MAX = 20,
+    MAP_POOL_MAX = 512,
+};
+
 // This allows us to decouple map_state from the base image_t type.
+//
+// The image is only decoded once its state is requested. Until then
+// image.valid is false and record is the GNS record to decode it from.
+//
+// The image data is shared with every texture of every loaded map that
+// decodes to the same bytes, see map_get_pool_stats().
 typedef struct {
     map_state_t state;
+    int record;
     image_t image;
 } map_image_t;
 
+// An alt mesh record. The mesh is decoded once its state is requested, until
+// then it is NULL. Like textures, identical meshes are shared between records
+// and maps.
+typedef struct {
+    map_state_t state;
+    int record;
+    mesh_t* mesh;
+} map_alt_mesh_t;
+
+// Decoded textures, palettes and alt meshes are kept in a pool shared by all
+// maps. Data that decodes to the same bytes is only allocated once.
+typedef struct {
+    int resource_count;
+    usize resident_size; // Bytes allocated by the pool
+    usize shared_size;   // Bytes not allocated because the data was shared
+} map_pool_stats_t;
+
 // map_t is a struct that contains all the data for a map for all scenarios.
+//
+// All records are parsed but only the primary/override meshes and the
+// resources for the default state and the states that have been requested are
+// decoded. See map_load_state().
 typedef struct {
     map_record_t records[MAP_RECORD_MAX_NUM];
 
     mesh_t primary_mesh;
     mesh_t override_mesh;
-    mesh_t alt_meshes[20];
-    map_image_t textures[20];
+    map_alt_mesh_t alt_meshes[MAP_ALT_MESH_MAX];
+    map_image_t textures[MAP_TEXTURE_MAX];
 
     int record_count;
     int texture_count;
     int alt_mesh_count;
+
+    // The mesh merged for merged_state, see map_get_mesh().
+    mesh_t* merged_mesh;
+    map_state_t merged_state;
 } map_t;
 
-map_t* read_map(int);
+map_t* read_map(int, map_state_t);
+terrain_t read_map_terrain(int);
+int read_map_terrain_grids(terrain_grid_t*);
 void map_destroy(map_t*);
+void map_load_state(map_t*, map_state_t);
+
+const mesh_t* map_get_mesh(map_t*, map_state_t);
+map_image_t map_get_texture(map_t*, map_state_t);
+map_pool_stats_t map_get_pool_stats(void);
 
 // map_desc_t is a struct that contains information about a map.
 // This lets us know if we can use the map and where on the disk it is.
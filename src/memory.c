@@ -1,3 +1,5 @@
+#include <string.h>
+
 #include "memory.h"
 #include "util.h"
 
@@ -79,3 +81,37 @@ void memory_free(void* ptr) {
 
     free(header);
 }
+
+// memory_hash returns a 64-bit hash of the bytes. It reads 8 bytes per round
+// using the xxHash64 round function, which is plenty for detecting identical
+// decoded resources.
+u64 memory_hash(const void* data, usize size) {
+    const u64 prime1 = 0x9E3779B185EBCA87ULL;
+    const u64 prime2 = 0xC2B2AE3D27D4EB4FULL;
+    const u64 prime3 = 0x165667B19E3779F9ULL;
+
+    const u8* bytes = data;
+    u64 hash = prime3 ^ (size * prime1);
+
+    usize i = 0;
+    for (; i + 8 <= size; i += 8) {
+        u64 word;
+        memcpy(&word, bytes + i, sizeof(word));
+        word *= prime2;
+        word = (word << 31) | (word >> 33);
+        word *= prime1;
+        hash ^= word;
+        hash = ((hash << 27) | (hash >> 37)) * prime1 + prime2;
+    }
+    for (; i < size; i++) {
+        hash ^= bytes[i] * prime3;
+        hash = ((hash << 11) | (hash >> 53)) * prime1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= prime2;
+    hash ^= hash >> 29;
+    hash *= prime3;
+    hash ^= hash >> 32;
+    return hash;
+}
@@ -18,3 +18,5 @@ void memory_init(void);
 void memory_shutdown(void);
 void* memory_allocate_impl(usize size, const char* file, int line);
 void memory_free(void* ptr);
+
+u64 memory_hash(const void* data, usize size);
@@ -1,21 +1,30 @@
 #include <float.h>
+#include <math.h>
+#include <string.h>
 
+#include "cglm/struct/vec3.h"
 #include "cglm/types-struct.h"
 #include "cglm/util.h"
 
 #include "defines.h"
 #include "image.h"
 #include "lighting.h"
+#include "memory.h"
 #include "mesh.h"
 #include "terrain.h"
+#include "trace.h"
 #include "util.h"
 
 static geometry_t _read_geometry(span_t*);
 static image_t _read_palette(span_t*);
 static vec3s _read_normal(span_t*);
 static vec2s _process_tex_coords(f32 u, f32 v, u8 page);
+static int _grid_add_polygon(mesh_grid_tri_t*, int, const vertex_t*, int, mesh_poly_e, int, u8, u8, u8);
+static int _grid_cell_clamp(f32, int);
+static bool _ray_triangle(ray_t, const mesh_grid_tri_t*, f32*);
 
 mesh_t read_mesh(span_t* span) {
+    TRACE_BEGIN();
     mesh_t mesh = { 0 };
 
     mesh.geometry = _read_geometry(span);
@@ -26,6 +35,7 @@ mesh_t read_mesh(span_t* span) {
     bool is_valid = mesh.geometry.valid || mesh.palette.valid || mesh.lighting.valid;
     mesh.valid = is_valid;
 
+    TRACE_END();
     return mesh;
 }
 
@@ -239,6 +249,7 @@ void merge_meshes(mesh_t* dst, const mesh_t* src) {
 
 vertices_t geometry_to_vertices(const geometry_t* geometry) {
     vertices_t vertices = { 0 };
+    vertices.vertices = memory_allocate(MAX(geometry->vertex_count, 1) * sizeof(vertex_t));
 
     int vcount = 0;
 
@@ -274,11 +285,16 @@ vertices_t geometry_to_vertices(const geometry_t* geometry) {
         vertices.vertices[vcount++] = geometry->untex_quads[i].vertices[2];
     }
 
+    ASSERT(vcount == geometry->vertex_count, "Vertex count mismatch");
     vertices.count = vcount;
 
     return vertices;
 }
 
+void vertices_destroy(vertices_t vertices) {
+    memory_free(vertices.vertices);
+}
+
 // Returns the center of the vertices in the mesh.
 vec3s vertices_center(const vertices_t* vertices) {
     f32 min_x = FLT_MAX, max_x = -FLT_MAX;
@@ -327,3 +343,290 @@ static image_t _read_palette(span_t* span) {
     const int palette_rows = 16; // All map textures use 16
     return image_read_palette(span, palette_rows);
 }
+
+mesh_grid_t* mesh_grid_create(const geometry_t* geometry) {
+    mesh_grid_t* grid = memory_allocate(sizeof(mesh_grid_t));
+
+    int max_tris = geometry->tex_tri_count + geometry->untex_tri_count
+        + (geometry->tex_quad_count + geometry->untex_quad_count) * 2;
+    grid->tris = memory_allocate(MAX(max_tris, 1) * sizeof(mesh_grid_tri_t));
+
+    int count = 0;
+    for (int i = 0; i < geometry->tex_tri_count; i++) {
+        const triangle_t* t = &geometry->tex_tris[i];
+        count = _grid_add_polygon(grid->tris, count, t->vertices, 3, MESH_POLY_TEX_TRI, i, t->terrain_x, t->terrain_z, t->elevation);
+    }
+    for (int i = 0; i < geometry->tex_quad_count; i++) {
+        const quad_t* q = &geometry->tex_quads[i];
+        count = _grid_add_polygon(grid->tris, count, q->vertices, 4, MESH_POLY_TEX_QUAD, i, q->terrain_x, q->terrain_z, q->elevation);
+    }
+    for (int i = 0; i < geometry->untex_tri_count; i++) {
+        const triangle_t* t = &geometry->untex_tris[i];
+        count = _grid_add_polygon(grid->tris, count, t->vertices, 3, MESH_POLY_UNTEX_TRI, i, 0, 0, 0);
+    }
+    for (int i = 0; i < geometry->untex_quad_count; i++) {
+        const quad_t* q = &geometry->untex_quads[i];
+        count = _grid_add_polygon(grid->tris, count, q->vertices, 4, MESH_POLY_UNTEX_QUAD, i, 0, 0, 0);
+    }
+    grid->tri_count = count;
+
+    // Bounds of all triangles.
+    grid->min = (vec3s) { { FLT_MAX, FLT_MAX, FLT_MAX } };
+    grid->max = (vec3s) { { -FLT_MAX, -FLT_MAX, -FLT_MAX } };
+    for (int i = 0; i < count; i++) {
+        const mesh_grid_tri_t* t = &grid->tris[i];
+        vec3s b = glms_vec3_add(t->v0, t->e1);
+        vec3s c = glms_vec3_add(t->v0, t->e2);
+        grid->min = glms_vec3_minv(grid->min, glms_vec3_minv(t->v0, glms_vec3_minv(b, c)));
+        grid->max = glms_vec3_maxv(grid->max, glms_vec3_maxv(t->v0, glms_vec3_maxv(b, c)));
+    }
+    if (count == 0) {
+        grid->min = (vec3s) { 0 };
+        grid->max = (vec3s) { 0 };
+    }
+
+    // Align the grid origin to the tile boundaries so that, on regular sized
+    // maps, each cell is exactly one terrain tile.
+    grid->min.x = floorf(grid->min.x / TILE_WIDTH) * TILE_WIDTH;
+    grid->min.z = floorf(grid->min.z / TILE_DEPTH) * TILE_DEPTH;
+
+    f32 extent = MAX(grid->max.x - grid->min.x, grid->max.z - grid->min.z);
+    grid->cell_size = MAX((f32)TILE_WIDTH, ceilf(extent / MESH_GRID_MAX_CELLS));
+    grid->cols = (int)((grid->max.x - grid->min.x) / grid->cell_size) + 1;
+    grid->rows = (int)((grid->max.z - grid->min.z) / grid->cell_size) + 1;
+    grid->cols = MIN(grid->cols, MESH_GRID_MAX_CELLS);
+    grid->rows = MIN(grid->rows, MESH_GRID_MAX_CELLS);
+
+    int cell_count = grid->cols * grid->rows;
+    grid->cell_start = memory_allocate((cell_count + 1) * sizeof(int));
+
+    // First pass counts the triangles per cell, the second pass fills them in.
+    for (int pass = 0; pass < 2; pass++) {
+        int* cursor = NULL;
+        if (pass == 1) {
+            for (int i = 0; i < cell_count; i++) {
+                grid->cell_start[i + 1] += grid->cell_start[i];
+            }
+            grid->cell_tris = memory_allocate(MAX(grid->cell_start[cell_count], 1) * sizeof(u16));
+            cursor = memory_allocate(cell_count * sizeof(int));
+            memcpy(cursor, grid->cell_start, cell_count * sizeof(int));
+        }
+
+        for (int i = 0; i < count; i++) {
+            const mesh_grid_tri_t* t = &grid->tris[i];
+            f32 x0 = t->v0.x + MIN(0.0f, MIN(t->e1.x, t->e2.x));
+            f32 x1 = t->v0.x + MAX(0.0f, MAX(t->e1.x, t->e2.x));
+            f32 z0 = t->v0.z + MIN(0.0f, MIN(t->e1.z, t->e2.z));
+            f32 z1 = t->v0.z + MAX(0.0f, MAX(t->e1.z, t->e2.z));
+
+            int col_min = _grid_cell_clamp((x0 - grid->min.x) / grid->cell_size, grid->cols);
+            int col_max = _grid_cell_clamp((x1 - grid->min.x) / grid->cell_size, grid->cols);
+            int row_min = _grid_cell_clamp((z0 - grid->min.z) / grid->cell_size, grid->rows);
+            int row_max = _grid_cell_clamp((z1 - grid->min.z) / grid->cell_size, grid->rows);
+
+            for (int row = row_min; row <= row_max; row++) {
+                for (int col = col_min; col <= col_max; col++) {
+                    int cell = row * grid->cols + col;
+                    if (pass == 0) {
+                        grid->cell_start[cell + 1]++;
+                    } else {
+                        grid->cell_tris[cursor[cell]++] = (u16)i;
+                    }
+                }
+            }
+        }
+
+        memory_free(cursor);
+    }
+
+    return grid;
+}
+
+void mesh_grid_destroy(mesh_grid_t* grid) {
+    if (grid == NULL) {
+        return;
+    }
+    memory_free(grid->tris);
+    memory_free(grid->cell_start);
+    memory_free(grid->cell_tris);
+    memory_free(grid);
+}
+
+// mesh_raycast returns the closest polygon hit by the ray.
+//
+// The ray is walked through the grid columns with a 2D DDA over XZ and only
+// the triangles in visited cells are tested. The walk stops as soon as the
+// closest hit lies before the exit of the current cell.
+mesh_hit_t mesh_raycast(const mesh_grid_t* grid, ray_t ray) {
+    mesh_hit_t hit = { 0 };
+    if (grid == NULL || grid->tri_count == 0) {
+        return hit;
+    }
+
+    // Clip the ray against the grid bounds.
+    f32 t_enter = 0.0f;
+    f32 t_exit = FLT_MAX;
+    vec3s max = { { grid->min.x + grid->cols * grid->cell_size, grid->max.y, grid->min.z + grid->rows * grid->cell_size } };
+    for (int axis = 0; axis < 3; axis++) {
+        f32 o = ray.origin.raw[axis];
+        f32 d = ray.direction.raw[axis];
+        f32 lo = grid->min.raw[axis];
+        f32 hi = max.raw[axis];
+        if (d == 0.0f) {
+            if (o < lo || o > hi) {
+                return hit;
+            }
+            continue;
+        }
+        f32 t0 = (lo - o) / d;
+        f32 t1 = (hi - o) / d;
+        t_enter = MAX(t_enter, MIN(t0, t1));
+        t_exit = MIN(t_exit, MAX(t0, t1));
+    }
+    if (t_enter > t_exit) {
+        return hit;
+    }
+
+    vec3s start = glms_vec3_add(ray.origin, glms_vec3_scale(ray.direction, t_enter));
+    int col = _grid_cell_clamp((start.x - grid->min.x) / grid->cell_size, grid->cols);
+    int row = _grid_cell_clamp((start.z - grid->min.z) / grid->cell_size, grid->rows);
+
+    int step_col = ray.direction.x > 0.0f ? 1 : -1;
+    int step_row = ray.direction.z > 0.0f ? 1 : -1;
+
+    // Distance along the ray to the next column/row boundary, and between two
+    // boundaries on the same axis.
+    f32 t_max_col = FLT_MAX;
+    f32 t_max_row = FLT_MAX;
+    f32 t_delta_col = FLT_MAX;
+    f32 t_delta_row = FLT_MAX;
+    if (ray.direction.x != 0.0f) {
+        f32 edge = grid->min.x + (col + (step_col > 0 ? 1 : 0)) * grid->cell_size;
+        t_max_col = (edge - ray.origin.x) / ray.direction.x;
+        t_delta_col = grid->cell_size / fabsf(ray.direction.x);
+    }
+    if (ray.direction.z != 0.0f) {
+        f32 edge = grid->min.z + (row + (step_row > 0 ? 1 : 0)) * grid->cell_size;
+        t_max_row = (edge - ray.origin.z) / ray.direction.z;
+        t_delta_row = grid->cell_size / fabsf(ray.direction.z);
+    }
+
+    f32 best_t = FLT_MAX;
+    int best_tri = -1;
+
+    while (col >= 0 && col < grid->cols && row >= 0 && row < grid->rows) {
+        int cell = row * grid->cols + col;
+        for (int i = grid->cell_start[cell]; i < grid->cell_start[cell + 1]; i++) {
+            int tri = grid->cell_tris[i];
+            f32 t;
+            if (_ray_triangle(ray, &grid->tris[tri], &t) && t < best_t) {
+                best_t = t;
+                best_tri = tri;
+            }
+        }
+
+        f32 t_next = MIN(t_max_col, t_max_row);
+        if (best_t <= t_next || t_next > t_exit) {
+            break;
+        }
+
+        if (t_max_col < t_max_row) {
+            col += step_col;
+            t_max_col += t_delta_col;
+        } else {
+            row += step_row;
+            t_max_row += t_delta_row;
+        }
+    }
+
+    if (best_tri < 0) {
+        return hit;
+    }
+
+    const mesh_grid_tri_t* t = &grid->tris[best_tri];
+    hit.poly_type = (mesh_poly_e)t->poly_type;
+    hit.poly_index = t->poly_index;
+    hit.position = glms_vec3_add(ray.origin, glms_vec3_scale(ray.direction, best_t));
+    hit.distance = best_t;
+    hit.terrain_x = t->terrain_x;
+    hit.terrain_z = t->terrain_z;
+    hit.elevation = t->elevation;
+    hit.has_tile = t->poly_type == MESH_POLY_TEX_TRI || t->poly_type == MESH_POLY_TEX_QUAD;
+    hit.valid = true;
+    return hit;
+}
+
+const char* mesh_poly_str(mesh_poly_e value) {
+    switch (value) {
+    case MESH_POLY_TEX_TRI:
+        return "Tex Tri";
+    case MESH_POLY_TEX_QUAD:
+        return "Tex Quad";
+    case MESH_POLY_UNTEX_TRI:
+        return "Untex Tri";
+    case MESH_POLY_UNTEX_QUAD:
+        return "Untex Quad";
+    default:
+        return "Unknown";
+    }
+}
+
+// Adds a triangle or quad to the list of grid triangles. Quads are split the
+// same way as geometry_to_vertices() so picking matches what is rendered.
+static int _grid_add_polygon(mesh_grid_tri_t* tris, int count, const vertex_t* vertices, int vertex_count, mesh_poly_e type, int index, u8 x, u8 z, u8 elevation) {
+    static const int quad_indices[2][3] = { { 0, 1, 2 }, { 1, 3, 2 } };
+    int tri_count = vertex_count == 4 ? 2 : 1;
+
+    for (int i = 0; i < tri_count; i++) {
+        vec3s a = vertices[quad_indices[i][0]].position;
+        vec3s b = vertices[quad_indices[i][1]].position;
+        vec3s c = vertices[quad_indices[i][2]].position;
+
+        tris[count++] = (mesh_grid_tri_t) {
+            .v0 = a,
+            .e1 = glms_vec3_sub(b, a),
+            .e2 = glms_vec3_sub(c, a),
+            .poly_index = (u16)index,
+            .poly_type = (u8)type,
+            .terrain_x = x,
+            .terrain_z = z,
+            .elevation = elevation,
+        };
+    }
+    return count;
+}
+
+static int _grid_cell_clamp(f32 cell, int count) {
+    int i = (int)floorf(cell);
+    return MIN(MAX(i, 0), count - 1);
+}
+
+// Moller-Trumbore ray/triangle intersection. Both faces are hit.
+static bool _ray_triangle(ray_t ray, const mesh_grid_tri_t* tri, f32* out_t) {
+    vec3s p = glms_vec3_cross(ray.direction, tri->e2);
+    f32 det = glms_vec3_dot(tri->e1, p);
+    if (fabsf(det) < 1e-8f) {
+        return false;
+    }
+    f32 inv_det = 1.0f / det;
+
+    vec3s s = glms_vec3_sub(ray.origin, tri->v0);
+    f32 u = glms_vec3_dot(s, p) * inv_det;
+    if (u < 0.0f || u > 1.0f) {
+        return false;
+    }
+
+    vec3s q = glms_vec3_cross(s, tri->e1);
+    f32 v = glms_vec3_dot(ray.direction, q) * inv_det;
+    if (v < 0.0f || u + v > 1.0f) {
+        return false;
+    }
+
+    f32 t = glms_vec3_dot(tri->e2, q) * inv_det;
+    if (t < 0.0f) {
+        return false;
+    }
+
+    *out_t = t;
+    return true;
+}
@@ -14,7 +14,11 @@ enum {
     MESH_MAX_TEX_QUADS = 768,
     MESH_MAX_UNTEX_TRIS = 64,
     MESH_MAX_UNTEX_QUADS = 256,
-    MESH_MAX_VERTICES = 7620
+    MESH_MAX_VERTICES = 7620,
+
+    // Cells per axis of a mesh_grid_t. Geometry larger than this many tiles
+    // gets proportionally larger cells.
+    MESH_GRID_MAX_CELLS = 64,
 };
 
 typedef struct {
@@ -25,8 +29,10 @@ typedef struct {
     f32 is_textured;
 } vertex_t;
 
+// vertices_t is a heap allocated list of vertices sized to the geometry.
+// geometry_to_vertices() allocates it and vertices_destroy() frees it.
 typedef struct {
-    vertex_t vertices[MESH_MAX_VERTICES];
+    vertex_t* vertices;
     int count;
 } vertices_t;
 
@@ -73,8 +79,79 @@ typedef struct {
     bool valid;
 } mesh_t;
 
+// mesh_poly_e identifies which polygon list of a geometry_t a polygon is in.
+typedef enum {
+    MESH_POLY_TEX_TRI,
+    MESH_POLY_TEX_QUAD,
+    MESH_POLY_UNTEX_TRI,
+    MESH_POLY_UNTEX_QUAD,
+} mesh_poly_e;
+
+// A ray in mesh space. The direction does not need to be normalized, hit
+// distances are in multiples of its length.
+typedef struct {
+    vec3s origin;
+    vec3s direction;
+} ray_t;
+
+// mesh_hit_t is the result of mesh_raycast(). Only textured polygons have a
+// terrain tile so has_tile is false for untextured polygons.
+typedef struct {
+    mesh_poly_e poly_type;
+    int poly_index;
+
+    vec3s position;
+    f32 distance;
+
+    u8 terrain_x;
+    u8 terrain_z;
+    u8 elevation;
+    bool has_tile;
+
+    bool valid;
+} mesh_hit_t;
+
+// A single triangle of the grid. Quads are split into two triangles that
+// share the same polygon index. The edges are precomputed for the ray test.
+typedef struct {
+    vec3s v0;
+    vec3s e1;
+    vec3s e2;
+
+    u16 poly_index;
+    u8 poly_type;
+    u8 terrain_x;
+    u8 terrain_z;
+    u8 elevation;
+} mesh_grid_tri_t;
+
+// mesh_grid_t is a uniform grid over the XZ plane with cells the size of a
+// terrain tile. Each cell lists the triangles whose bounds overlap it, so a
+// ray only tests the triangles in the cells it passes through.
+//
+// The triangles of cell i are cell_tris[cell_start[i]..cell_start[i + 1]].
+typedef struct {
+    mesh_grid_tri_t* tris;
+    int tri_count;
+
+    int* cell_start;
+    u16* cell_tris;
+
+    int cols;
+    int rows;
+    f32 cell_size;
+    vec3s min;
+    vec3s max;
+} mesh_grid_t;
+
 vec3s read_position(span_t*);
 mesh_t read_mesh(span_t*);
 void merge_meshes(mesh_t*, const mesh_t*);
 vec3s vertices_center(const vertices_t*);
 vertices_t geometry_to_vertices(const geometry_t*);
+void vertices_destroy(vertices_t);
+
+mesh_grid_t* mesh_grid_create(const geometry_t*);
+void mesh_grid_destroy(mesh_grid_t*);
+mesh_hit_t mesh_raycast(const mesh_grid_t*, ray_t);
+const char* mesh_poly_str(mesh_poly_e);
@@ -0,0 +1,309 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "sokol_time.h"
+
+#include "filesystem.h"
+#include "map.h"
+#include "memory.h"
+#include "path.h"
+#include "util.h"
+
+enum {
+    PATH_NEIGHBOR_MAX = 8, // Four directions on two levels
+
+    // Nodes are only pushed when their cost improves, at most once per edge.
+    PATH_HEAP_MAX = PATH_NODE_MAX * PATH_NEIGHBOR_MAX,
+
+    PATH_BENCH_MOVE = 4,
+    PATH_BENCH_JUMP = 3,
+};
+
+// Binary min-heap of (priority << 16 | node).
+typedef struct {
+    u32 items[PATH_HEAP_MAX];
+    int count;
+} heap_t;
+
+static int _neighbors(const terrain_grid_t*, int, int, int[static PATH_NEIGHBOR_MAX]);
+static int _stand_height(u32);
+static int _enter_cost(u32);
+static void _heap_push(heap_t*, u32, int);
+static int _heap_pop(heap_t*, u32*);
+
+int path_tile_index(const terrain_grid_t* grid, path_tile_t tile) {
+    ASSERT(tile.x < grid->x_count && tile.z < grid->z_count, "Tile %d,%d is outside the %dx%d map", tile.x, tile.z, grid->x_count, grid->z_count);
+    ASSERT(tile.level < TERRAIN_LEVEL_COUNT, "Invalid tile level %d", tile.level);
+    return tile.level * TERRAIN_TILE_MAX + tile.z * grid->x_count + tile.x;
+}
+
+// path_move_range returns the cost to every tile within the unit's Move. It is
+// a BFS when every tile costs 1 and Dijkstra when the map has deep tiles.
+path_range_t path_move_range(const terrain_grid_t* grid, path_tile_t start, path_limits_t limits) {
+    ASSERT(limits.move < PATH_COST_UNREACHABLE, "Move %d is too large", limits.move);
+
+    path_range_t range = { 0 };
+    memset(range.cost, PATH_COST_UNREACHABLE, sizeof(range.cost));
+
+    const int start_idx = path_tile_index(grid, start);
+    const int jump = limits.jump * 2; // Heights are in half h
+    int neighbors[PATH_NEIGHBOR_MAX];
+    range.cost[start_idx] = 0;
+
+    if (!grid->has_depth) {
+        int queue[PATH_NODE_MAX];
+        int head = 0;
+        int tail = 0;
+        queue[tail++] = start_idx;
+
+        while (head < tail) {
+            int node = queue[head++];
+            int cost = range.cost[node];
+            if (cost == limits.move) {
+                continue;
+            }
+            int count = _neighbors(grid, node, jump, neighbors);
+            for (int i = 0; i < count; i++) {
+                if (range.cost[neighbors[i]] == PATH_COST_UNREACHABLE) {
+                    range.cost[neighbors[i]] = cost + 1;
+                    queue[tail++] = neighbors[i];
+                }
+            }
+        }
+    } else {
+        static heap_t heap;
+        heap.count = 0;
+        _heap_push(&heap, 0, start_idx);
+
+        u32 cost;
+        while (heap.count > 0) {
+            int node = _heap_pop(&heap, &cost);
+            if (cost > range.cost[node]) {
+                continue; // Stale entry
+            }
+            int count = _neighbors(grid, node, jump, neighbors);
+            for (int i = 0; i < count; i++) {
+                int next = neighbors[i];
+                u32 next_cost = cost + _enter_cost(grid->cells[next]);
+                if (next_cost <= (u32)limits.move && next_cost < range.cost[next]) {
+                    range.cost[next] = next_cost;
+                    _heap_push(&heap, next_cost, next);
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < PATH_NODE_MAX; i++) {
+        if (range.cost[i] == PATH_COST_UNREACHABLE) {
+            continue;
+        }
+        if (i != start_idx && (grid->cells[i] & TERRAIN_CELL_PASS_THROUGH)) {
+            range.cost[i] = PATH_COST_UNREACHABLE;
+            continue;
+        }
+        range.count++;
+    }
+
+    return range;
+}
+
+// path_find returns the cheapest path from start to goal using A*. Only Jump
+// limits the path, it can be longer than the unit's Move.
+path_t path_find(const terrain_grid_t* grid, path_tile_t start, path_tile_t goal, path_limits_t limits) {
+    path_t path = { 0 };
+
+    const int start_idx = path_tile_index(grid, start);
+    const int goal_idx = path_tile_index(grid, goal);
+    const u32 goal_cell = grid->cells[goal_idx];
+    if (!(goal_cell & TERRAIN_CELL_WALKABLE) || (goal_cell & TERRAIN_CELL_PASS_THROUGH)) {
+        return path;
+    }
+
+    u16 cost[PATH_NODE_MAX];
+    i16 parent[PATH_NODE_MAX];
+    bool closed[PATH_NODE_MAX] = { 0 };
+    memset(cost, 0xFF, sizeof(cost));
+    cost[start_idx] = 0;
+    parent[start_idx] = -1;
+
+    static heap_t heap;
+    heap.count = 0;
+    _heap_push(&heap, abs(start.x - goal.x) + abs(start.z - goal.z), start_idx);
+
+    const int jump = limits.jump * 2;
+    int neighbors[PATH_NEIGHBOR_MAX];
+    u32 priority;
+    while (heap.count > 0) {
+        int node = _heap_pop(&heap, &priority);
+        if (closed[node]) {
+            continue;
+        }
+        closed[node] = true;
+        if (node == goal_idx) {
+            break;
+        }
+
+        int count = _neighbors(grid, node, jump, neighbors);
+        for (int i = 0; i < count; i++) {
+            int next = neighbors[i];
+            int next_cost = cost[node] + _enter_cost(grid->cells[next]);
+            if (closed[next] || next_cost >= cost[next]) {
+                continue;
+            }
+            cost[next] = next_cost;
+            parent[next] = node;
+
+            // Manhattan distance never overestimates as every step costs at
+            // least 1 and moves one tile.
+            int tile = next % TERRAIN_TILE_MAX;
+            int dx = abs(tile % grid->x_count - goal.x);
+            int dz = abs(tile / grid->x_count - goal.z);
+            _heap_push(&heap, next_cost + dx + dz, next);
+        }
+    }
+
+    if (!closed[goal_idx]) {
+        return path;
+    }
+
+    for (int node = goal_idx; node >= 0; node = parent[node]) {
+        path.count++;
+    }
+    int i = path.count;
+    for (int node = goal_idx; node >= 0; node = parent[node]) {
+        int tile = node % TERRAIN_TILE_MAX;
+        path.tiles[--i] = (path_tile_t) {
+            .x = tile % grid->x_count,
+            .z = tile / grid->x_count,
+            .level = node / TERRAIN_TILE_MAX,
+        };
+    }
+    path.cost = cost[goal_idx];
+    path.valid = true;
+    return path;
+}
+
+// path_benchmark runs a move range query from every walkable tile of every map
+// and a path query from each of them to the tile half the map away.
+path_bench_t path_benchmark(void) {
+    path_bench_t bench = { 0 };
+    path_limits_t limits = { .move = PATH_BENCH_MOVE, .jump = PATH_BENCH_JUMP };
+
+    terrain_grid_t* grids = memory_allocate(MAP_COUNT * sizeof(terrain_grid_t));
+    bench.maps = read_map_terrain_grids(grids);
+
+    u64 start = stm_now();
+    for (int m = 0; m < bench.maps; m++) {
+        const terrain_grid_t* grid = &grids[m];
+        for (int i = 0; i < PATH_NODE_MAX; i++) {
+            if (!(grid->cells[i] & TERRAIN_CELL_WALKABLE)) {
+                continue;
+            }
+            int tile = i % TERRAIN_TILE_MAX;
+            path_tile_t from = { tile % grid->x_count, tile / grid->x_count, i / TERRAIN_TILE_MAX };
+            bench.range_tiles += path_move_range(grid, from, limits).count;
+            bench.range_queries++;
+        }
+    }
+    bench.range_ms = stm_ms(stm_since(start));
+
+    start = stm_now();
+    for (int m = 0; m < bench.maps; m++) {
+        const terrain_grid_t* grid = &grids[m];
+        int tile_count = grid->x_count * grid->z_count;
+        for (int i = 0; i < tile_count; i++) {
+            if (!(grid->cells[i] & TERRAIN_CELL_WALKABLE)) {
+                continue;
+            }
+            int to = (i + tile_count / 2) % tile_count;
+            path_tile_t from_tile = { i % grid->x_count, i / grid->x_count, 0 };
+            path_tile_t to_tile = { to % grid->x_count, to / grid->x_count, 0 };
+            bench.path_tiles += path_find(grid, from_tile, to_tile, limits).count;
+            bench.path_queries++;
+        }
+    }
+    bench.path_ms = stm_ms(stm_since(start));
+
+    memory_free(grids);
+    return bench;
+}
+
+// Write the cells the unit can step to from node and return how many.
+static int _neighbors(const terrain_grid_t* grid, int node, int jump, int out[static PATH_NEIGHBOR_MAX]) {
+    static const int dirs[4][2] = { { 1, 0 }, { -1, 0 }, { 0, 1 }, { 0, -1 } };
+
+    const int tile = node % TERRAIN_TILE_MAX;
+    const int x = tile % grid->x_count;
+    const int z = tile / grid->x_count;
+    const int height = _stand_height(grid->cells[node]);
+
+    int count = 0;
+    for (int d = 0; d < 4; d++) {
+        int nx = x + dirs[d][0];
+        int nz = z + dirs[d][1];
+        if (nx < 0 || nz < 0 || nx >= grid->x_count || nz >= grid->z_count) {
+            continue;
+        }
+        for (int level = 0; level < TERRAIN_LEVEL_COUNT; level++) {
+            int next = level * TERRAIN_TILE_MAX + nz * grid->x_count + nx;
+            u32 cell = grid->cells[next];
+            if ((cell & TERRAIN_CELL_WALKABLE) && abs(_stand_height(cell) - height) <= jump) {
+                out[count++] = next;
+            }
+        }
+    }
+    return count;
+}
+
+static int _stand_height(u32 cell) {
+    int height = cell & TERRAIN_CELL_HEIGHT_MASK;
+    int depth = (cell >> TERRAIN_CELL_DEPTH_SHIFT) & TERRAIN_CELL_DEPTH_MASK;
+    return height - depth * 2;
+}
+
+static int _enter_cost(u32 cell) {
+    return 1 + ((cell >> TERRAIN_CELL_DEPTH_SHIFT) & TERRAIN_CELL_DEPTH_MASK);
+}
+
+static void _heap_push(heap_t* heap, u32 priority, int node) {
+    ASSERT(heap->count < PATH_HEAP_MAX, "Path heap is full");
+
+    u32 item = (priority << 16) | (u32)node;
+    int i = heap->count++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (heap->items[parent] <= item) {
+            break;
+        }
+        heap->items[i] = heap->items[parent];
+        i = parent;
+    }
+    heap->items[i] = item;
+}
+
+static int _heap_pop(heap_t* heap, u32* priority) {
+    u32 top = heap->items[0];
+    u32 last = heap->items[--heap->count];
+
+    int i = 0;
+    while (true) {
+        int child = i * 2 + 1;
+        if (child >= heap->count) {
+            break;
+        }
+        if (child + 1 < heap->count && heap->items[child + 1] < heap->items[child]) {
+            child++;
+        }
+        if (last <= heap->items[child]) {
+            break;
+        }
+        heap->items[i] = heap->items[child];
+        i = child;
+    }
+    if (heap->count > 0) {
+        heap->items[i] = last;
+    }
+
+    *priority = top >> 16;
+    return top & 0xFFFF;
+}
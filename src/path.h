@@ -0,0 +1,57 @@
+// Movement queries on a terrain_grid_t.
+//
+// Entering a tile costs 1 Move plus its depth. A unit can step to any of the
+// four neighboring tiles, on either level, if the difference between the
+// heights it stands at is within its Jump. Units stand lower in deep tiles.
+// Pass-through tiles can be crossed but not stopped on.
+#pragma once
+
+#include <stdbool.h>
+
+#include "defines.h"
+#include "terrain.h"
+
+enum {
+    PATH_NODE_MAX = TERRAIN_LEVEL_COUNT * TERRAIN_TILE_MAX,
+    PATH_COST_UNREACHABLE = 0xFF,
+};
+
+typedef struct {
+    u8 x;
+    u8 z;
+    u8 level;
+} path_tile_t;
+
+typedef struct {
+    int move;
+    int jump; // In h, like the unit stat
+} path_limits_t;
+
+// path_range_t is the Move cost of every cell of the grid, using the grid's
+// cell indices. Cells the unit can't reach or stop on are unreachable.
+typedef struct {
+    u8 cost[PATH_NODE_MAX];
+    int count; // Tiles the unit can stop on, including the start
+} path_range_t;
+
+typedef struct {
+    path_tile_t tiles[PATH_NODE_MAX];
+    int count; // Including the start and goal
+    int cost;
+    bool valid;
+} path_t;
+
+typedef struct {
+    int maps;
+    int range_queries;
+    int path_queries;
+    int range_tiles; // Summed over all range queries
+    int path_tiles;  // Summed over all paths found
+    f64 range_ms;
+    f64 path_ms;
+} path_bench_t;
+
+path_range_t path_move_range(const terrain_grid_t*, path_tile_t, path_limits_t);
+path_t path_find(const terrain_grid_t*, path_tile_t, path_tile_t, path_limits_t);
+int path_tile_index(const terrain_grid_t*, path_tile_t);
+path_bench_t path_benchmark(void);
@@ -0,0 +1,463 @@
+#include <string.h>
+
+#include "sokol_time.h"
+
+#include "memory.h"
+#include "pixel.h"
+#include "span.h"
+#include "util.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define PIXEL_SIMD_AVX2
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define PIXEL_SIMD_SSE2
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define PIXEL_SIMD_NEON
+#elif defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#define PIXEL_SIMD_WASM
+#endif
+
+enum {
+    // Size of a map texture on disk, 256x1024 at 4bpp.
+    BENCH_SIZE = 131072,
+};
+
+static void _4bpp_to_r8_scalar(const u8*, u8*, usize);
+static void _4bpp_to_rgba_scalar(const u8*, u8*, usize);
+static void _bgr555_to_rgba_scalar(const u8*, u8*, usize);
+
+static f64 _bench_ms(u64 start, int iterations);
+
+//
+// Kernels
+//
+
+void pixel_4bpp_to_r8(const u8* src, u8* dst, usize size) {
+    usize i = 0;
+
+#if defined(PIXEL_SIMD_AVX2)
+    const __m256i mask = _mm256_set1_epi8(0x0F);
+    for (; i + 32 <= size; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i lo = _mm256_and_si256(v, mask);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), mask);
+
+        // Unpacks work per 128-bit lane, the permutes put the lanes in order.
+        __m256i t0 = _mm256_unpacklo_epi8(lo, hi);
+        __m256i t1 = _mm256_unpackhi_epi8(lo, hi);
+        _mm256_storeu_si256((__m256i*)(dst + i * 2), _mm256_permute2x128_si256(t0, t1, 0x20));
+        _mm256_storeu_si256((__m256i*)(dst + i * 2 + 32), _mm256_permute2x128_si256(t0, t1, 0x31));
+    }
+#elif defined(PIXEL_SIMD_SSE2)
+    const __m128i mask = _mm_set1_epi8(0x0F);
+    for (; i + 16 <= size; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i lo = _mm_and_si128(v, mask);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+        _mm_storeu_si128((__m128i*)(dst + i * 2), _mm_unpacklo_epi8(lo, hi));
+        _mm_storeu_si128((__m128i*)(dst + i * 2 + 16), _mm_unpackhi_epi8(lo, hi));
+    }
+#elif defined(PIXEL_SIMD_NEON)
+    const uint8x16_t mask = vdupq_n_u8(0x0F);
+    for (; i + 16 <= size; i += 16) {
+        uint8x16_t v = vld1q_u8(src + i);
+        uint8x16x2_t t = { { vandq_u8(v, mask), vshrq_n_u8(v, 4) } };
+        vst2q_u8(dst + i * 2, t);
+    }
+#elif defined(PIXEL_SIMD_WASM)
+    const v128_t mask = wasm_i8x16_splat(0x0F);
+    for (; i + 16 <= size; i += 16) {
+        v128_t v = wasm_v128_load(src + i);
+        v128_t lo = wasm_v128_and(v, mask);
+        v128_t hi = wasm_u8x16_shr(v, 4);
+        wasm_v128_store(dst + i * 2, wasm_i8x16_shuffle(lo, hi, 0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23));
+        wasm_v128_store(dst + i * 2 + 16, wasm_i8x16_shuffle(lo, hi, 8, 24, 9, 25, 10, 26, 11, 27, 12, 28, 13, 29, 14, 30, 15, 31));
+    }
+#endif
+
+    _4bpp_to_r8_scalar(src + i, dst + i * 2, size - i);
+}
+
+void pixel_4bpp_to_rgba(const u8* src, u8* dst, usize size) {
+    usize i = 0;
+
+#if defined(PIXEL_SIMD_AVX2)
+    const __m256i mask = _mm256_set1_epi8(0x0F);
+    for (; i + 32 <= size; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i lo = _mm256_and_si256(v, mask);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), mask);
+        __m256i t0 = _mm256_unpacklo_epi8(lo, hi);
+        __m256i t1 = _mm256_unpackhi_epi8(lo, hi);
+
+        // Texels 0-31 and 32-63 in order.
+        __m256i texels[2] = {
+            _mm256_permute2x128_si256(t0, t1, 0x20),
+            _mm256_permute2x128_si256(t0, t1, 0x31),
+        };
+
+        u8* out = dst + i * 8;
+        for (int j = 0; j < 2; j++) {
+            __m256i d0 = _mm256_unpacklo_epi8(texels[j], texels[j]);
+            __m256i d1 = _mm256_unpackhi_epi8(texels[j], texels[j]);
+            __m256i q0 = _mm256_unpacklo_epi16(d0, d0);
+            __m256i q1 = _mm256_unpackhi_epi16(d0, d0);
+            __m256i q2 = _mm256_unpacklo_epi16(d1, d1);
+            __m256i q3 = _mm256_unpackhi_epi16(d1, d1);
+            _mm256_storeu_si256((__m256i*)(out + 0), _mm256_permute2x128_si256(q0, q1, 0x20));
+            _mm256_storeu_si256((__m256i*)(out + 32), _mm256_permute2x128_si256(q2, q3, 0x20));
+            _mm256_storeu_si256((__m256i*)(out + 64), _mm256_permute2x128_si256(q0, q1, 0x31));
+            _mm256_storeu_si256((__m256i*)(out + 96), _mm256_permute2x128_si256(q2, q3, 0x31));
+            out += 128;
+        }
+    }
+#elif defined(PIXEL_SIMD_SSE2)
+    const __m128i mask = _mm_set1_epi8(0x0F);
+    for (; i + 16 <= size; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i lo = _mm_and_si128(v, mask);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+        __m128i texels[2] = { _mm_unpacklo_epi8(lo, hi), _mm_unpackhi_epi8(lo, hi) };
+
+        u8* out = dst + i * 8;
+        for (int j = 0; j < 2; j++) {
+            __m128i d0 = _mm_unpacklo_epi8(texels[j], texels[j]);
+            __m128i d1 = _mm_unpackhi_epi8(texels[j], texels[j]);
+            _mm_storeu_si128((__m128i*)(out + 0), _mm_unpacklo_epi16(d0, d0));
+            _mm_storeu_si128((__m128i*)(out + 16), _mm_unpackhi_epi16(d0, d0));
+            _mm_storeu_si128((__m128i*)(out + 32), _mm_unpacklo_epi16(d1, d1));
+            _mm_storeu_si128((__m128i*)(out + 48), _mm_unpackhi_epi16(d1, d1));
+            out += 64;
+        }
+    }
+#elif defined(PIXEL_SIMD_NEON)
+    const uint8x16_t mask = vdupq_n_u8(0x0F);
+    for (; i + 16 <= size; i += 16) {
+        uint8x16_t v = vld1q_u8(src + i);
+        uint8x16x2_t t = vzipq_u8(vandq_u8(v, mask), vshrq_n_u8(v, 4));
+
+        // Interleaving the same register into all four channels replicates
+        // each index into R, G, B and A.
+        uint8x16x4_t q0 = { { t.val[0], t.val[0], t.val[0], t.val[0] } };
+        uint8x16x4_t q1 = { { t.val[1], t.val[1], t.val[1], t.val[1] } };
+        vst4q_u8(dst + i * 8, q0);
+        vst4q_u8(dst + i * 8 + 64, q1);
+    }
+#elif defined(PIXEL_SIMD_WASM)
+    const v128_t mask = wasm_i8x16_splat(0x0F);
+    for (; i + 16 <= size; i += 16) {
+        v128_t v = wasm_v128_load(src + i);
+        v128_t lo = wasm_v128_and(v, mask);
+        v128_t hi = wasm_u8x16_shr(v, 4);
+        v128_t texels[2] = {
+            wasm_i8x16_shuffle(lo, hi, 0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23),
+            wasm_i8x16_shuffle(lo, hi, 8, 24, 9, 25, 10, 26, 11, 27, 12, 28, 13, 29, 14, 30, 15, 31),
+        };
+
+        u8* out = dst + i * 8;
+        for (int j = 0; j < 2; j++) {
+            v128_t t = texels[j];
+            wasm_v128_store(out + 0, wasm_i8x16_shuffle(t, t, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3));
+            wasm_v128_store(out + 16, wasm_i8x16_shuffle(t, t, 4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7));
+            wasm_v128_store(out + 32, wasm_i8x16_shuffle(t, t, 8, 8, 8, 8, 9, 9, 9, 9, 10, 10, 10, 10, 11, 11, 11, 11));
+            wasm_v128_store(out + 48, wasm_i8x16_shuffle(t, t, 12, 12, 12, 12, 13, 13, 13, 13, 14, 14, 14, 14, 15, 15, 15, 15));
+            out += 64;
+        }
+    }
+#endif
+
+    _4bpp_to_rgba_scalar(src + i, dst + i * 8, size - i);
+}
+
+void pixel_bgr555_to_rgba(const u8* src, u8* dst, usize count) {
+    usize i = 0;
+
+#if defined(PIXEL_SIMD_AVX2)
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i alpha = _mm256_set1_epi16((short)0xFF00);
+    for (; i + 16 <= count; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + i * 2));
+        __m256i r = _mm256_slli_epi16(_mm256_and_si256(v, _mm256_set1_epi16(0x001F)), 3);
+        __m256i g = _mm256_srli_epi16(_mm256_and_si256(v, _mm256_set1_epi16(0x03E0)), 2);
+        __m256i b = _mm256_srli_epi16(_mm256_and_si256(v, _mm256_set1_epi16(0x7C00)), 7);
+        __m256i a = _mm256_andnot_si256(_mm256_cmpeq_epi16(v, zero), alpha);
+
+        __m256i rg = _mm256_or_si256(r, _mm256_slli_epi16(g, 8));
+        __m256i ba = _mm256_or_si256(b, a);
+        __m256i p0 = _mm256_unpacklo_epi16(rg, ba);
+        __m256i p1 = _mm256_unpackhi_epi16(rg, ba);
+        _mm256_storeu_si256((__m256i*)(dst + i * 4), _mm256_permute2x128_si256(p0, p1, 0x20));
+        _mm256_storeu_si256((__m256i*)(dst + i * 4 + 32), _mm256_permute2x128_si256(p0, p1, 0x31));
+    }
+#elif defined(PIXEL_SIMD_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alpha = _mm_set1_epi16((short)0xFF00);
+    for (; i + 8 <= count; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i * 2));
+        __m128i r = _mm_slli_epi16(_mm_and_si128(v, _mm_set1_epi16(0x001F)), 3);
+        __m128i g = _mm_srli_epi16(_mm_and_si128(v, _mm_set1_epi16(0x03E0)), 2);
+        __m128i b = _mm_srli_epi16(_mm_and_si128(v, _mm_set1_epi16(0x7C00)), 7);
+        __m128i a = _mm_andnot_si128(_mm_cmpeq_epi16(v, zero), alpha);
+
+        // Two 16-bit lanes per pixel, [r g] and [b a].
+        __m128i rg = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+        __m128i ba = _mm_or_si128(b, a);
+        _mm_storeu_si128((__m128i*)(dst + i * 4), _mm_unpacklo_epi16(rg, ba));
+        _mm_storeu_si128((__m128i*)(dst + i * 4 + 16), _mm_unpackhi_epi16(rg, ba));
+    }
+#elif defined(PIXEL_SIMD_NEON)
+    for (; i + 8 <= count; i += 8) {
+        uint16x8_t v = vreinterpretq_u16_u8(vld1q_u8(src + i * 2));
+        uint8x8x4_t p = { {
+            vmovn_u16(vshlq_n_u16(vandq_u16(v, vdupq_n_u16(0x001F)), 3)),
+            vmovn_u16(vshrq_n_u16(vandq_u16(v, vdupq_n_u16(0x03E0)), 2)),
+            vmovn_u16(vshrq_n_u16(vandq_u16(v, vdupq_n_u16(0x7C00)), 7)),
+            vmovn_u16(vtstq_u16(v, v)),
+        } };
+        vst4_u8(dst + i * 4, p);
+    }
+#elif defined(PIXEL_SIMD_WASM)
+    const v128_t alpha = wasm_i16x8_splat((short)0xFF00);
+    for (; i + 8 <= count; i += 8) {
+        v128_t v = wasm_v128_load(src + i * 2);
+        v128_t r = wasm_i16x8_shl(wasm_v128_and(v, wasm_i16x8_splat(0x001F)), 3);
+        v128_t g = wasm_u16x8_shr(wasm_v128_and(v, wasm_i16x8_splat(0x03E0)), 2);
+        v128_t b = wasm_u16x8_shr(wasm_v128_and(v, wasm_i16x8_splat(0x7C00)), 7);
+        v128_t a = wasm_v128_andnot(alpha, wasm_i16x8_eq(v, wasm_i16x8_splat(0)));
+
+        v128_t rg = wasm_v128_or(r, wasm_i16x8_shl(g, 8));
+        v128_t ba = wasm_v128_or(b, a);
+        wasm_v128_store(dst + i * 4, wasm_i16x8_shuffle(rg, ba, 0, 8, 1, 9, 2, 10, 3, 11));
+        wasm_v128_store(dst + i * 4 + 16, wasm_i16x8_shuffle(rg, ba, 4, 12, 5, 13, 6, 14, 7, 15));
+    }
+#endif
+
+    _bgr555_to_rgba_scalar(src + i * 2, dst + i * 4, count - i);
+}
+
+void pixel_4bpp_pal_to_rgba(const u8* src, u8* dst, usize size, const u8* palette) {
+    // Each source byte is two texels, low nibble first. Precomputing both
+    // colors for every byte value turns the decode into one 8 byte copy.
+    u8 lut[256][8];
+    for (int i = 0; i < 256; i++) {
+        memcpy(&lut[i][0], &palette[(i & 0x0F) * 4], 4);
+        memcpy(&lut[i][4], &palette[(i >> 4) * 4], 4);
+    }
+
+    for (usize i = 0; i < size; i++) {
+        memcpy(&dst[i * 8], lut[src[i]], 8);
+    }
+}
+
+void pixel_8bpp_pal_to_rgba(const u8* src, u8* dst, usize count, const u8* palette) {
+    for (usize i = 0; i < count; i++) {
+        memcpy(&dst[i * 4], &palette[src[i] * 4], 4);
+    }
+}
+
+void pixel_rgb24_to_rgba(const u8* src, u8* dst, usize count) {
+    for (usize i = 0; i < count; i++) {
+        dst[i * 4 + 0] = src[i * 3 + 0];
+        dst[i * 4 + 1] = src[i * 3 + 1];
+        dst[i * 4 + 2] = src[i * 3 + 2];
+        dst[i * 4 + 3] = 0xFF;
+    }
+}
+
+const char* pixel_simd_str(void) {
+#if defined(PIXEL_SIMD_AVX2)
+    return "AVX2";
+#elif defined(PIXEL_SIMD_SSE2)
+    return "SSE2";
+#elif defined(PIXEL_SIMD_NEON)
+    return "NEON";
+#elif defined(PIXEL_SIMD_WASM)
+    return "WASM SIMD128";
+#else
+    return "Scalar";
+#endif
+}
+
+static void _4bpp_to_r8_scalar(const u8* src, u8* dst, usize size) {
+    for (usize i = 0; i < size; i++) {
+        dst[i * 2 + 0] = src[i] & 0x0F;
+        dst[i * 2 + 1] = (src[i] & 0xF0) >> 4;
+    }
+}
+
+static void _4bpp_to_rgba_scalar(const u8* src, u8* dst, usize size) {
+    for (usize i = 0; i < size; i++) {
+        memset(&dst[i * 8 + 0], src[i] & 0x0F, 4);
+        memset(&dst[i * 8 + 4], (src[i] & 0xF0) >> 4, 4);
+    }
+}
+
+static void _bgr555_to_rgba_scalar(const u8* src, u8* dst, usize count) {
+    for (usize i = 0; i < count; i++) {
+        u16 val = src[i * 2] | (src[i * 2 + 1] << 8);
+        dst[i * 4 + 0] = (val & 0x001F) << 3; // 0b0000000000011111
+        dst[i * 4 + 1] = (val & 0x03E0) >> 2; // 0b0000001111100000
+        dst[i * 4 + 2] = (val & 0x7C00) >> 7; // 0b0111110000000000
+        dst[i * 4 + 3] = (val == 0) ? 0x00 : 0xFF;
+    }
+}
+
+//
+// Benchmark
+//
+
+// pixel_benchmark times each kernel against the per byte/pixel span reads the
+// image decoders used before, over a buffer the size of a map texture.
+pixel_bench_t pixel_benchmark(int iterations) {
+    u8* src = memory_allocate(BENCH_SIZE);
+    u8* expected = memory_allocate(BENCH_SIZE * 8);
+    u8* actual = memory_allocate(BENCH_SIZE * 8);
+
+    // Pseudo random texels with some black to cover the transparency rule.
+    u32 seed = 0x12345678;
+    for (usize i = 0; i < BENCH_SIZE; i++) {
+        seed = seed * 1664525 + 1013904223;
+        src[i] = (i % 64 < 4) ? 0 : (u8)(seed >> 24);
+    }
+
+    pixel_bench_t bench = { .iterations = iterations };
+
+    // 4bpp to R8
+    {
+        u64 start = stm_now();
+        for (int n = 0; n < iterations; n++) {
+            span_t span = { .data = src, .size = BENCH_SIZE };
+            usize write_idx = 0;
+            for (usize i = 0; i < BENCH_SIZE; i++) {
+                u8 raw_pixel = span_read_u8(&span);
+                expected[write_idx++] = (raw_pixel & 0x0F);
+                expected[write_idx++] = (raw_pixel & 0xF0) >> 4;
+            }
+        }
+        f64 baseline_ms = _bench_ms(start, iterations);
+
+        start = stm_now();
+        for (int n = 0; n < iterations; n++) {
+            pixel_4bpp_to_r8(src, actual, BENCH_SIZE);
+        }
+        bench.results[0] = (pixel_bench_result_t) {
+            .name = "4bpp to R8",
+            .baseline_ms = baseline_ms,
+            .kernel_ms = _bench_ms(start, iterations),
+            .matches = memcmp(expected, actual, BENCH_SIZE * 2) == 0,
+        };
+    }
+
+    // 4bpp to RGBA
+    {
+        u64 start = stm_now();
+        for (int n = 0; n < iterations; n++) {
+            span_t span = { .data = src, .size = BENCH_SIZE };
+            usize write_idx = 0;
+            for (usize i = 0; i < BENCH_SIZE; i++) {
+                u8 raw_pixel = span_read_u8(&span);
+                u8 right = (raw_pixel & 0x0F);
+                u8 left = (raw_pixel & 0xF0) >> 4;
+                for (int j = 0; j < 4; j++) {
+                    expected[write_idx++] = right;
+                }
+                for (int j = 0; j < 4; j++) {
+                    expected[write_idx++] = left;
+                }
+            }
+        }
+        f64 baseline_ms = _bench_ms(start, iterations);
+
+        start = stm_now();
+        for (int n = 0; n < iterations; n++) {
+            pixel_4bpp_to_rgba(src, actual, BENCH_SIZE);
+        }
+        bench.results[1] = (pixel_bench_result_t) {
+            .name = "4bpp to RGBA8",
+            .baseline_ms = baseline_ms,
+            .kernel_ms = _bench_ms(start, iterations),
+            .matches = memcmp(expected, actual, BENCH_SIZE * 8) == 0,
+        };
+    }
+
+    // 4bpp to RGBA with a palette
+    {
+        // The benchmark source doubles as a palette row.
+        const u8* palette = &src[64];
+
+        u64 start = stm_now();
+        for (int n = 0; n < iterations; n++) {
+            span_t span = { .data = src, .size = BENCH_SIZE };
+            usize write_idx = 0;
+            for (usize i = 0; i < BENCH_SIZE; i++) {
+                u8 raw_pixel = span_read_u8(&span);
+                for (int j = 0; j < 4; j++) {
+                    expected[write_idx++] = raw_pixel & 0x0F;
+                }
+                for (int j = 0; j < 4; j++) {
+                    expected[write_idx++] = (raw_pixel & 0xF0) >> 4;
+                }
+            }
+            for (usize i = 0; i < BENCH_SIZE * 8; i += 4) {
+                memcpy(&expected[i], &palette[expected[i] * 4], 4);
+            }
+        }
+        f64 baseline_ms = _bench_ms(start, iterations);
+
+        start = stm_now();
+        for (int n = 0; n < iterations; n++) {
+            pixel_4bpp_pal_to_rgba(src, actual, BENCH_SIZE, palette);
+        }
+        bench.results[2] = (pixel_bench_result_t) {
+            .name = "4bpp palette to RGBA8",
+            .baseline_ms = baseline_ms,
+            .kernel_ms = _bench_ms(start, iterations),
+            .matches = memcmp(expected, actual, BENCH_SIZE * 8) == 0,
+        };
+    }
+
+    // BGR555 to RGBA
+    {
+        const usize count = BENCH_SIZE / 2;
+
+        u64 start = stm_now();
+        for (int n = 0; n < iterations; n++) {
+            span_t span = { .data = src, .size = BENCH_SIZE };
+            usize write_idx = 0;
+            for (usize i = 0; i < count; i++) {
+                u16 val = span_read_u16(&span);
+                expected[write_idx++] = (val & 0x001F) << 3;
+                expected[write_idx++] = (val & 0x03E0) >> 2;
+                expected[write_idx++] = (val & 0x7C00) >> 7;
+                expected[write_idx++] = (val == 0) ? 0x00 : 0xFF;
+            }
+        }
+        f64 baseline_ms = _bench_ms(start, iterations);
+
+        start = stm_now();
+        for (int n = 0; n < iterations; n++) {
+            pixel_bgr555_to_rgba(src, actual, count);
+        }
+        bench.results[3] = (pixel_bench_result_t) {
+            .name = "BGR555 to RGBA8",
+            .baseline_ms = baseline_ms,
+            .kernel_ms = _bench_ms(start, iterations),
+            .matches = memcmp(expected, actual, count * 4) == 0,
+        };
+    }
+
+    memory_free(src);
+    memory_free(expected);
+    memory_free(actual);
+
+    return bench;
+}
+
+// Average milliseconds per iteration since start.
+static f64 _bench_ms(u64 start, int iterations) {
+    return stm_ms(stm_since(start)) / iterations;
+}
@@ -0,0 +1,51 @@
+// Pixel conversion kernels used by the image decoders.
+//
+// The kernels convert a whole row or image at a time. They use AVX2, SSE2,
+// NEON or WASM SIMD128 when the compiler targets them and fall back to scalar
+// code otherwise.
+#pragma once
+
+#include <stdbool.h>
+
+#include "defines.h"
+
+enum {
+    PIXEL_BENCH_KERNEL_COUNT = 4,
+};
+
+// 4bpp to one index per byte, low nibble first. dst holds size * 2 bytes.
+void pixel_4bpp_to_r8(const u8* src, u8* dst, usize size);
+
+// 4bpp to RGBA with the index replicated in every channel. dst holds size * 8
+// bytes.
+void pixel_4bpp_to_rgba(const u8* src, u8* dst, usize size);
+
+// 4bpp to RGBA using a 16 color RGBA palette row, in one pass through a 256
+// entry table of texel pairs. dst holds size * 8 bytes.
+void pixel_4bpp_pal_to_rgba(const u8* src, u8* dst, usize size, const u8* palette);
+
+// 8bpp to RGBA using a 256 color RGBA palette. dst holds count * 4 bytes.
+void pixel_8bpp_pal_to_rgba(const u8* src, u8* dst, usize count, const u8* palette);
+
+// 24-bit RGB to opaque RGBA8. dst holds count * 4 bytes.
+void pixel_rgb24_to_rgba(const u8* src, u8* dst, usize count);
+
+// Little endian BGR555 to RGBA8. Black (0x0000) is transparent, everything
+// else is opaque. dst holds count * 4 bytes.
+void pixel_bgr555_to_rgba(const u8* src, u8* dst, usize count);
+
+const char* pixel_simd_str(void);
+
+typedef struct {
+    const char* name;
+    f64 baseline_ms; // Per byte/pixel span reads, as the decoders used to do
+    f64 kernel_ms;
+    bool matches; // Kernel output is identical to the baseline
+} pixel_bench_result_t;
+
+typedef struct {
+    pixel_bench_result_t results[PIXEL_BENCH_KERNEL_COUNT];
+    int iterations;
+} pixel_bench_t;
+
+pixel_bench_t pixel_benchmark(int iterations);
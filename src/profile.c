@@ -0,0 +1,148 @@
+#include <stdlib.h>
+
+#include "sokol_gfx.h"
+#include "sokol_time.h"
+
+#include "profile.h"
+
+static struct {
+    profile_frame_t frames[PROFILE_FRAME_COUNT];
+    int frame_count; // Frames recorded, at most PROFILE_FRAME_COUNT
+    int next;        // Ring buffer slot of the frame being recorded
+
+    profile_frame_t current;
+    u64 frame_start;
+    u64 stage_start[PROFILE_STAGE_COUNT];
+    bool in_frame;
+} _state;
+
+static int _compare_f32(const void*, const void*);
+static profile_percentiles_t _percentiles(f32*, int);
+
+// profile_frame_begin starts recording a frame. The time since the previous
+// frame began is the frame time, including any wait for vsync.
+void profile_frame_begin(void) {
+    u64 now = stm_now();
+    f32 frame_ms = _state.frame_start != 0 ? (f32)stm_ms(stm_diff(now, _state.frame_start)) : 0.0f;
+
+    _state.current = (profile_frame_t) { .frame_ms = frame_ms };
+    _state.frame_start = now;
+    _state.in_frame = true;
+}
+
+// profile_frame_end is called after sg_commit(), so sokol_gfx's frame stats
+// are the ones of this frame.
+void profile_frame_end(void) {
+    if (!_state.in_frame) {
+        return;
+    }
+    _state.current.cpu_ms = (f32)stm_ms(stm_since(_state.frame_start));
+    _state.in_frame = false;
+
+    sg_frame_stats stats = sg_query_frame_stats();
+    _state.current.draws = stats.num_draw;
+    _state.current.pipelines = stats.num_apply_pipeline;
+    _state.current.bindings = stats.num_apply_bindings;
+    _state.current.uniforms = stats.num_apply_uniforms;
+    _state.current.upload_bytes = stats.size_update_buffer + stats.size_append_buffer + stats.size_update_image;
+
+    _state.frames[_state.next] = _state.current;
+    _state.next = (_state.next + 1) % PROFILE_FRAME_COUNT;
+    if (_state.frame_count < PROFILE_FRAME_COUNT) {
+        _state.frame_count++;
+    }
+}
+
+void profile_begin(profile_stage_e stage) {
+    _state.stage_start[stage] = stm_now();
+}
+
+// Stages can run more than once per frame, their times add up.
+void profile_end(profile_stage_e stage) {
+    _state.current.stage_ms[stage] += (f32)stm_ms(stm_since(_state.stage_start[stage]));
+}
+
+// profile_get_last_frame returns the last completed frame.
+const profile_frame_t* profile_get_last_frame(void) {
+    int last = (_state.next + PROFILE_FRAME_COUNT - 1) % PROFILE_FRAME_COUNT;
+    return &_state.frames[last];
+}
+
+// profile_get_frame_times writes the frame times oldest first into out, which
+// holds PROFILE_FRAME_COUNT values, and returns how many were written.
+int profile_get_frame_times(f32* out) {
+    int first = (_state.next + PROFILE_FRAME_COUNT - _state.frame_count) % PROFILE_FRAME_COUNT;
+    for (int i = 0; i < _state.frame_count; i++) {
+        out[i] = _state.frames[(first + i) % PROFILE_FRAME_COUNT].frame_ms;
+    }
+    return _state.frame_count;
+}
+
+profile_summary_t profile_get_summary(void) {
+    profile_summary_t summary = { .frame_count = _state.frame_count };
+    f32 values[PROFILE_FRAME_COUNT];
+    int count = _state.frame_count;
+
+    for (int i = 0; i < count; i++) {
+        values[i] = _state.frames[i].frame_ms;
+    }
+    summary.frame_ms = _percentiles(values, count);
+
+    for (int i = 0; i < count; i++) {
+        values[i] = _state.frames[i].cpu_ms;
+    }
+    summary.cpu_ms = _percentiles(values, count);
+
+    for (int stage = 0; stage < PROFILE_STAGE_COUNT; stage++) {
+        for (int i = 0; i < count; i++) {
+            values[i] = _state.frames[i].stage_ms[stage];
+        }
+        summary.stage_ms[stage] = _percentiles(values, count);
+    }
+    return summary;
+}
+
+// Nearest rank percentiles. Sorts values.
+static profile_percentiles_t _percentiles(f32* values, int count) {
+    if (count == 0) {
+        return (profile_percentiles_t) { 0 };
+    }
+    qsort(values, count, sizeof(f32), _compare_f32);
+    return (profile_percentiles_t) {
+        .p50 = values[(count - 1) * 50 / 100],
+        .p95 = values[(count - 1) * 95 / 100],
+        .p99 = values[(count - 1) * 99 / 100],
+        .max = values[count - 1],
+    };
+}
+
+static int _compare_f32(const void* a, const void* b) {
+    f32 fa = *(const f32*)a;
+    f32 fb = *(const f32*)b;
+    return (fa > fb) - (fa < fb);
+}
+
+const char* profile_stage_str(profile_stage_e stage) {
+    switch (stage) {
+    case PROFILE_STAGE_VM:
+        return "VM";
+    case PROFILE_STAGE_ANIM:
+        return "Animation";
+    case PROFILE_STAGE_BACKGROUND:
+        return "Background";
+    case PROFILE_STAGE_MODEL:
+        return "Model";
+    case PROFILE_STAGE_TILE:
+        return "Tiles";
+    case PROFILE_STAGE_LINE:
+        return "Lines";
+    case PROFILE_STAGE_SPRITE:
+        return "Sprites";
+    case PROFILE_STAGE_GUI:
+        return "GUI";
+    case PROFILE_STAGE_COMMIT:
+        return "Commit";
+    default:
+        return "Unknown";
+    }
+}
@@ -0,0 +1,64 @@
+// profile records how long each stage of a frame takes on the CPU and how much
+// work was submitted to sokol_gfx, as counted by sokol_gfx's frame stats. GPU
+// time is not measured, waiting on the GPU only shows up in the frame time. The last PROFILE_FRAME_COUNT frames are kept in a
+// ring buffer so percentiles can be computed over them.
+#pragma once
+
+#include <stdbool.h>
+
+#include "defines.h"
+
+enum {
+    PROFILE_FRAME_COUNT = 256,
+};
+
+typedef enum {
+    PROFILE_STAGE_VM,
+    PROFILE_STAGE_ANIM,
+    PROFILE_STAGE_BACKGROUND,
+    PROFILE_STAGE_MODEL,
+    PROFILE_STAGE_TILE,
+    PROFILE_STAGE_LINE,
+    PROFILE_STAGE_SPRITE,
+    PROFILE_STAGE_GUI,
+    PROFILE_STAGE_COMMIT,
+    PROFILE_STAGE_COUNT,
+} profile_stage_e;
+
+typedef struct {
+    f32 frame_ms; // Time since the previous frame started
+    f32 cpu_ms;   // Time from the start to the end of this frame's work
+    f32 stage_ms[PROFILE_STAGE_COUNT];
+
+    // From sg_query_frame_stats(), for the whole frame including the GUI.
+    u32 draws;
+    u32 pipelines;
+    u32 bindings;
+    u32 uniforms;
+    u32 upload_bytes; // Buffer and image updates
+} profile_frame_t;
+
+typedef struct {
+    f32 p50;
+    f32 p95;
+    f32 p99;
+    f32 max;
+} profile_percentiles_t;
+
+// Percentiles over the frames in the ring buffer.
+typedef struct {
+    int frame_count;
+    profile_percentiles_t frame_ms;
+    profile_percentiles_t cpu_ms;
+    profile_percentiles_t stage_ms[PROFILE_STAGE_COUNT];
+} profile_summary_t;
+
+void profile_frame_begin(void);
+void profile_frame_end(void);
+void profile_begin(profile_stage_e);
+void profile_end(profile_stage_e);
+
+const profile_frame_t* profile_get_last_frame(void);
+int profile_get_frame_times(f32*);
+profile_summary_t profile_get_summary(void);
+const char* profile_stage_str(profile_stage_e);
@@ -1,6 +1,9 @@
+#include "anim.h"
 #include "camera.h"
 #include "sokol_gfx.h"
 
+#include "cglm/struct/mat4.h"
+#include "cglm/struct/vec4.h"
 #include "cglm/types-struct.h"
 #include "shader.glsl.h"
 
@@ -9,9 +12,12 @@
 #include "gfx_line.h"
 #include "gfx_model.h"
 #include "gfx_sprite.h"
+#include "gfx_tile.h"
 #include "map.h"
+#include "profile.h"
 #include "scenario.h"
 #include "scene.h"
+#include "trace.h"
 #include "unit.h"
 #include "util.h"
 #include "vm.h"
@@ -29,6 +35,7 @@ typedef enum {
 } switch_e;
 
 static void _scene_switch(switch_e dir);
+static void _build_tile_positions(const terrain_t* terrain);
 
 void scene_init(void) {
     _state.current_scenario_id = 78;
@@ -44,36 +51,162 @@ void scene_reset(void) {
     camera_reset();
 
     map_destroy(_state.map);
-    gfx_model_destroy();
+    mesh_grid_destroy(_state.mesh_grid);
+    _state.map = NULL;
+    _state.mesh_grid = NULL;
+    _state.map_generation++;
+    gfx_model_reset();
     gfx_sprite_reset();
+    anim_reset();
 }
 
 void scene_shutdown(void) {
     scene_reset();
 }
 
-void scene_render(void) {
+// scene_render draws the scene into the offscreen image and returns true, or
+// returns false and shows the previous image again if nothing in the scene
+// changed. Every source is asked so each one updates its copy of the state.
+bool scene_render(void) {
+    // MapLight and MapDarkness change the lights every frame until they end.
+    bool lights_animating = vm_transition_has_active(WAITTYPE_MAPLIGHT) || vm_transition_has_active(WAITTYPE_MAPDARKNESS);
+    gfx_model_set_lights_animating(lights_animating);
+
+    bool changed = gfx_take_invalidated();
+    changed |= camera_changed();
+    changed |= gfx_model_changed();
+    changed |= gfx_sprite_changed();
+    if (!changed) {
+        gfx_render_skip();
+        return false;
+    }
+
     gfx_render_begin();
     {
+        profile_begin(PROFILE_STAGE_BACKGROUND);
         gfx_background_render();
+        profile_end(PROFILE_STAGE_BACKGROUND);
+
+        profile_begin(PROFILE_STAGE_MODEL);
         gfx_model_render();
+        profile_end(PROFILE_STAGE_MODEL);
+
+        profile_begin(PROFILE_STAGE_TILE);
+        gfx_tile_render();
+        profile_end(PROFILE_STAGE_TILE);
+
+        profile_begin(PROFILE_STAGE_LINE);
         gfx_line_render_axis();
+        profile_end(PROFILE_STAGE_LINE);
+
+        profile_begin(PROFILE_STAGE_SPRITE);
         gfx_sprite_render();
+        profile_end(PROFILE_STAGE_SPRITE);
     }
     gfx_render_end();
+    return true;
 }
 
 void scene_load_map(int num, map_state_t map_state) {
+    TRACE_BEGIN();
     scene_reset();
 
-    map_t* map = read_map(num);
-    model_t model = gfx_model_create(map, map_state);
+    map_t* map = read_map(num, map_state);
+    model_t model = gfx_model_cache_get(map, num, map_state);
     gfx_model_set(model);
     gfx_background_set(model.lighting.bg_top, model.lighting.bg_bottom);
 
+    const mesh_t* mesh = map_get_mesh(map, map_state);
+    _state.mesh_grid = mesh_grid_create(&mesh->geometry);
+    _build_tile_positions(&mesh->terrain);
+
     _state.map = map;
     _state.map_state = map_state;
     _state.current_map = num;
+    _state.map_generation++;
+    TRACE_END();
+}
+
+// scene_set_map_state switches the current map to another time/weather/layout
+// without reloading the map. The model comes from the model cache, so states
+// that were displayed before switch immediately. The model transform is kept.
+void scene_set_map_state(map_state_t map_state) {
+    transform_t transform = *gfx_model_get_transform();
+
+    model_t model = gfx_model_cache_get(_state.map, _state.current_map, map_state);
+    model.transform = transform;
+    gfx_model_set(model);
+    gfx_background_set(model.lighting.bg_top, model.lighting.bg_bottom);
+
+    mesh_grid_destroy(_state.mesh_grid);
+    const mesh_t* mesh = map_get_mesh(_state.map, map_state);
+    _state.mesh_grid = mesh_grid_create(&mesh->geometry);
+    _build_tile_positions(&mesh->terrain);
+
+    _state.map_state = map_state;
+    _state.map_generation++;
+}
+
+// scene_pick casts a ray from the camera through the normalized device
+// coordinates and returns the map polygon it hits. The ray is transformed into
+// mesh space so the model transform is taken into account.
+mesh_hit_t scene_pick(f32 ndc_x, f32 ndc_y) {
+    mat4s model = transform_to_matrix_around_center(*gfx_model_get_transform(), gfx_model_get_offset_center());
+    mat4s mvp = glms_mat4_mul(glms_mat4_mul(camera_get_proj(), camera_get_view()), model);
+    mat4s inv = glms_mat4_inv(mvp);
+
+    // Depth is reversed (cleared to 0.0 and compared with GREATER) so the
+    // near plane is at z = 1.0 and the far plane at z = -1.0.
+    vec4s near = glms_mat4_mulv(inv, (vec4s) { { ndc_x, ndc_y, 1.0f, 1.0f } });
+    vec4s far = glms_mat4_mulv(inv, (vec4s) { { ndc_x, ndc_y, -1.0f, 1.0f } });
+    vec3s a = glms_vec3_scale(glms_vec3(near), 1.0f / near.w);
+    vec3s b = glms_vec3_scale(glms_vec3(far), 1.0f / far.w);
+
+    ray_t ray = {
+        .origin = a,
+        .direction = glms_vec3_sub(b, a),
+    };
+    return mesh_raycast(_state.mesh_grid, ray);
+}
+
+// scene_tile_map_position returns where a unit standing on the tile is in map
+// mesh space. Tiles outside the map are placed as if they were flat at height 0.
+vec3s scene_tile_map_position(int x, int z, int level) {
+    if (_state.map != NULL) {
+        const terrain_grid_t* grid = &map_get_mesh(_state.map, _state.map_state)->terrain.grid;
+        bool inside = x >= 0 && z >= 0 && x < grid->x_count && z < grid->z_count;
+        if (inside && level >= 0 && level < TERRAIN_LEVEL_COUNT) {
+            return _state.tile_positions[level * TERRAIN_TILE_MAX + z * grid->x_count + x];
+        }
+    }
+
+    return (vec3s) { { x * TILE_WIDTH + TILE_WIDTH * 0.5f, 0.0f, z * TILE_DEPTH + TILE_DEPTH * 0.5f } };
+}
+
+// scene_map_to_world moves a point in map mesh space into world space with the
+// current model transform.
+vec3s scene_map_to_world(vec3s position) {
+    mat4s model = transform_to_matrix_around_center(*gfx_model_get_transform(), gfx_model_get_offset_center());
+    return glms_vec3(glms_mat4_mulv(model, glms_vec4(position, 1.0f)));
+}
+
+// Heights are in half h and the map's y axis points down. Sloped tiles use
+// the height at their center, which is where units stand.
+static void _build_tile_positions(const terrain_t* terrain) {
+    const terrain_grid_t* grid = &terrain->grid;
+    for (int level = 0; level < TERRAIN_LEVEL_COUNT; level++) {
+        for (int z = 0; z < grid->z_count; z++) {
+            for (int x = 0; x < grid->x_count; x++) {
+                int idx = level * TERRAIN_TILE_MAX + z * grid->x_count + x;
+                f32 height = terrain_surface_height(grid->cells[idx], 0.5f, 0.5f);
+                _state.tile_positions[idx] = (vec3s) { {
+                    x * TILE_WIDTH + TILE_WIDTH * 0.5f,
+                    height * -TILE_HEIGHT * 0.5f,
+                    z * TILE_DEPTH + TILE_DEPTH * 0.5f,
+                } };
+            }
+        }
+    }
 }
 
 void scene_load_units(int entd_id) {
@@ -82,6 +215,7 @@ void scene_load_units(int entd_id) {
 }
 
 void scene_load_scenario(int scenario_id) {
+    TRACE_BEGIN();
     scenario_t scenario = scenario_get_scenario(scenario_id);
     map_state_t scenario_state = {
         .time = scenario.time,
@@ -92,6 +226,7 @@ void scene_load_scenario(int scenario_id) {
     _state.event = vm_event_get_event(scenario.event_id);
     scene_load_map(scenario.map_id, scenario_state);
     scene_load_units(scenario.entd_id);
+    TRACE_END();
 }
 
 event_t scene_get_event(void) { return _state.event; }
@@ -4,6 +4,7 @@
 
 #include "map.h"
 #include "map_record.h"
+#include "mesh.h"
 #include "unit.h"
 #include "vm_event.h"
 
@@ -16,22 +17,35 @@ typedef struct {
     mode_e mode;
     map_t* map;
     map_state_t map_state;
+    mesh_grid_t* mesh_grid;
     int current_scenario_id;
     int current_map;
     event_t event;
     units_t units;
+
+    // Changes every time the map or the map state changes, so anything that
+    // keeps polygon or tile indices knows they are for another mesh.
+    u32 map_generation;
+
+    // Surface point at the center of every terrain tile in mesh space,
+    // indexed like terrain_grid_t cells. Built when the map is loaded.
+    vec3s tile_positions[TERRAIN_LEVEL_COUNT * TERRAIN_TILE_MAX];
 } scene_t;
 
 void scene_init(void);
 void scene_shutdown(void);
-void scene_render(void);
+bool scene_render(void);
 
 // Temporary
 scene_t* scene_get_internals(void);
 
 void scene_load_map(int, map_state_t);
+void scene_set_map_state(map_state_t);
 void scene_load_scenario(int);
 void scene_set_map_rotation(f32);
+mesh_hit_t scene_pick(f32, f32);
+vec3s scene_tile_map_position(int, int, int);
+vec3s scene_map_to_world(vec3s);
 
 event_t scene_get_event(void);
 
@@ -0,0 +1,180 @@
+#include <stdint.h>
+#include <stdio.h>
+
+#include "memory.h"
+#include "seq.h"
+#include "util.h"
+
+enum {
+    SEQ_POINTER_OFFSET = 0x0006,
+    SEQ_DATA_OFFSET = 0x0406,
+    SEQ_OPCODE_PREFIX = 0xFF,
+};
+
+// Opcodes that change the compiled steps. The rest only have their parameters
+// skipped.
+typedef enum {
+    SEQ_OP_MOVE_UNIT_DU = 0xC7,
+    SEQ_OP_MOVE_UNIT_RL = 0xC8,
+    SEQ_OP_MOVE_UNIT_RLDUFB = 0xC9,
+    SEQ_OP_FLIP_VERTICAL = 0xCC,
+    SEQ_OP_FLIP_HORIZONTAL = 0xCD,
+    SEQ_OP_SET_FRAME_OFFSET = 0xD8,
+} seq_opcode_e;
+
+static void _compile_sequences(seq_t*, span_t*);
+static seq_sequence_t _compile_sequence(seq_t*, span_t*, usize);
+static int _param_count(u8);
+
+// seq_read compiles every sequence of the file into one step table.
+seq_t seq_read(file_entry_e entry) {
+    span_t span = filesystem_read_file(entry);
+
+    // Sequences can share or overlap their data, so the file size doesn't
+    // bound the steps. A first pass without steps only counts them.
+    seq_t seq = { 0 };
+    _compile_sequences(&seq, &span);
+
+    seq.step_capacity = seq.step_count;
+    seq.step_count = 0;
+    seq.steps = memory_allocate(MAX(seq.step_capacity, 1) * sizeof(seq_step_t));
+    _compile_sequences(&seq, &span);
+
+    seq.valid = seq.step_count > 0;
+    return seq;
+}
+
+void seq_destroy(seq_t seq) {
+    memory_free(seq.steps);
+}
+
+static void _compile_sequences(seq_t* seq, span_t* span) {
+    for (int i = 0; i < SEQ_SEQUENCE_MAX; i++) {
+        u32 pointer = span_readat_u32(span, SEQ_POINTER_OFFSET + i * 4);
+        usize offset = SEQ_DATA_OFFSET + pointer;
+        if (pointer == UINT32_MAX || offset + 2 > span->size) {
+            seq->sequences[i] = (seq_sequence_t) { .first = seq->step_count };
+            continue;
+        }
+
+        span->offset = offset;
+        u16 length = span_read_u16(span);
+        usize end = MIN(span->offset + length, span->size);
+
+        seq->sequences[i] = _compile_sequence(seq, span, end);
+        seq->sequence_count = i + 1;
+    }
+}
+
+// Steps are only written when seq->steps is set, otherwise they are counted.
+static seq_sequence_t _compile_sequence(seq_t* seq, span_t* span, usize end) {
+    seq_sequence_t sequence = { .first = seq->step_count };
+
+    u8 flags = 0;
+    i8 offset_x = 0;
+    i8 offset_y = 0;
+
+    while (span->offset + 2 <= end) {
+        u8 first = span_read_u8(span);
+        u8 second = span_read_u8(span);
+
+        if (first != SEQ_OPCODE_PREFIX) {
+            if (seq->steps != NULL) {
+                ASSERT(seq->step_count < seq->step_capacity, "SEQ step table is full");
+                seq->steps[seq->step_count] = (seq_step_t) {
+                    .frame = first,
+                    .duration = MAX(second, 1),
+                    .flags = flags,
+                    .offset_x = offset_x,
+                    .offset_y = offset_y,
+                };
+            }
+            seq->step_count++;
+            sequence.count++;
+            continue;
+        }
+
+        int param_count = _param_count(second);
+        if (param_count < 0 || span->offset + param_count > end) {
+            if (seq->steps != NULL) {
+                printf("Unknown SEQ opcode 0x%02X\n", second);
+            }
+            break;
+        }
+
+        u8 params[3] = { 0 };
+        for (int i = 0; i < param_count; i++) {
+            params[i] = span_read_u8(span);
+        }
+
+        switch ((seq_opcode_e)second) {
+        case SEQ_OP_MOVE_UNIT_DU:
+            offset_y += (i8)params[0];
+            break;
+        case SEQ_OP_MOVE_UNIT_RL:
+            offset_x += (i8)params[0];
+            break;
+        case SEQ_OP_MOVE_UNIT_RLDUFB:
+            offset_x += (i8)params[0];
+            offset_y += (i8)params[1];
+            break;
+        case SEQ_OP_FLIP_VERTICAL:
+            flags ^= SEQ_STEP_FLIP_Y;
+            break;
+        case SEQ_OP_FLIP_HORIZONTAL:
+            flags ^= SEQ_STEP_FLIP_X;
+            break;
+        case SEQ_OP_SET_FRAME_OFFSET:
+            offset_x = (i8)params[0];
+            offset_y = (i8)params[1];
+            break;
+        default:
+            break;
+        }
+    }
+
+    return sequence;
+}
+
+// Parameter bytes of each opcode, -1 for unknown opcodes.
+static int _param_count(u8 opcode) {
+    switch (opcode) {
+    case 0xC1:
+    case 0xC2:
+    case 0xC3:
+    case SEQ_OP_FLIP_VERTICAL:
+    case SEQ_OP_FLIP_HORIZONTAL:
+    case 0xCE:
+    case 0xCF:
+    case 0xD0:
+    case 0xD2:
+    case 0xD9:
+    case 0xEE:
+    case 0xFA:
+    case 0xFB:
+    case 0xFC:
+    case 0xFD:
+    case 0xFE:
+        return 0;
+    case 0xC0:
+    case 0xC5:
+    case 0xC6:
+    case SEQ_OP_MOVE_UNIT_DU:
+    case SEQ_OP_MOVE_UNIT_RL:
+    case 0xCA:
+    case 0xCB:
+    case 0xD1:
+    case 0xD6:
+        return 1;
+    case 0xC4:
+    case 0xD3:
+    case 0xD7:
+    case SEQ_OP_SET_FRAME_OFFSET:
+    case 0xF4:
+        return 2;
+    case SEQ_OP_MOVE_UNIT_RLDUFB:
+        return 3;
+    default:
+        return -1;
+    }
+}
@@ -0,0 +1,60 @@
+// SEQ files are the animation sequences of a shape type, used with the SHP
+// file of the same name.
+//
+// 0x0000: u16 unknown
+// 0x0002: u16 unknown
+// 0x0006: 256 u32 sequence offsets, relative to 0x0406. 0xFFFFFFFF is unused.
+// 0x0406: Sequence data
+//
+// Sequence:
+//   u16 length in bytes
+//   instructions:
+//     u8 frame, u8 duration   Show an SHP frame for a number of ticks
+//     0xFF, u8 opcode, params Change the unit's offset, flip it, etc
+//
+// Sequences are compiled once into a flat table of steps so playing them
+// doesn't interpret the instructions every frame. Sequences loop.
+//
+// https://ffhacktics.com/wiki/SEQ
+#pragma once
+
+#include <stdbool.h>
+
+#include "filesystem.h"
+
+enum {
+    SEQ_SEQUENCE_MAX = 256,
+};
+
+typedef enum {
+    SEQ_STEP_FLIP_X = 1 << 0,
+    SEQ_STEP_FLIP_Y = 1 << 1,
+} seq_step_flags_e;
+
+// seq_step_t is one frame of a sequence with the state the opcodes before it
+// left the unit in.
+typedef struct {
+    u16 frame;
+    u8 duration;
+    u8 flags;
+    i8 offset_x;
+    i8 offset_y;
+} seq_step_t;
+
+// seq_sequence_t is a range of the step table.
+typedef struct {
+    int first;
+    int count;
+} seq_sequence_t;
+
+typedef struct {
+    seq_step_t* steps;
+    int step_count;
+    int step_capacity;
+    seq_sequence_t sequences[SEQ_SEQUENCE_MAX];
+    int sequence_count;
+    bool valid;
+} seq_t;
+
+seq_t seq_read(file_entry_e);
+void seq_destroy(seq_t);
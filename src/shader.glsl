@@ -8,13 +8,44 @@
 // Standard - Used for rendering 3D models/maps.
 //
 
-@vs standard_vs
-
+@block standard_vs_params
 layout(binding=0) uniform vs_standard_params {
     mat4 u_proj;
     mat4 u_view;
     mat4 u_model;
 };
+@end
+
+// Shared by the fragment shaders of standard and standard_baked. The textures
+// and sampler are declared by the including shader.
+@block standard_fs_palette
+// PS1 4x4 Bayer pattern
+const float bayer[16] = float[16](
+     0.0,  8.0,  2.0, 10.0,
+    12.0,  4.0, 14.0,  6.0,
+     3.0, 11.0,  1.0,  9.0,
+    15.0,  7.0, 13.0,  5.0
+);
+
+vec4 applyDither(vec4 color) {
+    ivec2 pixel = ivec2(gl_FragCoord.xy) & 3;  // 4x4 pattern
+    int index = pixel.x + pixel.y * 4;
+    float offset = bayer[index] / 256.0;       // scale to 0-1 range
+    return color + vec4(offset);               // add to all components
+}
+
+// The texture is R8 with a palette index (0-15) per texel.
+vec4 samplePalettedTexture(vec2 uv, float paletteIndex) {
+    vec4 indexColor = texture(sampler2D(u_texture, u_sampler), uv);
+    float palette_x = float(uint(indexColor.r * 255.0));
+    float palette_y = float(uint(paletteIndex));
+    vec2 pal_uv = vec2(palette_x / 16.0, palette_y / 16.0);
+    return texture(sampler2D(u_palette, u_sampler), pal_uv);
+}
+@end
+
+@vs standard_vs
+@include_block standard_vs_params
 
 in vec3 a_position;
 in vec3 a_normal;
@@ -64,20 +95,7 @@ in float v_is_textured;
 
 out vec4 frag_color;
 
-// PS1 4x4 Bayer pattern
-const float bayer[16] = float[16](
-     0.0,  8.0,  2.0, 10.0,
-    12.0,  4.0, 14.0,  6.0,
-     3.0, 11.0,  1.0,  9.0,
-    15.0,  7.0, 13.0,  5.0
-);
-
-vec4 applyDither(vec4 color) {
-    ivec2 pixel = ivec2(gl_FragCoord.xy) & 3;  // 4x4 pattern
-    int index = pixel.x + pixel.y * 4;
-    float offset = bayer[index] / 256.0;       // scale to 0-1 range
-    return color + vec4(offset);               // add to all components
-}
+@include_block standard_fs_palette
 
 vec4 applyLight(vec3 norm, vec4 color) {
     vec4 diffuse_light = vec4(0.0, 0.0, 0.0, 1.0);
@@ -90,14 +108,6 @@ vec4 applyLight(vec3 norm, vec4 color) {
     return light * color;
 }
 
-vec4 samplePalettedTexture(vec2 uv, float paletteIndex) {
-    vec4 indexColor = texture(sampler2D(u_texture, u_sampler), uv);
-    float palette_x = float(uint(indexColor.r * 255.0));
-    float palette_y = float(uint(paletteIndex));
-    vec2 pal_uv = vec2(palette_x / 16.0, palette_y / 16.0);
-    return texture(sampler2D(u_palette, u_sampler), pal_uv);
-}
-
 void main() {
    // Handle untextured triangles
     if (v_is_textured < 0.5) { // Assuming a_is_textured is 1.0 for textured and 0.0 for untextured
@@ -119,6 +129,74 @@ void main() {
 }
 @end
 
+//
+// Standard Baked - The standard shader with the diffuse lighting baked into a
+// per-vertex color on the CPU. Used while the lights are static.
+//
+
+@vs standard_baked_vs
+@include_block standard_vs_params
+
+in vec3 a_position;
+in vec2 a_uv;
+in float a_palette_index;
+in float a_is_textured;
+in vec4 a_light;
+
+out vec2 v_uv;
+out float v_palette_index;
+out float v_is_textured;
+out vec4 v_light;
+
+void main() {
+    gl_Position = u_proj * u_view * u_model * vec4(a_position, 1.0);
+
+    v_uv = a_uv;
+    v_palette_index = a_palette_index;
+    v_is_textured = a_is_textured;
+    v_light = a_light;
+}
+@end
+
+@fs standard_baked_fs
+
+layout(binding=1) uniform fs_standard_baked_params {
+    vec4  u_ambient; // Ambient color times strength
+    float u_dither;
+};
+
+layout(binding=0) uniform texture2D u_texture;
+layout(binding=1) uniform texture2D u_palette;
+layout(binding=0) uniform sampler u_sampler;
+
+in vec2 v_uv;
+in float v_palette_index;
+in float v_is_textured;
+in vec4 v_light;
+
+out vec4 frag_color;
+
+@include_block standard_fs_palette
+
+void main() {
+    if (v_is_textured < 0.5) {
+        frag_color = vec4(0.0, 0.0, 0.0, 1.0);
+        return;
+    }
+
+    vec4 color = samplePalettedTexture(v_uv, v_palette_index);
+    if (color.a < 0.5) discard;
+
+    color = (u_ambient + v_light) * color;
+
+    if (u_dither > 0) {
+        color = applyDither(color);
+    }
+
+    frag_color = color;
+}
+@end
+
 //
 // Background - used for render the gradient backgorund
 //
@@ -204,49 +282,115 @@ void main() {
 }
 @end
 
+//
+// Tile overlay
+//
+
+@vs tile_vs
+
+// Tiles are drawn instanced. a_corner is the corner of the tile (0 or 1 on x
+// and z) and the corner heights are interpolated from a_heights.
+layout(binding=0) uniform vs_tile_params {
+    mat4 u_proj;
+    mat4 u_view;
+    mat4 u_model;
+    vec2 u_tile_size; // TILE_WIDTH and TILE_DEPTH
+};
+
+in vec2 a_corner;
+
+// Per instance
+in vec2 a_origin;
+in vec4 a_heights;
+in vec4 a_color;
+
+out vec4 v_color;
+
+void main() {
+    float height = mix(mix(a_heights.x, a_heights.y, a_corner.x), mix(a_heights.z, a_heights.w, a_corner.x), a_corner.y);
+    vec2 xz = a_origin + a_corner * u_tile_size;
+    vec3 position = vec3(xz.x, height, xz.y);
+    gl_Position = u_proj * u_view * u_model * vec4(position, 1.0);
+    v_color = a_color;
+}
+@end
+
+@fs tile_fs
+in vec4 v_color;
+out vec4 frag_color;
+
+void main() {
+    frag_color = v_color;
+}
+@end
+
 //
 // Sprite
 //
 
 @vs sprite_vs
 
+// Sprites are drawn instanced. The quad is expanded along u_right and u_up,
+// the camera's axes for billboarded 3D sprites or the screen axes for 2D.
 layout(binding=0) uniform vs_sprite_params {
     mat4 u_proj;
     mat4 u_view;
-    mat4 u_model;
-    vec2 u_uv_min;
-    vec2 u_uv_max;
+    vec4 u_right;
+    vec4 u_up;
 };
 
 in vec3 a_position;
 in vec2 a_uv;
 
+// Per instance
+in vec3 a_translation;
+in float a_palette_row;
+in vec2 a_scale;
+in vec2 a_offset;
+in vec4 a_uv_rect;
+
 out vec2 v_uv;
+out float v_palette_row;
 
 void main() {
-    // Simple 3D transform for sprites if you’re drawing in a 3D scene.
-    gl_Position = u_proj * u_view * u_model * vec4(a_position, 1.0);
-    v_uv = mix(u_uv_min, u_uv_max, a_uv);
+    vec3 position = a_translation
+        + u_right.xyz * (a_position.x * a_scale.x + a_offset.x)
+        + u_up.xyz * (a_position.y * a_scale.y + a_offset.y);
+    gl_Position = u_proj * u_view * vec4(position, 1.0);
+    v_uv = mix(a_uv_rect.xy, a_uv_rect.zw, a_uv);
+    v_palette_row = a_palette_row;
 }
 @end
 
 @fs sprite_fs
+layout(binding=1) uniform fs_sprite_params {
+    float u_palette_count;
+};
+
+// u_texture is R8 with a palette index (0-15) per texel. u_palette has one
+// row of 16 colors per palette.
 layout(binding=0) uniform texture2D  u_texture;
+layout(binding=1) uniform texture2D  u_palette;
 layout(binding=0) uniform sampler    u_sampler;
 
 in vec2 v_uv;
+in float v_palette_row;
 
 out vec4 frag_color;
 
 void main() {
-    frag_color = texture(sampler2D(u_texture, u_sampler), v_uv);
+    float index = float(uint(texture(sampler2D(u_texture, u_sampler), v_uv).r * 255.0));
+    vec2 pal_uv = vec2((index + 0.5) / 16.0, (v_palette_row + 0.5) / u_palette_count);
+    frag_color = texture(sampler2D(u_palette, u_sampler), pal_uv);
     if (frag_color.a < 0.5)
         discard;
 
 }
 @end
 
-@program standard   standard_vs   standard_fs
-@program background background_vs background_fs
-@program line       line_vs       line_fs
-@program sprite     sprite_vs     sprite_fs
+@program standard        standard_vs        standard_fs
+@program standard_baked  standard_baked_vs  standard_baked_fs
+@program background      background_vs      background_fs
+@program line            line_vs            line_fs
+@program tile            tile_vs            tile_fs
+@program sprite          sprite_vs          sprite_fs
@@ -0,0 +1,113 @@
+#include "shp.h"
+#include "memory.h"
+#include "util.h"
+
+enum {
+    SHP_FRAME_TABLE_OFFSET = 0x000A,
+    SHP_FRAME_DATA_OFFSET = 0x040A,
+    SHP_TILE_SIZE = 8,
+    SHP_TILE_COLUMNS = SPR_WIDTH / SHP_TILE_SIZE,
+
+    SHP_PIECE_COUNT_MASK = 0x7F,
+    SHP_SHAPE_MASK = 0x0F,
+    SHP_SHAPE_FLIP_X = 0x40,
+    SHP_SHAPE_FLIP_Y = 0x80,
+};
+
+// Piece sizes in pixels, indexed by the shape.
+static const struct {
+    u8 width;
+    u8 height;
+} _shape_sizes[] = {
+    { 8, 8 },
+    { 16, 8 },
+    { 16, 16 },
+    { 16, 24 },
+    { 24, 8 },
+    { 24, 16 },
+    { 24, 24 },
+    { 32, 8 },
+    { 32, 16 },
+    { 32, 24 },
+    { 32, 32 },
+    { 32, 40 },
+    { 48, 16 },
+    { 40, 32 },
+    { 48, 48 },
+    { 56, 56 },
+};
+
+static shp_frame_t _read_frame(span_t*);
+
+// shp_read reads every frame of the file. Frames with an offset past the end
+// of the file end the table.
+shp_t shp_read(file_entry_e entry) {
+    span_t span = filesystem_read_file(entry);
+
+    shp_t shp = {
+        .frames = memory_allocate(SHP_FRAME_MAX * sizeof(shp_frame_t)),
+    };
+
+    for (int i = 0; i < SHP_FRAME_MAX; i++) {
+        usize offset = SHP_FRAME_DATA_OFFSET + span_readat_u16(&span, SHP_FRAME_TABLE_OFFSET + i * 2);
+        if (offset + 2 > span.size) {
+            break;
+        }
+        span.offset = offset;
+        shp.frames[i] = _read_frame(&span);
+        shp.frame_count++;
+    }
+
+    shp.valid = shp.frame_count > 0;
+    return shp;
+}
+
+void shp_destroy(shp_t shp) {
+    memory_free(shp.frames);
+}
+
+static shp_frame_t _read_frame(span_t* span) {
+    shp_frame_t frame = { 0 };
+
+    int count = span_read_u8(span) & SHP_PIECE_COUNT_MASK;
+    int row = span_read_u8(span);
+
+    for (int i = 0; i < count; i++) {
+        if (span->offset + 4 > span->size) {
+            break;
+        }
+
+        i8 x = span_read_i8(span);
+        i8 y = span_read_i8(span);
+        u8 shape = span_read_u8(span);
+        u8 tile = span_read_u8(span);
+
+        if (frame.piece_count >= SHP_PIECE_MAX) {
+            continue;
+        }
+
+        int size_idx = shape & SHP_SHAPE_MASK;
+        spr_region_t region = {
+            .x = (tile % SHP_TILE_COLUMNS) * SHP_TILE_SIZE,
+            .y = (tile / SHP_TILE_COLUMNS + row) * SHP_TILE_SIZE,
+            .width = _shape_sizes[size_idx].width,
+            .height = _shape_sizes[size_idx].height,
+        };
+
+        // Pieces that don't fit the uncompressed part of the sheet are
+        // skipped, see spr.h.
+        if (region.x + region.width > SPR_WIDTH || region.y + region.height > SPR_HEIGHT) {
+            continue;
+        }
+
+        frame.pieces[frame.piece_count++] = (shp_piece_t) {
+            .region = region,
+            .x = x,
+            .y = y,
+            .flip_x = (shape & SHP_SHAPE_FLIP_X) != 0,
+            .flip_y = (shape & SHP_SHAPE_FLIP_Y) != 0,
+        };
+    }
+
+    return frame;
+}
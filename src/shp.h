@@ -0,0 +1,51 @@
+// SHP files describe how the frames of a unit are composed from pieces of its
+// SPR sheet. Units of the same shape type (TYPE1, TYPE2, MON, ...) share one.
+//
+// 0x0000: u32 offset of the swimming frames (unused)
+// 0x0004: u32 offset of the second half of the sheet (unused)
+// 0x000A: 512 u16 frame offsets, relative to 0x040A
+// 0x040A: Frame data
+//
+// Frame:
+//   u8 piece count (low 7 bits)
+//   u8 sheet row of the tiles, in 8 pixel rows
+//   pieces, 4 bytes each:
+//     i8 x offset from the unit's feet
+//     i8 y offset from the unit's feet
+//     u8 shape, bits 0-3 index the size table, bit 6 flips x, bit 7 flips y
+//     u8 top left tile, 32 tiles of 8x8 pixels per row
+//
+// https://ffhacktics.com/wiki/SHP
+#pragma once
+
+#include <stdbool.h>
+
+#include "filesystem.h"
+#include "spr.h"
+
+enum {
+    SHP_FRAME_MAX = 512,
+    SHP_PIECE_MAX = 16,
+};
+
+typedef struct {
+    spr_region_t region;
+    i8 x;
+    i8 y;
+    bool flip_x;
+    bool flip_y;
+} shp_piece_t;
+
+typedef struct {
+    shp_piece_t pieces[SHP_PIECE_MAX];
+    int piece_count;
+} shp_frame_t;
+
+typedef struct {
+    shp_frame_t* frames;
+    int frame_count;
+    bool valid;
+} shp_t;
+
+shp_t shp_read(file_entry_e);
+void shp_destroy(shp_t);
@@ -0,0 +1,206 @@
+#include <math.h>
+#include <string.h>
+
+#include "sokol_time.h"
+
+#include "map.h"
+#include "memory.h"
+#include "sight.h"
+#include "util.h"
+
+enum {
+    SIGHT_SLAB_THICKNESS = 2, // Half h, upper level tiles are floors this thick
+};
+
+// A ray from tile center to tile center, x and z in tiles and y in half h.
+typedef struct {
+    f32 x0;
+    f32 z0;
+    f32 y0;
+    f32 dx;
+    f32 dz;
+    f32 dy;
+    f32 apex;
+} sight_ray_t;
+
+static bool _trace(const terrain_grid_t*, path_tile_t, path_tile_t, f32);
+static bool _blocked(const terrain_grid_t*, const sight_ray_t*, int, int, f32, f32);
+static f32 _ray_height(const sight_ray_t*, f32);
+
+// sight_line returns true if a unit on one tile can see a unit on the other.
+bool sight_line(const terrain_grid_t* grid, path_tile_t from, path_tile_t to) {
+    return _trace(grid, from, to, 0.0f);
+}
+
+// sight_arc returns true if a projectile can fly from one tile to the other on
+// a parabola that peaks apex half h above the straight line between them.
+bool sight_arc(const terrain_grid_t* grid, path_tile_t from, path_tile_t to, f32 apex) {
+    return _trace(grid, from, to, apex);
+}
+
+// sight_table_create traces a line between every pair of walkable tiles. Lines
+// are symmetric so each pair is traced once.
+sight_table_t* sight_table_create(const terrain_grid_t* grid) {
+    sight_table_t* table = memory_allocate(sizeof(sight_table_t));
+    memset(table, 0, sizeof(sight_table_t));
+
+    int walkable[PATH_NODE_MAX];
+    path_tile_t tiles[PATH_NODE_MAX];
+    int count = 0;
+    for (int i = 0; i < PATH_NODE_MAX; i++) {
+        if (grid->cells[i] & TERRAIN_CELL_WALKABLE) {
+            int tile = i % TERRAIN_TILE_MAX;
+            walkable[count] = i;
+            tiles[count] = (path_tile_t) { tile % grid->x_count, tile / grid->x_count, i / TERRAIN_TILE_MAX };
+            count++;
+        }
+    }
+
+    for (int a = 0; a < count; a++) {
+        int ia = walkable[a];
+        table->bits[ia][ia / 8] |= 1 << (ia % 8);
+        for (int b = a + 1; b < count; b++) {
+            if (_trace(grid, tiles[a], tiles[b], 0.0f)) {
+                int ib = walkable[b];
+                table->bits[ia][ib / 8] |= 1 << (ib % 8);
+                table->bits[ib][ia / 8] |= 1 << (ia % 8);
+            }
+        }
+    }
+    return table;
+}
+
+void sight_table_destroy(sight_table_t* table) {
+    memory_free(table);
+}
+
+bool sight_table_get(const sight_table_t* table, int from, int to) {
+    return (table->bits[from][to / 8] >> (to % 8)) & 1;
+}
+
+// sight_benchmark builds the visibility table of every map.
+sight_bench_t sight_benchmark(void) {
+    sight_bench_t bench = { 0 };
+
+    terrain_grid_t* grids = memory_allocate(MAP_COUNT * sizeof(terrain_grid_t));
+    bench.maps = read_map_terrain_grids(grids);
+
+    // Only building the tables is timed, counting the visible pairs isn't.
+    sight_table_t** tables = memory_allocate(bench.maps * sizeof(sight_table_t*));
+    u64 start = stm_now();
+    for (int m = 0; m < bench.maps; m++) {
+        tables[m] = sight_table_create(&grids[m]);
+    }
+    bench.ms = stm_ms(stm_since(start));
+
+    for (int m = 0; m < bench.maps; m++) {
+        sight_table_t* table = tables[m];
+        for (int a = 0; a < PATH_NODE_MAX; a++) {
+            if (!(grids[m].cells[a] & TERRAIN_CELL_WALKABLE)) {
+                continue;
+            }
+            for (int b = 0; b < PATH_NODE_MAX; b++) {
+                if (grids[m].cells[b] & TERRAIN_CELL_WALKABLE) {
+                    bench.pairs++;
+                    bench.visible += sight_table_get(table, a, b);
+                }
+            }
+        }
+        sight_table_destroy(table);
+    }
+
+    memory_free(tables);
+    memory_free(grids);
+    return bench;
+}
+
+// Trace from the center of one tile to the other, stepping through each
+// column the ray crosses. Only the columns between the two tiles are tested.
+static bool _trace(const terrain_grid_t* grid, path_tile_t from, path_tile_t to, f32 apex) {
+    const u32 from_cell = grid->cells[path_tile_index(grid, from)];
+    const u32 to_cell = grid->cells[path_tile_index(grid, to)];
+    const f32 y0 = terrain_surface_height(from_cell, 0.5f, 0.5f) + SIGHT_EYE_HEIGHT;
+    const f32 y1 = terrain_surface_height(to_cell, 0.5f, 0.5f) + SIGHT_EYE_HEIGHT;
+
+    const sight_ray_t ray = {
+        .x0 = from.x + 0.5f,
+        .z0 = from.z + 0.5f,
+        .y0 = y0,
+        .dx = (f32)to.x - from.x,
+        .dz = (f32)to.z - from.z,
+        .dy = y1 - y0,
+        .apex = apex,
+    };
+
+    // Starting at a tile center the first boundary is half a tile away.
+    const int step_x = ray.dx > 0 ? 1 : -1;
+    const int step_z = ray.dz > 0 ? 1 : -1;
+    const f32 delta_x = ray.dx != 0 ? fabsf(1.0f / ray.dx) : INFINITY;
+    const f32 delta_z = ray.dz != 0 ? fabsf(1.0f / ray.dz) : INFINITY;
+    f32 next_x = delta_x * 0.5f;
+    f32 next_z = delta_z * 0.5f;
+
+    int x = from.x;
+    int z = from.z;
+    f32 t = 0.0f;
+    while (t < 1.0f) {
+        f32 t_exit = MIN(MIN(next_x, next_z), 1.0f);
+
+        bool endpoint = (x == from.x && z == from.z) || (x == to.x && z == to.z);
+        if (!endpoint && _blocked(grid, &ray, x, z, t, t_exit)) {
+            return false;
+        }
+
+        if (next_x < next_z) {
+            x += step_x;
+            t = next_x;
+            next_x += delta_x;
+        } else {
+            z += step_z;
+            t = next_z;
+            next_z += delta_z;
+        }
+    }
+    return true;
+}
+
+// Test the part of the ray from t0 to t1, which is inside the column. The
+// surface is linear across a tile and the ray is a line or a parabola opening
+// down, so the ray is lowest relative to the surface at one of the ends.
+static bool _blocked(const terrain_grid_t* grid, const sight_ray_t* ray, int x, int z, f32 t0, f32 t1) {
+    const int idx = z * grid->x_count + x;
+    const f32 y_in = _ray_height(ray, t0);
+    const f32 y_out = _ray_height(ray, t1);
+
+    const f32 fx_in = ray->x0 + ray->dx * t0 - x;
+    const f32 fz_in = ray->z0 + ray->dz * t0 - z;
+    const f32 fx_out = ray->x0 + ray->dx * t1 - x;
+    const f32 fz_out = ray->z0 + ray->dz * t1 - z;
+
+    const u32 lower = grid->cells[idx];
+    if (y_in < terrain_surface_height(lower, fx_in, fz_in) || y_out < terrain_surface_height(lower, fx_out, fz_out)) {
+        return true;
+    }
+
+    const u32 upper = grid->cells[TERRAIN_TILE_MAX + idx];
+    if (!(upper & TERRAIN_CELL_VALID)) {
+        return false;
+    }
+
+    // The ray is blocked if any of it is inside the upper tile's slab. An arc
+    // can peak inside the column.
+    f32 y_min = MIN(y_in, y_out);
+    f32 y_max = MAX(y_in, y_out);
+    if (ray->apex > 0.0f) {
+        f32 t_peak = 0.5f + ray->dy / (8.0f * ray->apex);
+        if (t_peak > t0 && t_peak < t1) {
+            y_max = MAX(y_max, _ray_height(ray, t_peak));
+        }
+    }
+    f32 top = terrain_surface_height(upper, 0.5f, 0.5f);
+    return y_max > top - SIGHT_SLAB_THICKNESS && y_min < top;
+}
+
+static f32 _ray_height(const sight_ray_t* ray, f32 t) {
+    return ray->y0 + ray->dy * t + 4.0f * ray->apex * t * (1.0f - t);
+}
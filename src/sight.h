@@ -0,0 +1,39 @@
+// Line of sight and projectile arcs over a terrain_grid_t.
+//
+// Rays are traced from eye height above one tile to eye height above another
+// with a 2D DDA over the tile columns between them, so only the columns the
+// ray crosses are tested. A ray is blocked where it passes below the surface
+// of a column, including its slope, or through an upper level tile.
+#pragma once
+
+#include <stdbool.h>
+
+#include "defines.h"
+#include "path.h"
+#include "terrain.h"
+
+enum {
+    SIGHT_EYE_HEIGHT = 5, // Half h above the tile, near the top of a unit
+};
+
+// sight_table_t is the visibility between every pair of walkable tiles of a
+// map, one bit per pair, indexed by the grid's cell indices.
+typedef struct {
+    u8 bits[PATH_NODE_MAX][PATH_NODE_MAX / 8];
+} sight_table_t;
+
+typedef struct {
+    int maps;
+    int pairs;
+    int visible;
+    f64 ms;
+} sight_bench_t;
+
+bool sight_line(const terrain_grid_t*, path_tile_t, path_tile_t);
+bool sight_arc(const terrain_grid_t*, path_tile_t, path_tile_t, f32);
+
+sight_table_t* sight_table_create(const terrain_grid_t*);
+void sight_table_destroy(sight_table_t*);
+bool sight_table_get(const sight_table_t*, int, int);
+
+sight_bench_t sight_benchmark(void);
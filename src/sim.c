@@ -0,0 +1,45 @@
+#include "sokol_time.h"
+
+#include "sim.h"
+
+static sim_t _state;
+
+void sim_init(void) {
+    _state = (sim_t) {
+        .hz = SIM_HZ_DEFAULT,
+        .interpolate = true,
+        .last_time = stm_now(),
+    };
+}
+
+// sim_advance adds the time since the last call and returns how many steps to
+// run this frame. After a long stall, like loading a map, at most
+// SIM_MAX_STEPS are run and the rest of the time is dropped.
+int sim_advance(void) {
+    u64 now = stm_now();
+    _state.accumulator += stm_sec(stm_diff(now, _state.last_time));
+    _state.last_time = now;
+
+    const f64 step = 1.0 / _state.hz;
+    int steps = (int)(_state.accumulator / step);
+    if (steps > SIM_MAX_STEPS) {
+        _state.dropped += steps - SIM_MAX_STEPS;
+        _state.accumulator -= (steps - SIM_MAX_STEPS) * step;
+        steps = SIM_MAX_STEPS;
+    }
+    _state.accumulator -= steps * step;
+    _state.steps += steps;
+    _state.alpha = (f32)(_state.accumulator / step);
+
+    return steps;
+}
+
+// sim_get_alpha returns how far rendering is between the last step and the
+// next, or 0 when interpolation is off.
+f32 sim_get_alpha(void) {
+    return _state.interpolate ? _state.alpha : 0.0f;
+}
+
+sim_t* sim_get_internals(void) {
+    return &_state;
+}
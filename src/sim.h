@@ -0,0 +1,30 @@
+// sim is the fixed timestep clock the VM and animations advance on. Each frame
+// runs as many simulation steps as the elapsed time covers, so playback speed
+// doesn't depend on the display's refresh rate. Time left over is kept for
+// the next frame and used to interpolate rendering between steps.
+#pragma once
+
+#include <stdbool.h>
+
+#include "defines.h"
+
+enum {
+    SIM_HZ_DEFAULT = 60,
+    SIM_MAX_STEPS = 8, // Steps per frame before time is dropped
+};
+
+typedef struct {
+    int hz;           // Steps per second, the PSX ran at 30 or 60
+    bool interpolate; // Render between steps instead of at the last one
+
+    f64 accumulator; // Seconds not yet simulated
+    f32 alpha;       // accumulator in steps, 0-1
+    u64 last_time;
+    usize steps;     // Total steps run
+    usize dropped;   // Steps skipped after falling too far behind
+} sim_t;
+
+void sim_init(void);
+int sim_advance(void);
+f32 sim_get_alpha(void);
+sim_t* sim_get_internals(void);
@@ -15,6 +15,22 @@ void span_read_bytes(span_t* f, usize size, u8* out_bytes) {
     return;
 }
 
+// span_read_ptr returns a pointer to the next size bytes, for kernels that
+// decode straight from the span, and moves past them.
+const u8* span_read_ptr(span_t* span, usize size) {
+    ASSERT(span->offset + size <= span->size, "Out of bounds read.");
+    const u8* ptr = &span->data[span->offset];
+    span->offset += size;
+    return ptr;
+}
+
+// span_readat_ptr is span_read_ptr starting at offset.
+const u8* span_readat_ptr(span_t* span, usize offset, usize size) {
+    ASSERT(offset + size <= span->size, "Out of bounds read.");
+    span->offset = offset + size;
+    return &span->data[offset];
+}
+
 // This returns a f32, but stored as a fixed-point number.
 // 1 bit   - sign bit
 // 3 bits  - whole
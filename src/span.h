@@ -14,6 +14,8 @@ typedef struct {
 } span_t;
 
 void span_read_bytes(span_t*, usize, u8*);
+const u8* span_read_ptr(span_t*, usize);
+const u8* span_readat_ptr(span_t*, usize, usize);
 
 u8 span_read_u8(span_t*);
 u16 span_read_u16(span_t*);
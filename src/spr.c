@@ -0,0 +1,56 @@
+#include <string.h>
+
+#include "memory.h"
+#include "pixel.h"
+#include "spr.h"
+#include "util.h"
+
+enum {
+    SPR_ROW_SIZE = SPR_WIDTH / 2, // Two pixels per byte
+};
+
+// spr_is_sheet returns true for the BATTLE/*.SPR files.
+bool spr_is_sheet(file_entry_e entry) {
+    const char* name = file_list[entry].name;
+    usize len = strlen(name);
+    return strncmp(name, "BATTLE/", 7) == 0 && len > 4 && strcmp(&name[len - 4], ".SPR") == 0;
+}
+
+// spr_read_palette reads the first count palettes, one row of 16 colors each.
+image_t spr_read_palette(span_t* span, int count) {
+    ASSERT(count <= SPR_PALETTE_COUNT, "SPR files have %d palettes", SPR_PALETTE_COUNT);
+    span->offset = 0;
+    return image_read_palette(span, count);
+}
+
+// spr_read_region decodes only the rows and columns of the region, as palette
+// indices. The rest of the sheet is not touched.
+image_t spr_read_region(span_t* span, spr_region_t region) {
+    ASSERT(region.x >= 0 && region.y >= 0 && region.width > 0 && region.height > 0, "Invalid SPR region");
+    ASSERT(region.x + region.width <= SPR_WIDTH && region.y + region.height <= SPR_HEIGHT, "SPR region out of bounds");
+
+    const int size = region.width * region.height;
+    u8* data = memory_allocate(size);
+
+    // Decode whole bytes covering the region, then copy the region out of
+    // them. x is odd when the region starts on a high nibble.
+    const int first_byte = region.x / 2;
+    const int last_byte = (region.x + region.width + 1) / 2;
+    const int skip = region.x % 2;
+
+    u8 row[SPR_WIDTH];
+    for (int y = 0; y < region.height; y++) {
+        usize offset = SPR_DATA_OFFSET + (region.y + y) * SPR_ROW_SIZE + first_byte;
+        pixel_4bpp_to_r8(span_readat_ptr(span, offset, last_byte - first_byte), row, last_byte - first_byte);
+        memcpy(&data[y * region.width], &row[skip], region.width);
+    }
+
+    return (image_t) {
+        .width = region.width,
+        .height = region.height,
+        .data = data,
+        .size = size,
+        .format = IMAGE_FORMAT_R8,
+        .valid = true,
+    };
+}
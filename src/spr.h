@@ -0,0 +1,33 @@
+// SPR files are the unit sprite sheets in BATTLE/.
+//
+// 0x0000: 16 palettes of 16 BGR555 colors. The first 8 are for the unit and
+//         the rest for its portrait.
+// 0x0200: 256x256 4bpp pixels, uncompressed. This has all the battle frames.
+// 0x8200: Portraits and extra rows, compressed. Not decoded.
+//
+// https://ffhacktics.com/wiki/SPR
+#pragma once
+
+#include "filesystem.h"
+#include "image.h"
+#include "span.h"
+
+enum {
+    SPR_WIDTH = 256,
+    SPR_HEIGHT = 256,
+    SPR_DATA_OFFSET = 0x200,
+    SPR_PALETTE_COUNT = 16,
+    SPR_UNIT_PALETTE_COUNT = 8,
+};
+
+// spr_region_t is a rectangle of the sheet in pixels.
+typedef struct {
+    int x;
+    int y;
+    int width;
+    int height;
+} spr_region_t;
+
+bool spr_is_sheet(file_entry_e);
+image_t spr_read_palette(span_t*, int);
+image_t spr_read_region(span_t*, spr_region_t);
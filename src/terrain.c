@@ -2,6 +2,8 @@
 #include "util.h"
 #include <string.h>
 
+static u32 _pack_cell(const tile_t*, int);
+
 terrain_t read_terrain(span_t* span) {
     terrain_t terrain = { 0 };
 
@@ -55,9 +57,83 @@ terrain_t read_terrain(span_t* span) {
     terrain.x_count = x_count;
     terrain.z_count = z_count;
     terrain.valid = true;
+    terrain.grid = terrain_grid_create(&terrain);
     return terrain;
 }
 
+// terrain_grid_create packs the tiles for movement queries.
+terrain_grid_t terrain_grid_create(const terrain_t* terrain) {
+    terrain_grid_t grid = {
+        .x_count = terrain->x_count,
+        .z_count = terrain->z_count,
+    };
+
+    int tile_count = terrain->x_count * terrain->z_count;
+    for (int level = 0; level < TERRAIN_LEVEL_COUNT; level++) {
+        for (int i = 0; i < tile_count; i++) {
+            u32 cell = _pack_cell(&terrain->tiles[level][i], level);
+            grid.cells[level * TERRAIN_TILE_MAX + i] = cell;
+
+            if ((cell & TERRAIN_CELL_WALKABLE) && ((cell >> TERRAIN_CELL_DEPTH_SHIFT) & TERRAIN_CELL_DEPTH_MASK) > 0) {
+                grid.has_depth = true;
+            }
+        }
+    }
+    return grid;
+}
+
+// terrain_surface_height returns the height of a packed cell's surface at fx,
+// fz (0-1 across the tile) in half h.
+// Inclines rise across the tile, north is -z and east is +x. Convex and
+// concave corners use the height at the center.
+f32 terrain_surface_height(u32 cell, f32 fx, f32 fz) {
+    const f32 center = cell & TERRAIN_CELL_HEIGHT_MASK;
+    const f32 rise = 2.0f * ((cell >> TERRAIN_CELL_SLOPE_HEIGHT_SHIFT) & TERRAIN_CELL_SLOPE_HEIGHT_MASK);
+    const f32 bottom = center - rise * 0.5f;
+
+    switch ((slope_e)((cell >> TERRAIN_CELL_SLOPE_SHIFT) & TERRAIN_CELL_SLOPE_MASK)) {
+    case SLOPE_FLAT:
+        return center;
+    case SLOPE_INCLINE_N:
+        return bottom + rise * (1.0f - fz);
+    case SLOPE_INCLINE_S:
+        return bottom + rise * fz;
+    case SLOPE_INCLINE_E:
+        return bottom + rise * fx;
+    case SLOPE_INCLINE_W:
+        return bottom + rise * (1.0f - fx);
+    default:
+        return center;
+    }
+}
+
+// The lower level covers the whole map. Upper level tiles only exist where
+// something is on top of the lower tile, empty ones are all zero.
+static u32 _pack_cell(const tile_t* tile, int level) {
+    bool exists = level == 0 || tile->surface != 0 || tile->sloped_height_bottom != 0 || tile->slope != SLOPE_FLAT;
+    if (!exists) {
+        return 0;
+    }
+
+    u32 height = tile->sloped_height_bottom * 2 + tile->sloped_height_top;
+    u32 cell = (height & TERRAIN_CELL_HEIGHT_MASK)
+        | ((u32)(tile->depth & TERRAIN_CELL_DEPTH_MASK) << TERRAIN_CELL_DEPTH_SHIFT)
+        | ((u32)(tile->slope & TERRAIN_CELL_SLOPE_MASK) << TERRAIN_CELL_SLOPE_SHIFT)
+        | ((u32)(tile->sloped_height_top & TERRAIN_CELL_SLOPE_HEIGHT_MASK) << TERRAIN_CELL_SLOPE_HEIGHT_SHIFT)
+        | TERRAIN_CELL_VALID;
+
+    if (!tile->cant_walk) {
+        cell |= TERRAIN_CELL_WALKABLE;
+    }
+    if (!tile->cant_select) {
+        cell |= TERRAIN_CELL_SELECTABLE;
+    }
+    if (tile->pass_through_only) {
+        cell |= TERRAIN_CELL_PASS_THROUGH;
+    }
+    return cell;
+}
+
 const char* terrain_surface_str(surface_e value) {
     switch (value) {
 #define X(oname, ovalue, ostring) \
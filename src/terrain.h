@@ -15,7 +15,20 @@ enum {
 
     UNIT_HEIGHT = TILE_HEIGHT * 3, // Regular unit
 
-    TERRAIN_STR_SIZE = 128
+    TERRAIN_STR_SIZE = 128,
+
+    // Fields of a packed terrain_grid_t cell.
+    TERRAIN_CELL_HEIGHT_MASK = 0x3FF, // Bits 0-9, height of the tile center in half h
+    TERRAIN_CELL_DEPTH_SHIFT = 10,    // Bits 10-12
+    TERRAIN_CELL_DEPTH_MASK = 0x7,
+    TERRAIN_CELL_SLOPE_SHIFT = 13, // Bits 13-20, slope_e
+    TERRAIN_CELL_SLOPE_MASK = 0xFF,
+    TERRAIN_CELL_VALID = 1 << 21,
+    TERRAIN_CELL_WALKABLE = 1 << 22,
+    TERRAIN_CELL_SELECTABLE = 1 << 23,
+    TERRAIN_CELL_PASS_THROUGH = 1 << 24,
+    TERRAIN_CELL_SLOPE_HEIGHT_SHIFT = 25, // Bits 25-29, sloped_height_top
+    TERRAIN_CELL_SLOPE_HEIGHT_MASK = 0x1F,
 };
 
 #define SURFACE_INDEX                                   \
@@ -108,14 +121,27 @@ typedef struct {
     bool cant_select;
 } tile_t;
 
+// terrain_grid_t packs what movement queries need from each tile into 32
+// bits, so both levels of a map fit in 2KB. Cells are indexed by
+// level * TERRAIN_TILE_MAX + z * x_count + x.
+typedef struct {
+    u32 cells[TERRAIN_LEVEL_COUNT * TERRAIN_TILE_MAX];
+    u8 x_count;
+    u8 z_count;
+    bool has_depth; // Some walkable tile costs extra to enter
+} terrain_grid_t;
+
 typedef struct {
     tile_t tiles[TERRAIN_LEVEL_COUNT][TERRAIN_TILE_MAX];
+    terrain_grid_t grid;
     u8 x_count;
     u8 z_count;
     bool valid;
 } terrain_t;
 
 terrain_t read_terrain(span_t*);
+terrain_grid_t terrain_grid_create(const terrain_t*);
+f32 terrain_surface_height(u32, f32, f32);
 const char* terrain_surface_str(surface_e);
 const char* terrain_slope_str(slope_e);
 const char* terrain_shading_str(u8);
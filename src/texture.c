@@ -10,7 +10,7 @@ texture_t texture_create(image_t image) {
     desc.height = image.height;
     desc.data.subimage[0][0].size = image.size;
     desc.data.subimage[0][0].ptr = image.data;
-    desc.pixel_format = SG_PIXELFORMAT_RGBA8;
+    desc.pixel_format = image.format == IMAGE_FORMAT_R8 ? SG_PIXELFORMAT_R8 : SG_PIXELFORMAT_RGBA8;
 
     sg_image gpu_image = sg_make_image(&desc);
 
@@ -21,6 +21,31 @@ texture_t texture_create(image_t image) {
     return texture;
 }
 
+// texture_create_dynamic creates a texture without contents that is filled
+// with texture_update(). sokol_gfx allows one update per frame.
+texture_t texture_create_dynamic(int width, int height, image_format_e format) {
+    sg_image_desc desc = {0};
+    desc.width = width;
+    desc.height = height;
+    desc.usage = SG_USAGE_DYNAMIC;
+    desc.pixel_format = format == IMAGE_FORMAT_R8 ? SG_PIXELFORMAT_R8 : SG_PIXELFORMAT_RGBA8;
+
+    texture_t texture = {0};
+    texture.width = width;
+    texture.height = height;
+    texture.gpu_image = sg_make_image(&desc);
+    return texture;
+}
+
+// texture_update replaces the contents of a dynamic texture. The image must
+// have the texture's size and format.
+void texture_update(texture_t texture, image_t image) {
+    sg_image_data data = {0};
+    data.subimage[0][0].size = image.size;
+    data.subimage[0][0].ptr = image.data;
+    sg_update_image(texture.gpu_image, &data);
+}
+
 void texture_destroy(texture_t texture) {
     sg_destroy_image(texture.gpu_image);
 }
@@ -12,6 +12,8 @@ typedef struct {
 } texture_t;
 
 texture_t texture_create(image_t);
+texture_t texture_create_dynamic(int, int, image_format_e);
+void texture_update(texture_t, image_t);
 void texture_destroy(texture_t);
 bool texture_valid(texture_t);
 u64 texture_imgui_id(texture_t); // Maybe move to gui.h/c
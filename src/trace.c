@@ -0,0 +1,115 @@
+#include <stdio.h>
+
+#include "sokol_time.h"
+
+#include "memory.h"
+#include "trace.h"
+
+// All loading happens on the main thread, so there is one buffer. Spans are
+// pushed on a stack when they begin and written to the buffer when they end,
+// so parents come after their children.
+static struct {
+    trace_event_t* events;
+    int count;
+    int dropped;
+    bool capturing;
+    u64 capture_start;
+
+    struct {
+        const char* name;
+        u64 start;
+    } stack[TRACE_DEPTH_MAX];
+    int depth;
+} _state;
+
+void trace_shutdown(void) {
+    if (_state.events != NULL) {
+        memory_free(_state.events);
+        _state.events = NULL;
+    }
+    _state.count = 0;
+    _state.capturing = false;
+}
+
+// trace_start clears the buffer and starts capturing spans.
+void trace_start(void) {
+    if (_state.events == NULL) {
+        _state.events = memory_allocate(TRACE_EVENT_MAX * sizeof(trace_event_t));
+    }
+    _state.count = 0;
+    _state.dropped = 0;
+    _state.depth = 0;
+    _state.capture_start = stm_now();
+    _state.capturing = true;
+}
+
+// trace_stop stops capturing. The captured spans are kept until the next
+// trace_start so they can be exported.
+void trace_stop(void) {
+    _state.capturing = false;
+    _state.depth = 0;
+}
+
+void trace_begin(const char* name) {
+    if (!_state.capturing) {
+        return;
+    }
+    if (_state.depth < TRACE_DEPTH_MAX) {
+        _state.stack[_state.depth].name = name;
+        _state.stack[_state.depth].start = stm_now();
+    }
+    _state.depth++;
+}
+
+void trace_end(void) {
+    if (!_state.capturing || _state.depth == 0) {
+        return;
+    }
+    _state.depth--;
+    if (_state.depth >= TRACE_DEPTH_MAX) {
+        return;
+    }
+    if (_state.count == TRACE_EVENT_MAX) {
+        _state.dropped++;
+        return;
+    }
+
+    _state.events[_state.count++] = (trace_event_t) {
+        .name = _state.stack[_state.depth].name,
+        .start = _state.stack[_state.depth].start,
+        .end = stm_now(),
+        .depth = _state.depth,
+    };
+}
+
+// trace_export writes the captured spans to path in the Chrome trace event
+// format, as complete ("X") events in microseconds since the capture started.
+bool trace_export(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        return false;
+    }
+
+    fprintf(file, "{\"traceEvents\":[\n");
+    for (int i = 0; i < _state.count; i++) {
+        const trace_event_t* event = &_state.events[i];
+        fprintf(file, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f}%s\n",
+            event->name,
+            stm_us(stm_diff(event->start, _state.capture_start)),
+            stm_us(stm_diff(event->end, event->start)),
+            i + 1 < _state.count ? "," : "");
+    }
+    fprintf(file, "],\"displayTimeUnit\":\"ms\"}\n");
+
+    bool ok = ferror(file) == 0;
+    fclose(file);
+    return ok;
+}
+
+trace_stats_t trace_get_stats(void) {
+    return (trace_stats_t) {
+        .count = _state.count,
+        .dropped = _state.dropped,
+        .capturing = _state.capturing,
+    };
+}
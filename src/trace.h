@@ -0,0 +1,44 @@
+// trace records nested spans of time while a capture is running and exports
+// them as Chrome trace events, for chrome://tracing or Perfetto.
+//
+// Usage:
+//   TRACE_BEGIN();
+//   ... work, every return must be preceded by TRACE_END() ...
+//   TRACE_END();
+//
+// Outside of a capture TRACE_BEGIN and TRACE_END only check a flag.
+#pragma once
+
+#include <stdbool.h>
+
+#include "defines.h"
+
+enum {
+    TRACE_EVENT_MAX = 1 << 16,
+    TRACE_DEPTH_MAX = 64,
+};
+
+#define TRACE_BEGIN() trace_begin(__func__)
+#define TRACE_END() trace_end()
+
+// A completed span. Times are in ticks of sokol_time.
+typedef struct {
+    const char* name;
+    u64 start;
+    u64 end;
+    int depth;
+} trace_event_t;
+
+typedef struct {
+    int count;
+    int dropped; // Spans that didn't fit in the buffer
+    bool capturing;
+} trace_stats_t;
+
+void trace_shutdown(void);
+void trace_start(void);
+void trace_stop(void);
+void trace_begin(const char*);
+void trace_end(void);
+bool trace_export(const char*);
+trace_stats_t trace_get_stats(void);
@@ -1,6 +1,7 @@
 // Thanks to Glain and the FFTPatcher project for some of the data in the lists.
 #include "unit.h"
 #include "filesystem.h"
+#include "trace.h"
 #include "util.h"
 #include <string.h>
 
@@ -64,6 +65,7 @@ unit_t read_unit(span_t* span) {
 }
 
 units_t unit_get_units(int entd_id) {
+    TRACE_BEGIN();
     file_entry_e entry = find_unit_file(entd_id);
     span_t span = filesystem_read_file(entry);
 
@@ -80,6 +82,7 @@ units_t unit_get_units(int entd_id) {
 
         units.units[units.count++] = unit;
     }
+    TRACE_END();
     return units;
 }
 
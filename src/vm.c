@@ -26,6 +26,8 @@ void vm_init(void) {
     _state.handlers[OPCODE_CAMERA] = vm_func_camera;
     _state.handlers[OPCODE_WAITFORINSTRUCTION] = vm_func_wait_for_instruction;
     _state.handlers[OPCODE_WARPUNIT] = vm_func_warp_unit;
+    _state.handlers[OPCODE_WALKTO] = vm_func_walk_to;
+    _state.handlers[OPCODE_FOCUS] = vm_func_focus;
 }
 
 // Reset the virtual machine state
@@ -3,6 +3,7 @@
 #include "defines.h"
 #include "filesystem.h"
 #include "span.h"
+#include "trace.h"
 #include "util.h"
 #include "vm_event.h"
 #include "vm_instruction.h"
@@ -12,12 +13,14 @@ static event_t read_event(span_t*);
 
 event_t vm_event_get_event(int id) {
     ASSERT(id < VM_EVENT_COUNT, "Event id %d out of bounds", id);
+    TRACE_BEGIN();
     span_t file = filesystem_read_file(F_EVENT__TEST_EVT);
     span_t span = {
         .data = file.data + (id * VM_EVENT_SIZE),
         .size = VM_EVENT_SIZE,
     };
     event_t event = read_event(&span);
+    TRACE_END();
     return event;
 }
 
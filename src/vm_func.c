@@ -1,3 +1,5 @@
+#include <math.h>
+
 #include "vm_func.h"
 
 #include "camera.h"
@@ -39,7 +41,7 @@ void vm_func_display_message(const instruction_t* instr) {
     y = GFX_RENDER_HEIGHT / 2 + y;
 
     sprite_t* sprites = gfx_sprite_get_internals();
-    texture_t texture = sprite_get_paletted_texture(F_EVENT__FRAME_BIN, 0);
+    sprite_sheet_t sheet = gfx_sprite_get_sheet(F_EVENT__FRAME_BIN);
     sprite_t* sprite = &sprites[0];
 
     transform_t transform = {
@@ -47,7 +49,7 @@ void vm_func_display_message(const instruction_t* instr) {
         .rotation = { { 0.0f, 0.0f, 0.0f } },
         .scale = { { 20.0f, 20.0f, 20.0f } },
     };
-    *sprite = gfx_sprite_create(SPRITE_2D, texture, (vec2s) { { 0.0f, 0.0f } }, (vec2s) { { 32, 32 } }, transform);
+    *sprite = gfx_sprite_create(SPRITE_2D, sheet, 0, (vec2s) { { 0.0f, 0.0f } }, (vec2s) { { 32, 32 } }, transform);
 
     vm_transition_add(instr->opcode, &sprite->transform.scale, 20.0f, 80.0f, speed);
     vm_transition_add(instr->opcode, &sprite->transform.scale, 20.0f, 40.0f, speed);
@@ -101,20 +103,79 @@ void vm_func_warp_unit(const instruction_t* instr) {
 
     // FIXME: unit_id is probably not what we want to use here, but we aren't working
     // with units yet so ignore for now.
-    if (unit_id >= 100) {
+    if (unit_id >= SPRITE_ANIM_FIRST) {
         printf("Invalid unit id %d\n", unit_id);
         return;
     }
 
-    texture_t texture = sprite_get_paletted_texture(F_EVENT__UNIT_BIN, 0);
+    // The unit stands on the map, so it is placed in mesh space and follows the
+    // map when it is rotated.
+    sprite_sheet_t sheet = gfx_sprite_get_sheet(F_EVENT__UNIT_BIN);
     transform_t transform = {
-        .translation = { { tile_x * 24.0f, elevation * 5.0f, tile_y * 24.0f } },
+        .translation = scene_tile_map_position(tile_x, tile_y, elevation),
         .rotation = { { 0.0f, facing * 90.0f, 0.0f } },
         .scale = { { 15.0f, 15.0f, 15.0f } }
     };
 
     sprite_t* sprite = &gfx_sprite_get_internals()[unit_id];
-    *sprite = gfx_sprite_create(SPRITE_3D, texture, (vec2s) { { unit_id * 32.0f, 0.0f } }, (vec2s) { { 32.0f, 40.0f } }, transform);
+    *sprite = gfx_sprite_create(SPRITE_3D, sheet, 0, (vec2s) { { unit_id * 32.0f, 0.0f } }, (vec2s) { { 32.0f, 40.0f } }, transform);
+    sprite->on_map = true;
 
     (void)unused;
 }
+
+void vm_func_walk_to(const instruction_t* instr) {
+    u8 unit_id = instr->params[0].value.u8;
+    u8 tile_x = instr->params[2].value.u8;
+    u8 tile_y = instr->params[3].value.u8;
+    u8 elevation = instr->params[4].value.u8; // 0x00 lower, 0x01 upper
+
+    if (unit_id >= SPRITE_ANIM_FIRST) {
+        printf("Invalid unit id %d\n", unit_id);
+        return;
+    }
+
+    sprite_t* sprite = &gfx_sprite_get_internals()[unit_id];
+    if (!sprite->sheet.valid) {
+        return;
+    }
+
+    // Walk in a straight line in mesh space, a fixed number of frames per tile.
+    vec3s* from = &sprite->transform.translation;
+    vec3s to = scene_tile_map_position(tile_x, tile_y, elevation);
+    f32 tiles = fmaxf(fabsf(to.x - from->x), fabsf(to.z - from->z)) / TILE_WIDTH;
+    f32 duration = fmaxf(tiles * 8.0f, 1.0f);
+
+    vm_transition_add(instr->opcode, &from->x, from->x, to.x, duration);
+    vm_transition_add(instr->opcode, &from->y, from->y, to.y, duration);
+    vm_transition_add(instr->opcode, &from->z, from->z, to.z, duration);
+}
+
+void vm_func_focus(const instruction_t* instr) {
+    camera_t* cam = camera_get_internals();
+
+    u8 unit_id = instr->params[0].value.u8;
+
+    if (unit_id >= SPRITE_ANIM_FIRST) {
+        printf("Invalid unit id %d\n", unit_id);
+        return;
+    }
+
+    // Focus on the unit where WarpUnit or WalkTo last put it.
+    const sprite_t* sprite = &gfx_sprite_get_internals()[unit_id];
+    if (!sprite->sheet.valid) {
+        return;
+    }
+
+    vec3s target = sprite->transform.translation;
+    if (sprite->on_map) {
+        target = scene_map_to_world(target);
+    }
+
+    vec3s position = camera_focus_position(target);
+    f32 duration = 30.0f;
+
+    vm_transition_add(instr->opcode, &cam->position.x, cam->position.x, position.x, duration);
+    vm_transition_add(instr->opcode, &cam->position.y, cam->position.y, position.y, duration);
+    vm_transition_add(instr->opcode, &cam->position.z, cam->position.z, position.z, duration);
+}
@@ -9,3 +9,5 @@ void vm_func_display_message(const instruction_t*);
 void vm_func_camera(const instruction_t*);
 void vm_func_wait_for_instruction(const instruction_t*);
 void vm_func_warp_unit(const instruction_t*);
+void vm_func_walk_to(const instruction_t*);
+void vm_func_focus(const instruction_t*);
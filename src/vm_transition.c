@@ -32,6 +32,23 @@ void vm_transition_update(void) {
     }
 }
 
+// vm_transition_interpolate writes the values the transitions have alpha of a
+// step after the last update. Transitions are linear in steps, so this is
+// their exact value at that time. The next update continues from the step
+// count, not from the written value. Transitions only advance while the VM is
+// executing, so nothing is written otherwise.
+void vm_transition_interpolate(f32 alpha) {
+    if (!vm_is_executing() || alpha <= 0.0f) {
+        return;
+    }
+
+    for (usize i = 0; i < _state.transaction_count; i++) {
+        transition_t* t = &_state.transitions[i];
+        f32 progress = glm_clamp((t->frame_current + alpha) / t->frame_total, 0.0f, 1.0f);
+        *(f32*)(t->target) = t->start + (t->end - t->start) * progress;
+    }
+}
+
 void vm_transition_add(opcode_e opcode, void* target, f32 start, f32 end, f32 duration) {
     ASSERT(_state.transaction_count <= VM_TRANSITION_MAX, "Too many transitions");
 
@@ -27,5 +27,6 @@ typedef struct {
 
 void vm_transition_reset(void);
 void vm_transition_update(void);
+void vm_transition_interpolate(f32);
 void vm_transition_add(opcode_e, void*, f32, f32, f32);
 bool vm_transition_has_active(waittype_e);